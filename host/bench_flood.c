@@ -0,0 +1,174 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+/* Flooding peer benchmark of the host build: FLOOD_CONNS threads, all of one peer, connect to the Wish TCP server over loopback and
+ * write to it as fast as it reads. What the core makes of the data is up to the core: when it closes a connection, the thread
+ * connects again, so the flood loads the accept, read and close paths of the main loop alike. The main loop runs a timer every
+ * BENCH_TICK_MS, and the lateness of the timer shows how much the flood delays the rest of the work of the main loop. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "wish_connection.h"
+#include "port_net.h"
+#include "port_main.h"
+#include "bench_util.h"
+#include "bench_flood.h"
+
+#define FLOOD_CONNS 4
+#define FLOOD_CHUNK 1460
+
+static volatile bool flood_stop;
+static uint16_t server_port;
+
+/* Per flooding thread, summed up after the threads have been joined */
+static uint64_t bytes_sent[FLOOD_CONNS];
+static uint32_t connects[FLOOD_CONNS];
+
+static int connect_to_server(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    /* A write blocked on a connection which the port has stopped reading must not keep the thread from seeing flood_stop */
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    struct sockaddr_in dst = { .sin_family = AF_INET, .sin_port = htons(server_port) };
+    inet_pton(AF_INET, "127.0.0.1", &dst.sin_addr);
+    if (connect(fd, (struct sockaddr *) &dst, sizeof(dst)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void *flood_thread(void *arg) {
+    int id = (int) (intptr_t) arg;
+    uint8_t buf[FLOOD_CHUNK];
+    memset(buf, 0xa5, sizeof(buf));
+    while (!flood_stop) {
+        int fd = connect_to_server();
+        if (fd < 0) {
+            /* The backlog is full, or the server is being re-armed */
+            usleep(1000);
+            continue;
+        }
+        connects[id]++;
+        while (!flood_stop) {
+            ssize_t ret = write(fd, buf, sizeof(buf));
+            if (ret > 0) {
+                bytes_sent[id] += ret;
+            }
+            else if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                /* Closed by the port */
+                break;
+            }
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+static void run(const char *name, struct bench_samples *lateness, unsigned int seconds) {
+    struct mist_port_esp32_accept_stats before, after;
+    mist_port_esp32_get_accept_stats(&before);
+    memset(bytes_sent, 0, sizeof(bytes_sent));
+    memset(connects, 0, sizeof(connects));
+    lateness->len = 0;
+    flood_stop = false;
+
+    pthread_t threads[FLOOD_CONNS];
+    for (int i = 0; i < FLOOD_CONNS; i++) {
+        pthread_create(&threads[i], NULL, flood_thread, (void *) (intptr_t) i);
+    }
+
+    bench_lateness_start(lateness, NULL);
+    uint64_t end_ns = bench_now_ns() + (uint64_t) seconds * 1000000000;
+    while (bench_now_ns() < end_ns) {
+        mist_port_esp32_periodic(BENCH_TICK_MS);
+    }
+    bench_lateness_stop();
+
+    /* Keep the main loop running while the threads notice flood_stop, so that none of them stays blocked in connect() or write() */
+    flood_stop = true;
+    uint64_t drain_end_ns = bench_now_ns() + 300000000;
+    while (bench_now_ns() < drain_end_ns) {
+        mist_port_esp32_periodic(BENCH_TICK_MS);
+    }
+    for (int i = 0; i < FLOOD_CONNS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    /* Let the port see the connections of this case closing, so that they do not count in the next one */
+    drain_end_ns = bench_now_ns() + 200000000;
+    while (bench_now_ns() < drain_end_ns) {
+        mist_port_esp32_periodic(BENCH_TICK_MS);
+    }
+    mist_port_esp32_get_accept_stats(&after);
+
+    uint64_t total_bytes = 0;
+    uint32_t total_connects = 0;
+    for (int i = 0; i < FLOOD_CONNS; i++) {
+        total_bytes += bytes_sent[i];
+        total_connects += connects[i];
+    }
+    bench_samples_sort(lateness);
+    printf("%-16s %8u %8u %8u %12llu %10u %10u %10u\n", name, bench_samples_percentile(lateness, 50), 
+            bench_samples_percentile(lateness, 99), bench_samples_percentile(lateness, 100), 
+            (unsigned long long) (total_bytes / seconds), total_connects, after.accepted - before.accepted, 
+            after.rejected_pool_full - before.rejected_pool_full);
+}
+
+int host_bench_flood(unsigned int seconds) {
+    wish_core_t *core = port_net_get_core();
+    server_port = wish_get_host_port(core);
+    if (server_port == 0) {
+        fprintf(stderr, "The Wish server is not running\n");
+        return -1;
+    }
+
+    struct bench_samples lateness;
+    if (bench_samples_init(&lateness, (size_t) seconds * 1000 / BENCH_TICK_MS + 1) != 0) {
+        return -1;
+    }
+
+    printf("One peer flooding the Wish server on port %u over %u connections, a timer every %u ms\n", server_port, FLOOD_CONNS, 
+            BENCH_TICK_MS);
+    printf("%-16s %8s %8s %8s %12s %10s %10s %10s\n", "timer late/us", "p50", "p99", "max", "bytes/s", "connects", "accepted", 
+            "pool full");
+
+    struct mist_port_esp32_budget defaults;
+    mist_port_esp32_get_budget(&defaults);
+    /* As if there were no budgets: a readable connection is read until the socket would block or its ring buffer
+     * is full, and all queued events are handled */
+    struct mist_port_esp32_budget unbounded = { UINT_MAX, UINT_MAX, UINT_MAX, UINT_MAX };
+    mist_port_esp32_set_budget(&unbounded);
+    run("unbounded", &lateness, seconds);
+    mist_port_esp32_set_budget(&defaults);
+    run("default", &lateness, seconds);
+    /* One segment per connection and a few events per iteration */
+    struct mist_port_esp32_budget tight = { 4, 4, MIST_PORT_RX_SCRATCH_SZ, MIST_PORT_BULK_TX_BUDGET };
+    mist_port_esp32_set_budget(&tight);
+    run("tight", &lateness, seconds);
+
+    mist_port_esp32_set_budget(&defaults);
+    bench_samples_free(&lateness);
+    return 0;
+}
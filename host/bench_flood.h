@@ -0,0 +1,21 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * Measure how responsive the main loop stays while one peer floods the Wish TCP server with data on several connections as fast as
+ * loopback takes it: with budgets so big that they never limit the work of one main loop iteration, with the default budgets, and
+ * with tight budgets. Each case runs for the given number of seconds.
+ *
+ * @return 0, or -1 if the Wish server is not running
+ */
+int host_bench_flood(unsigned int seconds);
@@ -0,0 +1,154 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+/* Round-trip benchmark of the host build: invoke-sized request/reply exchanges over a loopback TCP connection, first with the stack
+ * default socket options and then with the socket option profiles of the port applied, as outgoing and incoming Wish connections
+ * get them. Both ends write a message as a 2-byte header and a body, as the Wish transport does, which is the pattern where the
+ * Nagle algorithm and delayed ACKs add latency. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "port_sockopt.h"
+#include "bench_rtt.h"
+
+/* A typical Mist invoke request and reply, with the frame overhead */
+#define REQUEST_LEN 120
+#define REPLY_LEN 200
+
+static int read_full(int fd, uint8_t *buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t ret = read(fd, buf + got, len - got);
+        if (ret <= 0) {
+            return -1;
+        }
+        got += ret;
+    }
+    return 0;
+}
+
+static int send_message(int fd, const uint8_t *body, size_t len) {
+    uint8_t hdr[2] = { len >> 8, len & 0xff };
+    if (write(fd, hdr, sizeof(hdr)) != sizeof(hdr) || write(fd, body, len) != (ssize_t) len) {
+        return -1;
+    }
+    return 0;
+}
+
+static int recv_message(int fd, uint8_t *body, size_t max_len) {
+    uint8_t hdr[2];
+    if (read_full(fd, hdr, sizeof(hdr)) != 0) {
+        return -1;
+    }
+    size_t len = (hdr[0] << 8) | hdr[1];
+    if (len > max_len || read_full(fd, body, len) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* The peer: replies to each request until the connection is closed */
+static void *responder(void *arg) {
+    int fd = *((int *) arg);
+    uint8_t buf[REPLY_LEN];
+    memset(buf, 0, sizeof(buf));
+    while (recv_message(fd, buf, sizeof(buf)) == 0) {
+        if (send_message(fd, buf, REPLY_LEN) != 0) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int run(bool with_profiles, unsigned int seconds, double *invokes_per_s, double *mean_rtt_us) {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(listen_fd, 1) != 0
+            || getsockname(listen_fd, (struct sockaddr *) &addr, &addr_len) != 0) {
+        perror("bench listen");
+        return -1;
+    }
+
+    int client_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (with_profiles) {
+        port_sockopt_apply(client_fd, MIST_PORT_SOCKET_DIRECT);
+    }
+    if (connect(client_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        perror("bench connect");
+        return -1;
+    }
+    int server_fd = accept(listen_fd, NULL, NULL);
+    close(listen_fd);
+    if (with_profiles) {
+        port_sockopt_apply(server_fd, MIST_PORT_SOCKET_INBOUND);
+    }
+
+    pthread_t responder_thread;
+    pthread_create(&responder_thread, NULL, responder, &server_fd);
+
+    uint8_t request[REQUEST_LEN] = { 0 };
+    uint8_t reply[REPLY_LEN];
+    unsigned long invokes = 0;
+    double start = now_s();
+    double t = start;
+    while (t < start + seconds) {
+        if (send_message(client_fd, request, sizeof(request)) != 0 || recv_message(client_fd, reply, sizeof(reply)) != 0) {
+            perror("bench invoke");
+            break;
+        }
+        invokes++;
+        t = now_s();
+    }
+
+    /* Ends the responder */
+    close(client_fd);
+    pthread_join(responder_thread, NULL);
+    close(server_fd);
+
+    *invokes_per_s = invokes / (t - start);
+    *mean_rtt_us = invokes > 0 ? (t - start) * 1e6 / invokes : 0;
+    return 0;
+}
+
+int host_bench_rtt(unsigned int seconds) {
+    double rate, rtt;
+
+    printf("%-18s %12s %14s\n", "socket options", "invokes/s", "mean rtt/us");
+    if (run(false, seconds, &rate, &rtt) != 0) {
+        return -1;
+    }
+    printf("%-18s %12.0f %14.1f\n", "stack defaults", rate, rtt);
+    if (run(true, seconds, &rate, &rtt) != 0) {
+        return -1;
+    }
+    printf("%-18s %12.0f %14.1f\n", "port profiles", rate, rtt);
+    return 0;
+}
@@ -0,0 +1,21 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * Measure the round trips per second and the mean round-trip time of invoke-sized request/reply exchanges over loopback TCP, with
+ * the stack default socket options and with the socket option profiles of the port, and print the results. Each case runs for the
+ * given number of seconds.
+ *
+ * @return 0, or -1 if the loopback connection could not be set up
+ */
+int host_bench_rtt(unsigned int seconds);
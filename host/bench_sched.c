@@ -0,0 +1,195 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+/* Outbound scheduler benchmark of the host build: the latency of small interactive frames while other connections send bursts of
+ * bulk frames, with every write going to the socket right away, versus the main loop corking and scheduling the writes. The Wish
+ * connections share one link: their sockets are duplicates of one end of a socket pair, so the frames queue in the order of the
+ * write() calls. A thread reads the other end at a fixed link rate, and records when each frame has been transmitted. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "wish_connection.h"
+#include "port_net.h"
+#include "port_main.h"
+#include "bench_util.h"
+#include "bench_sched.h"
+
+/* The emulated link, in bytes per second */
+#define LINK_RATE 3000000
+/* One main loop iteration every ITERATION_US, producing BULK0_FRAMES and BULK1_FRAMES bulk frames on two connections, and then one
+ * interactive frame on a third connection. This loads the link to about 70 %. */
+#define ITERATION_US 5000
+#define BULK0_FRAMES 5
+#define BULK1_FRAMES 2
+/* A bulk frame is MIST_PORT_DRR_QUANTUM bytes with its header, so that the scheduler writes whole frames, and the frames of different
+ * connections do not get mixed up on the shared link */
+#define BULK_LEN (MIST_PORT_DRR_QUANTUM - 2)
+#define INTERACTIVE_LEN 100
+
+enum frame_class {
+    FRAME_BULK0,
+    FRAME_BULK1,
+    FRAME_INTERACTIVE,
+    NUM_FRAME_CLASSES,
+};
+
+/* The body of a frame starts with this */
+struct frame_info {
+    uint8_t frame_class;
+    uint64_t produced_ns;
+} __attribute__((packed));
+
+static struct bench_samples latencies[NUM_FRAME_CLASSES];
+static volatile bool link_stop;
+
+static bool read_full(int fd, uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t ret = read(fd, buf, len);
+        if (ret <= 0) {
+            return false;
+        }
+        buf += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+static void *link_thread(void *arg) {
+    int fd = *((int *) arg);
+    uint8_t buf[2 + BULK_LEN];
+    uint64_t link_free_ns = 0;
+    while (true) {
+        /* A frame which was already waiting is transmitted right after the previous one, also if this thread overslept */
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        bool waiting = poll(&pfd, 1, 0) > 0;
+        if (!read_full(fd, buf, 2)) {
+            break;
+        }
+        size_t len = (buf[0] << 8) | buf[1];
+        if (len > BULK_LEN || !read_full(fd, buf + 2, len)) {
+            break;
+        }
+        uint64_t start_ns = bench_now_ns();
+        if (waiting || link_free_ns > start_ns) {
+            start_ns = link_free_ns;
+        }
+        link_free_ns = start_ns + (2 + len) * 1000000000ULL / LINK_RATE;
+        bench_sleep_until_ns(link_free_ns);
+
+        struct frame_info info;
+        memcpy(&info, buf + 2, sizeof(info));
+        if (!link_stop) {
+            bench_samples_add(&latencies[info.frame_class % NUM_FRAME_CLASSES], (link_free_ns - info.produced_ns) / 1000);
+        }
+    }
+    return NULL;
+}
+
+static void write_frame(wish_connection_t *ctx, enum frame_class frame_class, size_t len) {
+    uint8_t frame[2 + BULK_LEN] = { len >> 8, len & 0xff };
+    struct frame_info info = { .frame_class = frame_class, .produced_ns = bench_now_ns() };
+    memcpy(frame + 2, &info, sizeof(info));
+    write_to_socket(ctx, frame, 2 + len);
+}
+
+static void run(wish_core_t *core, wish_connection_t *conns[NUM_FRAME_CLASSES], bool scheduled, unsigned int seconds) {
+    for (int c = 0; c < NUM_FRAME_CLASSES; c++) {
+        latencies[c].len = 0;
+    }
+    uint64_t next_ns = bench_now_ns();
+    uint64_t end_ns = next_ns + (uint64_t) seconds * 1000000000;
+    while (next_ns < end_ns) {
+        bench_sleep_until_ns(next_ns);
+        next_ns += ITERATION_US * 1000;
+
+        /* The events of one wakeup: the core handles them in order, and the reply to the invoke comes last */
+        if (scheduled) {
+            port_net_cork();
+        }
+        for (int i = 0; i < BULK0_FRAMES; i++) {
+            write_frame(conns[FRAME_BULK0], FRAME_BULK0, BULK_LEN);
+        }
+        for (int i = 0; i < BULK1_FRAMES; i++) {
+            write_frame(conns[FRAME_BULK1], FRAME_BULK1, BULK_LEN);
+        }
+        write_frame(conns[FRAME_INTERACTIVE], FRAME_INTERACTIVE, INTERACTIVE_LEN);
+        if (scheduled) {
+            port_net_uncork(core, MIST_PORT_BULK_TX_BUDGET);
+        }
+    }
+    /* Let the link drain */
+    usleep(100000);
+
+    for (int c = 0; c < NUM_FRAME_CLASSES; c++) {
+        bench_samples_sort(&latencies[c]);
+    }
+    printf("%-12s %10u %10u %10u %10u\n", scheduled ? "scheduled" : "unscheduled", 
+            bench_samples_percentile(&latencies[FRAME_INTERACTIVE], 50), bench_samples_percentile(&latencies[FRAME_INTERACTIVE], 99),
+            bench_samples_percentile(&latencies[FRAME_BULK1], 99), bench_samples_percentile(&latencies[FRAME_BULK0], 99));
+}
+
+int host_bench_sched(unsigned int seconds) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        perror("socketpair");
+        return -1;
+    }
+    /* The socket buffer is the queue of the link: big enough that no write would block */
+    int sndbuf = 1024 * 1024;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    size_t cap = (size_t) seconds * 1000000 / ITERATION_US * BULK0_FRAMES;
+    for (int c = 0; c < NUM_FRAME_CLASSES; c++) {
+        if (bench_samples_init(&latencies[c], cap) != 0) {
+            return -1;
+        }
+    }
+
+    wish_core_t *core = port_net_get_core();
+    wish_connection_t *conns[NUM_FRAME_CLASSES];
+    for (int c = 0; c < NUM_FRAME_CLASSES; c++) {
+        conns[c] = &core->connection_pool[c];
+        conns[c]->core = core;
+        int fd = dup(fds[0]);
+        socket_set_nonblocking(fd);
+        port_net_attach(conns[c], fd, false);
+    }
+
+    pthread_t link;
+    pthread_create(&link, NULL, link_thread, &fds[1]);
+
+    printf("Link %u bytes/s, every %u us %u+%u bulk frames of %u bytes and an interactive frame of %u bytes\n", 
+            LINK_RATE, ITERATION_US, BULK0_FRAMES, BULK1_FRAMES, (unsigned int) BULK_LEN, INTERACTIVE_LEN);
+    printf("%-12s %10s %10s %10s %10s\n", "latency/us", "inter p50", "inter p99", "bulk1 p99", "bulk0 p99");
+    run(core, conns, false, seconds);
+    run(core, conns, true, seconds);
+
+    link_stop = true;
+    for (int c = 0; c < NUM_FRAME_CLASSES; c++) {
+        port_net_release_connection(conns[c]);
+    }
+    /* The duplicates are closed, closing the original ends the link thread */
+    close(fds[0]);
+    pthread_join(link, NULL);
+    close(fds[1]);
+    for (int c = 0; c < NUM_FRAME_CLASSES; c++) {
+        bench_samples_free(&latencies[c]);
+    }
+    return 0;
+}
@@ -0,0 +1,21 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * Measure the latency of interactive frames on one Wish connection while two other connections send bursts of bulk frames over the
+ * same emulated link, without and with the outbound scheduler of the port, and print the results. Each case runs for the given
+ * number of seconds.
+ *
+ * @return 0, or -1 if the socket pair could not be created
+ */
+int host_bench_sched(unsigned int seconds);
@@ -0,0 +1,120 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+/* Send path microbenchmark of the host build: Wish frames per second through the port, with the frame assembled into one buffer
+ * before write_to_socket(), as the Wish core does it, versus port_net_writev() with the header, ciphertext and tag as separate
+ * pieces. The frames are written to one end of a socket pair, and a thread reads and discards them from the other end. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "wish_connection.h"
+#include "port_net.h"
+#include "bench_send.h"
+
+/* The Wish transport frame: 2-byte length, AES-GCM ciphertext, 16-byte tag */
+#define FRAME_HDR_LEN 2
+#define FRAME_TAG_LEN 16
+
+static volatile int reader_stop = 0;
+
+static void *reader(void *arg) {
+    int fd = *((int *) arg);
+    uint8_t buf[16384];
+    while (!reader_stop) {
+        if (read(fd, buf, sizeof(buf)) <= 0) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(wish_connection_t *ctx, size_t payload_len, bool vectored, unsigned int seconds) {
+    uint8_t hdr[FRAME_HDR_LEN] = { payload_len >> 8, payload_len & 0xff };
+    uint8_t *ciphertext = calloc(1, payload_len);
+    uint8_t tag[FRAME_TAG_LEN] = { 0 };
+    unsigned long frames = 0;
+
+    double start = now_s();
+    double end = start + seconds;
+    double t = start;
+    while (t < end) {
+        /* Check the clock every 256 frames only */
+        for (int i = 0; i < 256; i++) {
+            if (vectored) {
+                struct iovec iov[3] = {
+                    { .iov_base = hdr, .iov_len = FRAME_HDR_LEN },
+                    { .iov_base = ciphertext, .iov_len = payload_len },
+                    { .iov_base = tag, .iov_len = FRAME_TAG_LEN },
+                };
+                port_net_writev(ctx, iov, 3);
+            }
+            else {
+                size_t len = FRAME_HDR_LEN + payload_len + FRAME_TAG_LEN;
+                uint8_t *frame = malloc(len);
+                memcpy(frame, hdr, FRAME_HDR_LEN);
+                memcpy(frame + FRAME_HDR_LEN, ciphertext, payload_len);
+                memcpy(frame + FRAME_HDR_LEN + payload_len, tag, FRAME_TAG_LEN);
+                write_to_socket(ctx, frame, len);
+                free(frame);
+            }
+        }
+        frames += 256;
+        t = now_s();
+    }
+    free(ciphertext);
+    return frames / (t - start);
+}
+
+int host_bench_send(unsigned int seconds) {
+    static const size_t payload_lens[] = { 64, 512, 1400 };
+    int fds[2];
+
+    /* Blocking sockets: the writer waits for the reader, instead of filling the outbound queue */
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        perror("socketpair");
+        return -1;
+    }
+    pthread_t reader_thread;
+    pthread_create(&reader_thread, NULL, reader, &fds[1]);
+
+    wish_core_t *core = port_net_get_core();
+    wish_connection_t *ctx = &core->connection_pool[0];
+    ctx->core = core;
+    port_net_attach(ctx, fds[0], false);
+
+    printf("%10s %16s %16s\n", "payload", "contiguous/s", "vectored/s");
+    for (size_t i = 0; i < sizeof(payload_lens) / sizeof(payload_lens[0]); i++) {
+        double contiguous = run(ctx, payload_lens[i], false, seconds);
+        double vectored = run(ctx, payload_lens[i], true, seconds);
+        printf("%10zu %16.0f %16.0f\n", payload_lens[i], contiguous, vectored);
+    }
+
+    /* Closes fds[0], which ends the reader */
+    reader_stop = 1;
+    port_net_release_connection(ctx);
+    pthread_join(reader_thread, NULL);
+    close(fds[1]);
+    return 0;
+}
@@ -0,0 +1,20 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * Measure the Wish frames per second of write_to_socket() with an assembled frame, and of port_net_writev() with the frame in
+ * pieces, for a few payload sizes, and print the results. Each case runs for the given number of seconds.
+ *
+ * @return 0, or -1 if the socket pair could not be created
+ */
+int host_bench_send(unsigned int seconds);
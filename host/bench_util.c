@@ -0,0 +1,91 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "port_timer.h"
+#include "bench_util.h"
+
+static port_timer_t lateness_timer;
+static struct bench_samples *lateness_samples;
+static void (*lateness_on_tick)(uint64_t now_ns);
+static uint64_t tick_due_ns;
+
+uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void bench_sleep_until_ns(uint64_t t) {
+    struct timespec ts = { .tv_sec = t / 1000000000, .tv_nsec = t % 1000000000 };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+int bench_samples_init(struct bench_samples *s, size_t cap) {
+    s->us = malloc(cap * sizeof(uint32_t));
+    s->len = 0;
+    s->cap = s->us != NULL ? cap : 0;
+    return s->us != NULL ? 0 : -1;
+}
+
+void bench_samples_free(struct bench_samples *s) {
+    free(s->us);
+    s->us = NULL;
+    s->len = 0;
+    s->cap = 0;
+}
+
+void bench_samples_add(struct bench_samples *s, uint32_t us) {
+    if (s->len < s->cap) {
+        s->us[s->len++] = us;
+    }
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *((const uint32_t *) a);
+    uint32_t y = *((const uint32_t *) b);
+    return x < y ? -1 : x > y;
+}
+
+void bench_samples_sort(struct bench_samples *s) {
+    qsort(s->us, s->len, sizeof(uint32_t), compare_u32);
+}
+
+uint32_t bench_samples_percentile(const struct bench_samples *s, unsigned int pct) {
+    if (s->len == 0) {
+        return 0;
+    }
+    return s->us[(s->len - 1) * pct / 100];
+}
+
+static void tick(void *arg) {
+    uint64_t now = bench_now_ns();
+    bench_samples_add(lateness_samples, now > tick_due_ns ? (now - tick_due_ns) / 1000 : 0);
+    tick_due_ns += BENCH_TICK_MS * 1000000ULL;
+    if (lateness_on_tick != NULL) {
+        lateness_on_tick(now);
+    }
+}
+
+void bench_lateness_start(struct bench_samples *samples, void (*on_tick)(uint64_t now_ns)) {
+    lateness_samples = samples;
+    lateness_on_tick = on_tick;
+    port_timer_init(&lateness_timer, tick, NULL);
+    tick_due_ns = bench_now_ns() + BENCH_TICK_MS * 1000000ULL;
+    port_timer_start(&lateness_timer, BENCH_TICK_MS, BENCH_TICK_MS);
+}
+
+void bench_lateness_stop(void) {
+    port_timer_stop(&lateness_timer);
+}
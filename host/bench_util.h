@@ -0,0 +1,64 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file bench_util.h
+ * @brief Helpers shared by the host benchmarks: the monotonic clock, latency samples and their percentiles, and a main loop timer
+ * whose lateness shows how much other work delays the main loop.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** The period of the lateness timer */
+#define BENCH_TICK_MS 10
+
+/** Latency samples in microseconds. Samples beyond the capacity are dropped. */
+struct bench_samples {
+    uint32_t *us;
+    size_t len;
+    size_t cap;
+};
+
+/** Nanoseconds of the monotonic clock */
+uint64_t bench_now_ns(void);
+
+/** Sleep until the monotonic clock reaches t nanoseconds */
+void bench_sleep_until_ns(uint64_t t);
+
+/**
+ * Allocate room for cap samples.
+ *
+ * @return 0, or -1 if the memory could not be allocated
+ */
+int bench_samples_init(struct bench_samples *s, size_t cap);
+
+void bench_samples_free(struct bench_samples *s);
+
+void bench_samples_add(struct bench_samples *s, uint32_t us);
+
+/** Sort the samples, for bench_samples_percentile() */
+void bench_samples_sort(struct bench_samples *s);
+
+/** A percentile of the sorted samples, 100 for the maximum, or 0 if there are none */
+uint32_t bench_samples_percentile(const struct bench_samples *s, unsigned int pct);
+
+/**
+ * Start a port timer which runs every BENCH_TICK_MS from the main loop, and adds its lateness to samples. The samples are not
+ * cleared.
+ *
+ * @param on_tick Called from the timer with the current time of bench_now_ns(), or NULL
+ */
+void bench_lateness_start(struct bench_samples *samples, void (*on_tick)(uint64_t now_ns));
+
+void bench_lateness_stop(void);
@@ -0,0 +1,284 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+/* Local discovery storm benchmark of the host build: a thread sends advert-shaped datagrams, each one different so that they are not
+ * dropped as duplicates, to the local discovery port at STORM_RATE, and another thread sends the advert of a well-behaved peer every
+ * LEGIT_INTERVAL_MS. The main loop runs a timer every BENCH_TICK_MS, and the lateness of the timer shows how much the storm delays the
+ * rest of the work of the main loop.
+ *
+ * The legitimate adverts carry their sequence number also as their alias. The timer looks up the legitimate peer in the neighbour
+ * table, and from the alias and the time it was heard, counts the legitimate adverts which got through the rate limits, and their
+ * delay from being sent. Without a class filter, and as each advert is different, the adverts heard are the adverts fed to the core. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "port_main.h"
+#include "port_neighbours.h"
+#include "bench_util.h"
+#include "bench_wld.h"
+
+#define WLD_PORT 9090
+#define STORM_RATE 10000
+/* The storm is sent in batches every millisecond */
+#define STORM_BATCH (STORM_RATE / 1000)
+/* The number of source addresses of a spread storm, 127.0.1.1 onwards. The legitimate peer must not be evicted from the neighbour
+ * table, so a spread storm leaves room in it for the legitimate peer and the source of a single source storm. */
+#define STORM_SPREAD_SOURCES (MIST_PORT_WLD_NEIGHBOURS - 4)
+#define LEGIT_INTERVAL_MS 1000
+
+struct storm_args {
+    int fds[STORM_SPREAD_SOURCES];
+    int num_fds;
+    int legit_fd;
+};
+
+static volatile bool senders_stop;
+static uint32_t num_legit_sent;
+/* The send time of each legitimate advert, by sequence number */
+static uint64_t *legit_sent_ns;
+static size_t legit_sent_cap;
+static uint32_t last_legit_heard;
+static struct bench_samples legit_delay;
+
+static struct bench_samples lateness;
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static size_t put_string(uint8_t *buf, const char *key, const char *value) {
+    size_t key_len = strlen(key) + 1;
+    size_t value_len = strlen(value) + 1;
+    size_t pos = 0;
+    buf[pos++] = 0x02;
+    memcpy(buf + pos, key, key_len);
+    pos += key_len;
+    put_le32(buf + pos, value_len);
+    pos += 4;
+    memcpy(buf + pos, value, value_len);
+    return pos + value_len;
+}
+
+/* "W." and a BSON document { class: advert_class, alias: alias, seq: seq }, as far as the port is concerned an advert. The alias is
+ * left out if it is NULL. */
+static size_t make_advert(uint8_t *buf, const char *advert_class, const char *alias, uint32_t seq) {
+    size_t pos = 0;
+    buf[pos++] = 'W';
+    buf[pos++] = '.';
+    size_t doc = pos;
+    pos += 4;
+    pos += put_string(buf + pos, "class", advert_class);
+    if (alias != NULL) {
+        pos += put_string(buf + pos, "alias", alias);
+    }
+    buf[pos++] = 0x10;
+    memcpy(buf + pos, "seq", 4);
+    pos += 4;
+    put_le32(buf + pos, seq);
+    pos += 4;
+    buf[pos++] = 0x00;
+    put_le32(buf + doc, pos - doc);
+    return pos;
+}
+
+static int open_sender(const char *ip) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    struct sockaddr_in src = { .sin_family = AF_INET };
+    inet_pton(AF_INET, ip, &src.sin_addr);
+    if (bind(fd, (struct sockaddr *) &src, sizeof(src)) != 0) {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    struct sockaddr_in dst = { .sin_family = AF_INET, .sin_port = htons(WLD_PORT) };
+    inet_pton(AF_INET, "127.0.0.1", &dst.sin_addr);
+    if (connect(fd, (struct sockaddr *) &dst, sizeof(dst)) != 0) {
+        perror("connect");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void *storm_thread(void *arg) {
+    struct storm_args *args = arg;
+    uint8_t buf[64];
+    uint32_t seq = 0;
+    uint64_t next_ns = bench_now_ns();
+    while (!senders_stop) {
+        for (int i = 0; i < STORM_BATCH; i++, seq++) {
+            size_t len = make_advert(buf, "bench.storm", NULL, seq);
+            /* A full socket buffer drops datagrams, as a congested link would */
+            send(args->fds[seq % args->num_fds], buf, len, MSG_DONTWAIT);
+        }
+        next_ns += 1000000;
+        bench_sleep_until_ns(next_ns);
+    }
+    return NULL;
+}
+
+static void *legit_thread(void *arg) {
+    struct storm_args *args = arg;
+    uint8_t buf[96];
+    uint64_t next_ns = bench_now_ns();
+    while (!senders_stop && num_legit_sent < legit_sent_cap) {
+        char alias[12];
+        snprintf(alias, sizeof(alias), "%u", num_legit_sent);
+        size_t len = make_advert(buf, "bench.legit", alias, num_legit_sent);
+        /* Stored before sending, so that the main loop never hears an advert before its send time is there */
+        __atomic_store_n(&legit_sent_ns[num_legit_sent], bench_now_ns(), __ATOMIC_RELEASE);
+        if (send(args->legit_fd, buf, len, 0) > 0) {
+            num_legit_sent++;
+        }
+        next_ns += LEGIT_INTERVAL_MS * 1000000ULL;
+        while (!senders_stop && bench_now_ns() < next_ns) {
+            usleep(10000);
+        }
+    }
+    return NULL;
+}
+
+/* Look up the latest advert of the legitimate peer in the neighbour table */
+static void check_legit(uint64_t now) {
+    struct mist_port_esp32_wld_neighbour page[8];
+    unsigned int cursor = 0;
+    int n;
+    do {
+        n = mist_port_esp32_get_wld_neighbours(&cursor, page, 8);
+        for (int i = 0; i < n; i++) {
+            if (page[i].ip[0] != 127 || page[i].ip[1] != 0 || page[i].ip[2] != 0 || page[i].ip[3] != 3 
+                    || strcmp(page[i].advert_class, "bench.legit") != 0) {
+                continue;
+            }
+            uint32_t seq = strtoul(page[i].alias, NULL, 10);
+            if (seq == last_legit_heard || seq >= legit_sent_cap) {
+                return;
+            }
+            uint64_t sent_ns = __atomic_load_n(&legit_sent_ns[seq], __ATOMIC_ACQUIRE);
+            /* The neighbour table has a millisecond resolution */
+            uint64_t heard_ns = now - (uint64_t) page[i].heard_ms_ago * 1000000;
+            if (sent_ns == 0 || heard_ns + 1000000 < sent_ns) {
+                /* Heard in an earlier case, whose sequence numbers were the same */
+                return;
+            }
+            last_legit_heard = seq;
+            bench_samples_add(&legit_delay, heard_ns > sent_ns ? (heard_ns - sent_ns) / 1000 : 0);
+            return;
+        }
+    } while (n == 8);
+}
+
+static void run(const char *name, struct storm_args *args, unsigned int seconds) {
+    struct mist_port_esp32_wld_stats before, after;
+    mist_port_esp32_get_wld_stats(&before);
+    lateness.len = 0;
+    num_legit_sent = 0;
+    memset(legit_sent_ns, 0, legit_sent_cap * sizeof(uint64_t));
+    last_legit_heard = UINT32_MAX;
+    legit_delay.len = 0;
+    senders_stop = false;
+
+    pthread_t storm, legit;
+    pthread_create(&storm, NULL, storm_thread, args);
+    pthread_create(&legit, NULL, legit_thread, args);
+
+    bench_lateness_start(&lateness, check_legit);
+    uint64_t end_ns = bench_now_ns() + (uint64_t) seconds * 1000000000;
+    while (bench_now_ns() < end_ns) {
+        mist_port_esp32_periodic(BENCH_TICK_MS);
+    }
+    bench_lateness_stop();
+
+    senders_stop = true;
+    pthread_join(storm, NULL);
+    pthread_join(legit, NULL);
+    /* Read what is left in the socket buffer, so that it does not count in the next case */
+    uint64_t drain_end_ns = bench_now_ns() + 200000000;
+    while (bench_now_ns() < drain_end_ns) {
+        mist_port_esp32_periodic(BENCH_TICK_MS);
+        check_legit(bench_now_ns());
+    }
+    mist_port_esp32_get_wld_stats(&after);
+
+    bench_samples_sort(&lateness);
+    bench_samples_sort(&legit_delay);
+    printf("%-16s %8u %8u %8u %10u %10u %10u %8u %8u %8zu %8u %8u\n", name, bench_samples_percentile(&lateness, 50), 
+            bench_samples_percentile(&lateness, 99), bench_samples_percentile(&lateness, 100), after.received - before.received, 
+            after.rate_limited_source - before.rate_limited_source, after.rate_limited_global - before.rate_limited_global, 
+            after.fed - before.fed, num_legit_sent, legit_delay.len, bench_samples_percentile(&legit_delay, 50), 
+            bench_samples_percentile(&legit_delay, 100));
+}
+
+int host_bench_wld(unsigned int seconds) {
+    struct storm_args single = { .num_fds = 1 };
+    struct storm_args spread = { .num_fds = STORM_SPREAD_SOURCES };
+    single.fds[0] = open_sender("127.0.0.2");
+    single.legit_fd = spread.legit_fd = open_sender("127.0.0.3");
+    if (single.fds[0] < 0 || single.legit_fd < 0) {
+        return -1;
+    }
+    for (int i = 0; i < STORM_SPREAD_SOURCES; i++) {
+        char ip[16];
+        snprintf(ip, sizeof(ip), "127.0.1.%d", i + 1);
+        spread.fds[i] = open_sender(ip);
+        if (spread.fds[i] < 0) {
+            return -1;
+        }
+    }
+
+    legit_sent_cap = (size_t) seconds * 1000 / LEGIT_INTERVAL_MS + 2;
+    legit_sent_ns = malloc(legit_sent_cap * sizeof(uint64_t));
+    if (legit_sent_ns == NULL || bench_samples_init(&lateness, (size_t) seconds * 1000 / BENCH_TICK_MS + 1) != 0 
+            || bench_samples_init(&legit_delay, legit_sent_cap) != 0) {
+        return -1;
+    }
+
+    printf("Storm of %u datagrams/s to the local discovery port, a legitimate advert every %u ms, a timer every %u ms\n", 
+            STORM_RATE, LEGIT_INTERVAL_MS, BENCH_TICK_MS);
+    printf("%-16s %8s %8s %8s %10s %10s %10s %8s %8s %8s %8s %8s\n", "timer late/us", "p50", "p99", "max", "received", "src limit", 
+            "glob limit", "fed", "legit", "lgt fed", "delay/us", "max");
+
+    struct mist_port_esp32_wld_rate_limit defaults;
+    mist_port_esp32_get_wld_rate_limit(&defaults);
+    struct mist_port_esp32_wld_rate_limit unlimited = { 1000000, 1000000, 1000000, 1000000 };
+    mist_port_esp32_set_wld_rate_limit(&unlimited);
+    run("unlimited", &single, seconds);
+    mist_port_esp32_set_wld_rate_limit(&defaults);
+    run("limited", &single, seconds);
+    mist_port_esp32_set_wld_rate_limit(&defaults);
+    run("limited, spread", &spread, seconds);
+
+    close(single.fds[0]);
+    close(single.legit_fd);
+    for (int i = 0; i < STORM_SPREAD_SOURCES; i++) {
+        close(spread.fds[i]);
+    }
+    bench_samples_free(&lateness);
+    free(legit_sent_ns);
+    bench_samples_free(&legit_delay);
+    return 0;
+}
@@ -0,0 +1,21 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * Measure how responsive the main loop stays while a storm of local discovery datagrams, 10000 per second, hits the local discovery
+ * socket, next to a well-behaved peer advertising once per second: without rate limiting, with the default rate limits, and with
+ * the default rate limits and the storm spread over many source addresses. Each case runs for the given number of seconds.
+ *
+ * @return 0, or -1 if the sending sockets could not be set up
+ */
+int host_bench_wld(unsigned int seconds);
@@ -0,0 +1,132 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+/* Linux host build: ESP-IDF logging, system, Wi-Fi and TCP/IP adapter functions */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+#include "tcpip_adapter.h"
+
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void host_log_write(char level, const char *tag, const char *format, ...) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    unsigned long ms = (unsigned long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+    va_list ap;
+    va_start(ap, format);
+    /* Keep the lines of the tasks from mixing */
+    pthread_mutex_lock(&log_lock);
+    printf("%c (%lu) %s: ", level, ms, tag);
+    vprintf(format, ap);
+    printf("\n");
+    fflush(stdout);
+    pthread_mutex_unlock(&log_lock);
+    va_end(ap);
+}
+
+static pthread_once_t urandom_once = PTHREAD_ONCE_INIT;
+static int urandom_fd = -1;
+
+static void open_urandom(void) {
+    urandom_fd = open("/dev/urandom", O_RDONLY);
+}
+
+uint32_t esp_random(void) {
+    pthread_once(&urandom_once, open_urandom);
+
+    uint32_t value;
+    if (urandom_fd < 0 || read(urandom_fd, &value, sizeof(value)) != sizeof(value)) {
+        value = ((uint32_t) rand() << 16) ^ (uint32_t) rand();
+    }
+    return value;
+}
+
+uint32_t esp_get_free_heap_size(void) {
+    /* There is no fixed heap on the host, report the available memory instead */
+    uint64_t avail = (uint64_t) sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE);
+    return avail > UINT32_MAX ? UINT32_MAX : (uint32_t) avail;
+}
+
+void esp_restart(void) {
+    exit(0);
+}
+
+esp_err_t esp_wifi_get_mode(wifi_mode_t *mode) {
+    *mode = WIFI_MODE_STA;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_ap_get_sta_list(wifi_sta_list_t *sta) {
+    memset(sta, 0, sizeof(wifi_sta_list_t));
+    return ESP_OK;
+}
+
+esp_err_t tcpip_adapter_get_ip_info(tcpip_adapter_if_t tcpip_if, tcpip_adapter_ip_info_t *ip_info) {
+    memset(ip_info, 0, sizeof(tcpip_adapter_ip_info_t));
+    if (tcpip_if != TCPIP_ADAPTER_IF_STA) {
+        /* No soft-AP on the host, like on a device without the AP interface up */
+        return ESP_OK;
+    }
+
+    struct ifaddrs *ifaddrs;
+    if (getifaddrs(&ifaddrs) != 0) {
+        return ESP_FAIL;
+    }
+    for (struct ifaddrs *ifa = ifaddrs; ifa != NULL; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr == NULL || ifa->ifa_addr->sa_family != AF_INET) {
+            continue;
+        }
+        if (!(ifa->ifa_flags & IFF_UP) || (ifa->ifa_flags & IFF_LOOPBACK)) {
+            continue;
+        }
+        ip_info->ip.addr = ((struct sockaddr_in *) ifa->ifa_addr)->sin_addr.s_addr;
+        if (ifa->ifa_netmask != NULL) {
+            ip_info->netmask.addr = ((struct sockaddr_in *) ifa->ifa_netmask)->sin_addr.s_addr;
+        }
+        break;
+    }
+    freeifaddrs(ifaddrs);
+
+    if (ip_info->ip.addr == 0) {
+        /* Only loopback, which is fine for testing on one machine */
+        ip_info->ip.addr = htonl(INADDR_LOOPBACK);
+        ip_info->netmask.addr = htonl(0xff000000);
+    }
+    return ESP_OK;
+}
+
+esp_err_t tcpip_adapter_get_sta_list(wifi_sta_list_t *wifi_sta_list, tcpip_adapter_sta_list_t *tcpip_sta_list) {
+    memset(tcpip_sta_list, 0, sizeof(tcpip_adapter_sta_list_t));
+    return ESP_OK;
+}
+
+char *ip4addr_ntoa(const ip4_addr_t *addr) {
+    static __thread char buf[INET_ADDRSTRLEN];
+    struct in_addr in = { .s_addr = addr->addr };
+    return (char *) inet_ntop(AF_INET, &in, buf, sizeof(buf));
+}
@@ -0,0 +1,269 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+/* Linux host build: FreeRTOS tasks, task notifications and queues on top of pthreads */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+
+struct host_task {
+    pthread_t thread;
+    TaskFunction_t fn;
+    void *arg;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify_value;
+};
+
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    uint8_t *items;
+    size_t item_size;
+    UBaseType_t length;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+static __thread struct host_task *current_task = NULL;
+
+static void init_cond(pthread_cond_t *cond) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static struct timespec deadline_after(TickType_t ticks) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t ms = (uint64_t) ticks * portTICK_PERIOD_MS;
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    return ts;
+}
+
+/* Wait on cond until it is signaled or the deadline passes. Returns false on timeout. */
+static bool cond_wait(pthread_cond_t *cond, pthread_mutex_t *lock, TickType_t ticks, const struct timespec *deadline) {
+    if (ticks == portMAX_DELAY) {
+        pthread_cond_wait(cond, lock);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+static struct host_task *alloc_task(TaskFunction_t fn, void *arg) {
+    struct host_task *task = calloc(1, sizeof(struct host_task));
+    if (task == NULL) {
+        return NULL;
+    }
+    task->fn = fn;
+    task->arg = arg;
+    pthread_mutex_init(&task->lock, NULL);
+    init_cond(&task->cond);
+    return task;
+}
+
+static void *task_main(void *arg) {
+    struct host_task *task = arg;
+    current_task = task;
+    task->fn(task->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg, UBaseType_t priority,
+        TaskHandle_t *handle, BaseType_t core_id) {
+    struct host_task *task = alloc_task(fn, arg);
+    if (task == NULL) {
+        return pdFAIL;
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    /* The stack depth is in bytes on the ESP32. Host code needs more stack, e.g. for the C library, so this is only a minimum. */
+    size_t stack_size = stack_depth < PTHREAD_STACK_MIN ? PTHREAD_STACK_MIN : stack_depth;
+    if (stack_size < 256 * 1024) {
+        stack_size = 256 * 1024;
+    }
+    pthread_attr_setstacksize(&attr, stack_size);
+    if (handle != NULL) {
+        /* Set before the task runs, as the task may be notified right away */
+        *handle = task;
+    }
+    if (pthread_create(&task->thread, &attr, task_main, task) != 0) {
+        pthread_attr_destroy(&attr);
+        free(task);
+        return pdFAIL;
+    }
+    pthread_attr_destroy(&attr);
+    pthread_setname_np(task->thread, name);
+
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (core_id >= 0 && core_id < num_cpus) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(core_id, &cpus);
+        pthread_setaffinity_np(task->thread, sizeof(cpus), &cpus);
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg, UBaseType_t priority,
+        TaskHandle_t *handle) {
+    return xTaskCreatePinnedToCore(fn, name, stack_depth, arg, priority, handle, -1);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (task == NULL || task == current_task) {
+        pthread_exit(NULL);
+    }
+    pthread_cancel(task->thread);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    uint64_t ms = (uint64_t) ticks * portTICK_PERIOD_MS;
+    struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000 };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    if (current_task == NULL) {
+        /* A thread not created with xTaskCreate(), like the main thread */
+        current_task = alloc_task(NULL, NULL);
+        current_task->thread = pthread_self();
+    }
+    return current_task;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (TickType_t) ((uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000) / portTICK_PERIOD_MS;
+}
+
+void host_task_yield(void) {
+    sched_yield();
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    pthread_mutex_lock(&task->lock);
+    task->notify_value++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait) {
+    struct host_task *task = xTaskGetCurrentTaskHandle();
+    struct timespec deadline = deadline_after(ticks_to_wait);
+
+    pthread_mutex_lock(&task->lock);
+    while (task->notify_value == 0 && ticks_to_wait > 0) {
+        if (!cond_wait(&task->cond, &task->lock, ticks_to_wait, &deadline)) {
+            break;
+        }
+    }
+    uint32_t value = task->notify_value;
+    if (value > 0) {
+        task->notify_value = clear_on_exit ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return value;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    struct host_queue *queue = calloc(1, sizeof(struct host_queue));
+    if (queue == NULL) {
+        return NULL;
+    }
+    queue->items = malloc(length * item_size);
+    if (queue->items == NULL) {
+        free(queue);
+        return NULL;
+    }
+    queue->item_size = item_size;
+    queue->length = length;
+    pthread_mutex_init(&queue->lock, NULL);
+    init_cond(&queue->not_empty);
+    init_cond(&queue->not_full);
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait) {
+    struct timespec deadline = deadline_after(ticks_to_wait);
+    BaseType_t ret = pdFALSE;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length && ticks_to_wait > 0) {
+        if (!cond_wait(&queue->not_full, &queue->lock, ticks_to_wait, &deadline)) {
+            break;
+        }
+    }
+    if (queue->count < queue->length) {
+        UBaseType_t tail = (queue->head + queue->count) % queue->length;
+        memcpy(queue->items + tail * queue->item_size, item, queue->item_size);
+        queue->count++;
+        pthread_cond_signal(&queue->not_empty);
+        ret = pdTRUE;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return ret;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *higher_priority_task_woken) {
+    if (higher_priority_task_woken != NULL) {
+        *higher_priority_task_woken = pdFALSE;
+    }
+    return xQueueSend(queue, item, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks_to_wait) {
+    struct timespec deadline = deadline_after(ticks_to_wait);
+    BaseType_t ret = pdFALSE;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0 && ticks_to_wait > 0) {
+        if (!cond_wait(&queue->not_empty, &queue->lock, ticks_to_wait, &deadline)) {
+            break;
+        }
+    }
+    if (queue->count > 0) {
+        memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        pthread_cond_signal(&queue->not_full);
+        ret = pdTRUE;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return ret;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    pthread_mutex_lock(&queue->lock);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
@@ -0,0 +1,40 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file esp_err.h
+ * @brief Linux host build: ESP-IDF error codes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+typedef int32_t esp_err_t;
+
+#define ESP_OK                  0
+#define ESP_FAIL                -1
+#define ESP_ERR_NO_MEM          0x101
+#define ESP_ERR_INVALID_ARG     0x102
+#define ESP_ERR_INVALID_STATE   0x103
+#define ESP_ERR_INVALID_SIZE    0x104
+#define ESP_ERR_NOT_FOUND       0x105
+
+#define ESP_ERROR_CHECK(x) do {                                                                     \
+        esp_err_t __err_rc = (x);                                                                   \
+        if (__err_rc != ESP_OK) {                                                                   \
+            fprintf(stderr, "ESP_ERROR_CHECK failed: esp_err_t 0x%x at %s:%d\n", (unsigned int) __err_rc,  \
+                    __FILE__, __LINE__);                                                            \
+            abort();                                                                                \
+        }                                                                                           \
+    } while (0)
@@ -0,0 +1,27 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file esp_log.h
+ * @brief Linux host build: ESP-IDF logging macros, printing to stdout in the ESP-IDF format.
+ */
+
+#include <stdint.h>
+
+void host_log_write(char level, const char *tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+#define ESP_LOGE(tag, format, ...) host_log_write('E', tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) host_log_write('W', tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) host_log_write('I', tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) host_log_write('D', tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) host_log_write('V', tag, format, ##__VA_ARGS__)
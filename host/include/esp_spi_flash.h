@@ -0,0 +1,44 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file esp_spi_flash.h
+ * @brief Linux host build: SPI flash in RAM, or in a memory mapped file, see host_flash_init().
+ *
+ * Writes behave like NOR flash: they can only clear bits, and an erase sets a whole sector to 0xff.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+#define SPI_FLASH_SEC_SIZE 4096
+
+/** Size of the host flash, which is all given to the spiffs partition */
+#ifndef HOST_FLASH_SIZE
+#define HOST_FLASH_SIZE (512 * 1024)
+#endif
+
+esp_err_t spi_flash_read(size_t src_addr, void *dest, size_t size);
+esp_err_t spi_flash_write(size_t dest_addr, const void *src, size_t size);
+esp_err_t spi_flash_erase_sector(size_t sector);
+
+/**
+ * Initialise the host flash.
+ *
+ * @param path A file backing the flash, so that the contents are kept between runs, or NULL for a flash in RAM only
+ * @return true if the flash is blank, i.e. it must be formatted
+ */
+bool host_flash_init(const char *path);
@@ -0,0 +1,25 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file esp_system.h
+ * @brief Linux host build: ESP-IDF system functions.
+ */
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+uint32_t esp_random(void);
+uint32_t esp_get_free_heap_size(void);
+void esp_restart(void);
@@ -0,0 +1,38 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file esp_wifi_types.h
+ * @brief Linux host build: the Wi-Fi types used by the port.
+ */
+
+#include <stdint.h>
+
+#define ESP_WIFI_MAX_CONN_NUM 10
+
+typedef enum {
+    WIFI_MODE_NULL = 0,
+    WIFI_MODE_STA,
+    WIFI_MODE_AP,
+    WIFI_MODE_APSTA,
+    WIFI_MODE_MAX
+} wifi_mode_t;
+
+typedef struct {
+    uint8_t mac[6];
+} wifi_sta_info_t;
+
+typedef struct {
+    wifi_sta_info_t sta[ESP_WIFI_MAX_CONN_NUM];
+    int num;
+} wifi_sta_list_t;
@@ -0,0 +1,35 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file dns.h
+ * @brief Linux host build: lwIP's asynchronous DNS API on top of getaddrinfo().
+ *
+ * Like with lwIP, numeric addresses are returned right away with ERR_OK. Names are resolved in a thread of their own, from which
+ * the callback is called, like it is called from the lwIP thread on the device.
+ */
+
+#include <stdint.h>
+
+#include "lwip/ip4_addr.h"
+
+typedef int8_t err_t;
+
+#define ERR_OK          0
+#define ERR_MEM         -1
+#define ERR_INPROGRESS  -5
+#define ERR_ARG         -16
+
+typedef void (*dns_found_callback)(const char *name, const ip_addr_t *ipaddr, void *callback_arg);
+
+err_t dns_gethostbyname(const char *hostname, ip_addr_t *addr, dns_found_callback found, void *callback_arg);
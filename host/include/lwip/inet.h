@@ -0,0 +1,17 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/* Linux host build: lwIP's inet functions are the ones of the C library */
+
+#include <arpa/inet.h>
+#include "lwip/ip4_addr.h"
@@ -0,0 +1,49 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file ip4_addr.h
+ * @brief Linux host build: lwIP IPv4 address types and macros. Addresses are in network byte order, as in lwIP.
+ */
+
+#include <stdint.h>
+
+typedef struct {
+    uint32_t addr;
+} ip4_addr_t;
+
+typedef struct {
+    union {
+        ip4_addr_t ip4;
+    } u_addr;
+    uint8_t type;
+} ip_addr_t;
+
+#define IPADDR_TYPE_V4 0
+
+#define ip4_addr1(ipaddr) (((const uint8_t *) (&(ipaddr)->addr))[0])
+#define ip4_addr2(ipaddr) (((const uint8_t *) (&(ipaddr)->addr))[1])
+#define ip4_addr3(ipaddr) (((const uint8_t *) (&(ipaddr)->addr))[2])
+#define ip4_addr4(ipaddr) (((const uint8_t *) (&(ipaddr)->addr))[3])
+
+#define IP4_ADDR(ipaddr, a, b, c, d) do {                                   \
+        uint8_t *__b = (uint8_t *) &(ipaddr)->addr;                         \
+        __b[0] = (a); __b[1] = (b); __b[2] = (c); __b[3] = (d);             \
+    } while (0)
+
+#define IP_ADDR4(ipaddr, a, b, c, d) do {                                   \
+        IP4_ADDR(&(ipaddr)->u_addr.ip4, a, b, c, d);                        \
+        (ipaddr)->type = IPADDR_TYPE_V4;                                    \
+    } while (0)
+
+char *ip4addr_ntoa(const ip4_addr_t *addr);
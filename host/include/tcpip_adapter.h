@@ -0,0 +1,49 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file tcpip_adapter.h
+ * @brief Linux host build: the station interface is the first IPv4 interface of the host which is up and not a loopback.
+ */
+
+#include <arpa/inet.h>
+
+#include "esp_err.h"
+#include "esp_wifi_types.h"
+#include "lwip/ip4_addr.h"
+
+typedef enum {
+    TCPIP_ADAPTER_IF_STA = 0,
+    TCPIP_ADAPTER_IF_AP,
+    TCPIP_ADAPTER_IF_ETH,
+    TCPIP_ADAPTER_IF_MAX
+} tcpip_adapter_if_t;
+
+typedef struct {
+    ip4_addr_t ip;
+    ip4_addr_t netmask;
+    ip4_addr_t gw;
+} tcpip_adapter_ip_info_t;
+
+typedef struct {
+    uint8_t mac[6];
+    ip4_addr_t ip;
+} tcpip_adapter_sta_info_t;
+
+typedef struct {
+    tcpip_adapter_sta_info_t sta[ESP_WIFI_MAX_CONN_NUM];
+    int num;
+} tcpip_adapter_sta_list_t;
+
+esp_err_t tcpip_adapter_get_ip_info(tcpip_adapter_if_t tcpip_if, tcpip_adapter_ip_info_t *ip_info);
+esp_err_t tcpip_adapter_get_sta_list(wifi_sta_list_t *wifi_sta_list, tcpip_adapter_sta_list_t *tcpip_sta_list);
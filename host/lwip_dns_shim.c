@@ -0,0 +1,86 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+/* Linux host build: lwIP's dns_gethostbyname() on top of getaddrinfo() */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "lwip/dns.h"
+
+struct dns_query {
+    char *hostname;
+    dns_found_callback found;
+    void *callback_arg;
+};
+
+static void *resolver_thread(void *arg) {
+    struct dns_query *query = arg;
+    struct addrinfo hints;
+    struct addrinfo *result = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(query->hostname, NULL, &hints, &result) == 0 && result != NULL) {
+        ip_addr_t ip;
+        memset(&ip, 0, sizeof(ip));
+        ip.type = IPADDR_TYPE_V4;
+        ip.u_addr.ip4.addr = ((struct sockaddr_in *) result->ai_addr)->sin_addr.s_addr;
+        freeaddrinfo(result);
+        query->found(query->hostname, &ip, query->callback_arg);
+    }
+    else {
+        query->found(query->hostname, NULL, query->callback_arg);
+    }
+    free(query->hostname);
+    free(query);
+    return NULL;
+}
+
+err_t dns_gethostbyname(const char *hostname, ip_addr_t *addr, dns_found_callback found, void *callback_arg) {
+    if (hostname == NULL || addr == NULL || found == NULL) {
+        return ERR_ARG;
+    }
+    struct in_addr in;
+    if (inet_aton(hostname, &in)) {
+        memset(addr, 0, sizeof(ip_addr_t));
+        addr->type = IPADDR_TYPE_V4;
+        addr->u_addr.ip4.addr = in.s_addr;
+        return ERR_OK;
+    }
+
+    struct dns_query *query = malloc(sizeof(struct dns_query));
+    if (query == NULL) {
+        return ERR_MEM;
+    }
+    query->hostname = strdup(hostname);
+    query->found = found;
+    query->callback_arg = callback_arg;
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = query->hostname == NULL ? -1 : pthread_create(&thread, &attr, resolver_thread, query);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        free(query->hostname);
+        free(query);
+        return ERR_MEM;
+    }
+    return ERR_INPROGRESS;
+}
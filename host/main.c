@@ -0,0 +1,149 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+/* Linux host build: runs the port as a normal process, for profiling and load testing off-target */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "esp_spi_flash.h"
+#include "spiffs_integration.h"
+#include "port_main.h"
+#include "port_latency.h"
+#include "port_conntrace.h"
+#include "bench_send.h"
+#include "bench_rtt.h"
+#include "bench_sched.h"
+#include "bench_wld.h"
+#include "bench_flood.h"
+
+static volatile sig_atomic_t stop = 0;
+
+static void handle_stop(int sig) {
+    stop = 1;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [-a alias] [-f flash_file] [-t max_block_ms] [-d] [-b seconds] [-r seconds] [-s seconds] [-w seconds]\n"
+            "       [-p seconds]\n"
+            "  -a alias         Alias of the identity created on first start (default: host)\n"
+            "  -f flash_file    Keep the flash contents, and so the identities, in this file (default: RAM only)\n"
+            "  -t max_block_ms  max_block_time_ms of mist_port_esp32_periodic() (default: 100)\n"
+            "  -d               Run in dual-core mode, with the I/O and protocol tasks on CPUs 0 and 1\n"
+            "  -b seconds       Run the send path benchmark, each case for this long, and exit\n"
+            "  -r seconds       Run the invoke round-trip benchmark, each case for this long, and exit\n"
+            "  -s seconds       Run the outbound scheduler benchmark, each case for this long, and exit\n"
+            "  -w seconds       Run the local discovery storm benchmark, each case for this long, and exit\n"
+            "  -p seconds       Run the flooding peer benchmark, each case for this long, and exit\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    char *alias = "host";
+    const char *flash_file = NULL;
+    unsigned int max_block_ms = 100;
+    bool dual_core = false;
+    unsigned int bench_seconds = 0;
+    unsigned int rtt_bench_seconds = 0;
+    unsigned int sched_bench_seconds = 0;
+    unsigned int wld_bench_seconds = 0;
+    unsigned int flood_bench_seconds = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:f:t:db:r:s:w:p:h")) != -1) {
+        switch (opt) {
+            case 'a':
+                alias = optarg;
+                break;
+            case 'f':
+                flash_file = optarg;
+                break;
+            case 't':
+                max_block_ms = strtoul(optarg, NULL, 10);
+                break;
+            case 'd':
+                dual_core = true;
+                break;
+            case 'b':
+                bench_seconds = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                rtt_bench_seconds = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                sched_bench_seconds = strtoul(optarg, NULL, 10);
+                break;
+            case 'w':
+                wld_bench_seconds = strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                flood_bench_seconds = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    /* lwIP reports writes to a closed connection as errors, not with a signal */
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, handle_stop);
+    signal(SIGTERM, handle_stop);
+
+    if (host_flash_init(flash_file)) {
+        esp32_spiffs_reformat();
+    }
+    esp32_spiffs_mount();
+
+    mist_port_esp32_init(alias);
+
+    if (bench_seconds > 0) {
+        return host_bench_send(bench_seconds) == 0 ? 0 : 1;
+    }
+    if (rtt_bench_seconds > 0) {
+        return host_bench_rtt(rtt_bench_seconds) == 0 ? 0 : 1;
+    }
+    if (sched_bench_seconds > 0) {
+        return host_bench_sched(sched_bench_seconds) == 0 ? 0 : 1;
+    }
+    if (wld_bench_seconds > 0) {
+        return host_bench_wld(wld_bench_seconds) == 0 ? 0 : 1;
+    }
+    if (flood_bench_seconds > 0) {
+        return host_bench_flood(flood_bench_seconds) == 0 ? 0 : 1;
+    }
+
+    if (dual_core) {
+        if (mist_port_esp32_start_dual_core(0, 1, 5) != 0) {
+            return 1;
+        }
+        while (!stop) {
+            pause();
+        }
+    }
+    else {
+        while (!stop) {
+            mist_port_esp32_periodic(max_block_ms);
+        }
+    }
+
+    /* Print the main loop latency statistics and the connection traces of the run */
+    port_latency_log();
+    port_conntrace_log();
+    esp32_spiffs_unmount();
+    return 0;
+}
@@ -0,0 +1,109 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+/* Linux host build: SPI flash and partition table */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "esp_spi_flash.h"
+#include "esp_partition.h"
+
+static uint8_t ram_flash[HOST_FLASH_SIZE];
+static uint8_t *flash = NULL;
+
+bool host_flash_init(const char *path) {
+    if (path == NULL) {
+        flash = ram_flash;
+        memset(flash, 0xff, HOST_FLASH_SIZE);
+        return true;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror("host flash file");
+        exit(1);
+    }
+    bool blank = st.st_size != HOST_FLASH_SIZE;
+    if (blank && ftruncate(fd, HOST_FLASH_SIZE) != 0) {
+        perror("host flash file");
+        exit(1);
+    }
+    /* Changes go straight to the file, so that the contents survive the process being killed */
+    flash = mmap(NULL, HOST_FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (flash == MAP_FAILED) {
+        perror("host flash mmap");
+        exit(1);
+    }
+    if (blank) {
+        memset(flash, 0xff, HOST_FLASH_SIZE);
+    }
+    return blank;
+}
+
+static bool in_range(size_t addr, size_t size) {
+    return flash != NULL && addr <= HOST_FLASH_SIZE && size <= HOST_FLASH_SIZE - addr;
+}
+
+esp_err_t spi_flash_read(size_t src_addr, void *dest, size_t size) {
+    if (!in_range(src_addr, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dest, flash + src_addr, size);
+    return ESP_OK;
+}
+
+esp_err_t spi_flash_write(size_t dest_addr, const void *src, size_t size) {
+    if (!in_range(dest_addr, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    const uint8_t *bytes = src;
+    for (size_t i = 0; i < size; i++) {
+        /* NOR flash: programming can only clear bits */
+        flash[dest_addr + i] &= bytes[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t spi_flash_erase_sector(size_t sector) {
+    if (!in_range(sector * SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memset(flash + sector * SPI_FLASH_SEC_SIZE, 0xff, SPI_FLASH_SEC_SIZE);
+    return ESP_OK;
+}
+
+static const esp_partition_t spiffs_partition = {
+    .type = ESP_PARTITION_TYPE_DATA,
+    .subtype = ESP_PARTITION_SUBTYPE_ANY,
+    .address = 0,
+    .size = HOST_FLASH_SIZE,
+    .label = "spiffs",
+    .encrypted = false,
+};
+
+esp_partition_iterator_t esp_partition_find(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label) {
+    if (type != ESP_PARTITION_TYPE_DATA || (label != NULL && strcmp(label, spiffs_partition.label) != 0)) {
+        return NULL;
+    }
+    return &spiffs_partition;
+}
+
+const esp_partition_t *esp_partition_get(esp_partition_iterator_t iterator) {
+    return iterator;
+}
@@ -0,0 +1,19 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file wish_core.h
+ * @brief Unit tests: stand-in for the wish-c99 header, for the modules under test which only pass the core around.
+ */
+
+typedef struct wish_core wish_core_t;
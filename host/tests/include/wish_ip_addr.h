@@ -0,0 +1,23 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file wish_ip_addr.h
+ * @brief Unit tests: stand-in for the wish-c99 header.
+ */
+
+#include <stdint.h>
+
+typedef struct {
+    uint8_t addr[4];
+} wish_ip_addr_t;
@@ -0,0 +1,25 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file wish_local_discovery.h
+ * @brief Unit tests: stand-in for the wish-c99 header. The test defines wish_ldiscover_feed(), and counts the adverts fed.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wish_core.h"
+#include "wish_ip_addr.h"
+
+void wish_ldiscover_feed(wish_core_t *core, wish_ip_addr_t *ip, uint16_t port, uint8_t *buffer, size_t buffer_len);
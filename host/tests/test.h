@@ -0,0 +1,43 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file test.h
+ * @brief Minimal checks for the unit tests of the host build. A failed check is printed, and the test goes on.
+ */
+
+#include <stdio.h>
+
+static int test_failures = 0;
+
+#define TEST_CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define TEST_CHECK_EQ(a, b) do { \
+        long long test_a_ = (long long) (a); \
+        long long test_b_ = (long long) (b); \
+        if (test_a_ != test_b_) { \
+            printf("%s:%d: check failed: %s == %s (%lld != %lld)\n", __FILE__, __LINE__, #a, #b, test_a_, test_b_); \
+            test_failures++; \
+        } \
+    } while (0)
+
+/** Print the result, and return the exit status of the test */
+static inline int test_report(const char *name) {
+    printf("%s: %s\n", name, test_failures == 0 ? "ok" : "FAILED");
+    return test_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,66 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file test_advert.h
+ * @brief Local discovery datagrams for the unit tests: "W." and a BSON document with string elements, as far as the port looks into
+ * adverts.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+static inline void test_put_le32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+/** Append a string element to the document which test_advert_end() closes */
+static inline size_t test_advert_string(uint8_t *buf, size_t pos, const char *key, const char *value) {
+    size_t key_len = strlen(key) + 1;
+    size_t value_len = strlen(value) + 1;
+    buf[pos++] = 0x02;
+    memcpy(buf + pos, key, key_len);
+    pos += key_len;
+    test_put_le32(buf + pos, value_len);
+    pos += 4;
+    memcpy(buf + pos, value, value_len);
+    return pos + value_len;
+}
+
+/** Start an advert, returning the position of its first element */
+static inline size_t test_advert_begin(uint8_t *buf) {
+    buf[0] = 'W';
+    buf[1] = '.';
+    return 6;
+}
+
+/** Close the document, returning the length of the advert */
+static inline size_t test_advert_end(uint8_t *buf, size_t pos) {
+    buf[pos++] = 0x00;
+    test_put_le32(buf + 2, pos - 2);
+    return pos;
+}
+
+/** An advert with a class, and an alias unless it is NULL */
+static inline size_t test_advert(uint8_t *buf, const char *advert_class, const char *alias) {
+    size_t pos = test_advert_begin(buf);
+    pos = test_advert_string(buf, pos, "class", advert_class);
+    if (alias != NULL) {
+        pos = test_advert_string(buf, pos, "alias", alias);
+    }
+    return test_advert_end(buf, pos);
+}
@@ -0,0 +1,195 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+/* Tests of the local discovery neighbour table: expiry, least recently heard eviction, and which hosts count as new, with the clock
+ * of the port under the control of the test */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "wish_local_discovery.h"
+#include "port_neighbours.h"
+#include "port_main.h"
+#include "test.h"
+#include "test_advert.h"
+
+static int64_t clock_us = 1000000000;
+
+int64_t time_helper_monotonic_us(void) {
+    return clock_us;
+}
+
+static void advance_ms(uint32_t ms) {
+    clock_us += (int64_t) ms * 1000;
+}
+
+/* port_wld.c, for port_wld_find_string(), needs these */
+void wish_ldiscover_feed(wish_core_t *core, wish_ip_addr_t *ip, uint16_t port, uint8_t *buffer, size_t buffer_len) {
+}
+
+void port_advert_trigger(void) {
+}
+
+/* Host n is 10.0.n/256.n%256, port 9090 */
+static bool heard_advert(unsigned int n, const char *advert_class, const char *alias) {
+    uint8_t buf[128];
+    size_t len = test_advert(buf, advert_class, alias);
+    wish_ip_addr_t ip = { { 10, 0, n / 256, n % 256 } };
+    /* The digest only needs to change with the advert */
+    uint32_t digest = n * 31 + len + (alias != NULL ? alias[0] : 0);
+    return port_neighbours_heard(&ip, 9090, digest, buf, len);
+}
+
+static bool heard(unsigned int n) {
+    return heard_advert(n, "t.host", NULL);
+}
+
+static unsigned int num_neighbours(void) {
+    struct mist_port_esp32_wld_stats stats;
+    port_neighbours_get_stats(&stats);
+    return stats.neighbours;
+}
+
+static unsigned int num_evicted(void) {
+    struct mist_port_esp32_wld_stats stats;
+    port_neighbours_get_stats(&stats);
+    return stats.neighbours_evicted;
+}
+
+/* Find host n in a listing of the whole table, two entries a page */
+static bool find(unsigned int n, struct mist_port_esp32_wld_neighbour *found) {
+    struct mist_port_esp32_wld_neighbour page[2];
+    unsigned int cursor = 0;
+    int num;
+    do {
+        num = mist_port_esp32_get_wld_neighbours(&cursor, page, 2);
+        for (int i = 0; i < num; i++) {
+            if (page[i].ip[0] == 10 && page[i].ip[2] == n / 256 && page[i].ip[3] == n % 256) {
+                if (found != NULL) {
+                    *found = page[i];
+                }
+                return true;
+            }
+        }
+    } while (num == 2);
+    return false;
+}
+
+/* Let every host of the previous test expire */
+static void empty_table(void) {
+    advance_ms(MIST_PORT_WLD_NEIGHBOUR_TTL_MS + 1);
+    TEST_CHECK_EQ(num_neighbours(), 0);
+}
+
+static void test_expiry(void) {
+    empty_table();
+    heard(1);
+    advance_ms(1000);
+    heard(2);
+    TEST_CHECK_EQ(num_neighbours(), 2);
+
+    /* Host 1 has not been heard from for exactly the TTL */
+    advance_ms(MIST_PORT_WLD_NEIGHBOUR_TTL_MS - 1000);
+    TEST_CHECK(find(1, NULL));
+    advance_ms(1);
+    TEST_CHECK(!find(1, NULL));
+    TEST_CHECK(find(2, NULL));
+    TEST_CHECK_EQ(num_neighbours(), 1);
+    advance_ms(1000);
+    TEST_CHECK_EQ(num_neighbours(), 0);
+}
+
+static void test_lru_eviction(void) {
+    empty_table();
+    unsigned int evicted = num_evicted();
+    for (unsigned int n = 0; n < MIST_PORT_WLD_NEIGHBOURS; n++) {
+        heard(n);
+        advance_ms(1);
+    }
+    TEST_CHECK_EQ(num_neighbours(), MIST_PORT_WLD_NEIGHBOURS);
+
+    /* Host 0 is heard again, so host 1 is now the least recently heard */
+    heard(0);
+    heard(1000);
+    TEST_CHECK_EQ(num_neighbours(), MIST_PORT_WLD_NEIGHBOURS);
+    TEST_CHECK_EQ(num_evicted(), evicted + 1);
+    TEST_CHECK(find(0, NULL));
+    TEST_CHECK(!find(1, NULL));
+    TEST_CHECK(find(2, NULL));
+    TEST_CHECK(find(1000, NULL));
+
+    heard(1001);
+    TEST_CHECK(!find(2, NULL));
+    TEST_CHECK_EQ(num_evicted(), evicted + 2);
+}
+
+static void test_strings(void) {
+    empty_table();
+    struct mist_port_esp32_wld_neighbour n;
+    heard_advert(1, "t.lamp", "kitchen");
+    advance_ms(250);
+    TEST_CHECK(find(1, &n));
+    TEST_CHECK(strcmp(n.advert_class, "t.lamp") == 0);
+    TEST_CHECK(strcmp(n.alias, "kitchen") == 0);
+    TEST_CHECK_EQ(n.port, 9090);
+    TEST_CHECK_EQ(n.heard_ms_ago, 250);
+
+    /* A changed advert updates the strings, and an alias longer than the space is cut */
+    heard_advert(1, "t.lamp", "a very long alias for a lamp in the kitchen");
+    TEST_CHECK(find(1, &n));
+    TEST_CHECK_EQ(strlen(n.alias), MIST_PORT_WLD_NEIGHBOUR_ALIAS_LEN - 1);
+    TEST_CHECK_EQ(n.heard_ms_ago, 0);
+}
+
+static void test_is_new(void) {
+    empty_table();
+    TEST_CHECK(heard(1));
+    advance_ms(5000);
+    TEST_CHECK(!heard(1));
+    advance_ms(MIST_PORT_WLD_NEIGHBOUR_QUIET_MS - 1);
+    TEST_CHECK(!heard(1));
+    /* Quiet for long enough to have been restarted or away */
+    advance_ms(MIST_PORT_WLD_NEIGHBOUR_QUIET_MS);
+    TEST_CHECK(heard(1));
+    /* Expired from the table */
+    advance_ms(MIST_PORT_WLD_NEIGHBOUR_TTL_MS);
+    TEST_CHECK(heard(1));
+}
+
+/* More hosts than the table holds: they keep evicting each other, and are not new each time they are heard again */
+static void test_is_new_when_full(void) {
+    empty_table();
+    int num_new = 0;
+    for (int round = 0; round < 3; round++) {
+        for (unsigned int n = 0; n < MIST_PORT_WLD_NEIGHBOURS + 16; n++) {
+            if (heard(n)) {
+                num_new++;
+            }
+            advance_ms(10);
+        }
+    }
+    TEST_CHECK_EQ(num_new, MIST_PORT_WLD_NEIGHBOURS);
+
+    /* When the least recently heard host has been quiet for long enough, a host missing from the table is new */
+    advance_ms(MIST_PORT_WLD_NEIGHBOUR_QUIET_MS);
+    TEST_CHECK(heard(2000));
+}
+
+int main(void) {
+    test_expiry();
+    test_lru_eviction();
+    test_strings();
+    test_is_new();
+    test_is_new_when_full();
+    return test_report("port_neighbours");
+}
@@ -0,0 +1,117 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+/* Tests of the outbound queue of a connection: compaction, growth, the limit, and when the buffer is freed */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "port_outq.h"
+#include "test.h"
+
+/* PORT_OUTQ_MIN_CAP of port_outq.c */
+#define MIN_CAP 512
+
+static uint8_t pattern[4096];
+
+/* Whether the queue holds pattern[from] ... pattern[from + len - 1] */
+static bool holds(const struct port_outq *q, size_t from, size_t len) {
+    return port_outq_len(q) == len && memcmp(port_outq_data(q), pattern + from, len) == 0;
+}
+
+static void test_push_consume(void) {
+    struct port_outq q = { 0 };
+    TEST_CHECK_EQ(port_outq_len(&q), 0);
+    TEST_CHECK_EQ(port_outq_push(&q, pattern, 100, 4096), 0);
+    TEST_CHECK_EQ(port_outq_push(&q, pattern + 100, 50, 4096), 0);
+    TEST_CHECK(holds(&q, 0, 150));
+    TEST_CHECK_EQ(q.cap, MIN_CAP);
+
+    port_outq_consume(&q, 30);
+    TEST_CHECK(holds(&q, 30, 120));
+    /* Emptying a small buffer keeps it */
+    port_outq_consume(&q, 120);
+    TEST_CHECK_EQ(port_outq_len(&q), 0);
+    TEST_CHECK(q.buf != NULL);
+    TEST_CHECK_EQ(q.head, 0);
+
+    port_outq_clear(&q);
+    TEST_CHECK(q.buf == NULL);
+    TEST_CHECK_EQ(q.cap, 0);
+}
+
+/* Data consumed from the front leaves room which is used by moving the rest to the front, instead of growing */
+static void test_compaction(void) {
+    struct port_outq q = { 0 };
+    TEST_CHECK_EQ(port_outq_push(&q, pattern, 500, 4096), 0);
+    port_outq_consume(&q, 400);
+    TEST_CHECK_EQ(port_outq_push(&q, pattern + 500, 300, 4096), 0);
+    TEST_CHECK_EQ(q.cap, MIN_CAP);
+    TEST_CHECK_EQ(q.head, 0);
+    TEST_CHECK(holds(&q, 400, 400));
+    port_outq_clear(&q);
+}
+
+static void test_growth(void) {
+    struct port_outq q = { 0 };
+    TEST_CHECK_EQ(port_outq_push(&q, pattern, 400, 4096), 0);
+    port_outq_consume(&q, 100);
+    /* 300 queued and 1000 more do not fit in 512, nor in 1024 */
+    TEST_CHECK_EQ(port_outq_push(&q, pattern + 400, 1000, 4096), 0);
+    TEST_CHECK_EQ(q.cap, 2048);
+    TEST_CHECK(holds(&q, 100, 1300));
+
+    /* Emptying a grown buffer frees it */
+    port_outq_consume(&q, 1300);
+    TEST_CHECK(q.buf == NULL);
+    TEST_CHECK_EQ(q.cap, 0);
+    TEST_CHECK_EQ(port_outq_len(&q), 0);
+}
+
+static void test_max_len(void) {
+    struct port_outq q = { 0 };
+    /* Growth stops at the limit */
+    TEST_CHECK_EQ(port_outq_push(&q, pattern, 600, 700), 0);
+    TEST_CHECK_EQ(q.cap, 700);
+    TEST_CHECK_EQ(port_outq_push(&q, pattern + 600, 100, 700), 0);
+    TEST_CHECK(holds(&q, 0, 700));
+
+    /* Data over the limit is not queued at all */
+    TEST_CHECK_EQ(port_outq_push(&q, pattern + 700, 1, 700), -1);
+    TEST_CHECK(holds(&q, 0, 700));
+    port_outq_consume(&q, 200);
+    TEST_CHECK_EQ(port_outq_push(&q, pattern + 700, 201, 700), -1);
+    TEST_CHECK(holds(&q, 200, 500));
+    TEST_CHECK_EQ(port_outq_push(&q, pattern + 700, 200, 700), 0);
+    TEST_CHECK(holds(&q, 200, 700));
+    port_outq_clear(&q);
+
+    /* Also on an empty queue, and with lengths which would overflow */
+    TEST_CHECK_EQ(port_outq_push(&q, pattern, 701, 700), -1);
+    TEST_CHECK(q.buf == NULL);
+    TEST_CHECK_EQ(port_outq_push(&q, pattern, 10, 4096), 0);
+    TEST_CHECK_EQ(port_outq_push(&q, pattern, SIZE_MAX - 5, SIZE_MAX), -1);
+    TEST_CHECK(holds(&q, 0, 10));
+    port_outq_clear(&q);
+}
+
+int main(void) {
+    for (size_t i = 0; i < sizeof(pattern); i++) {
+        pattern[i] = (uint8_t) (i * 7 + i / 256);
+    }
+    test_push_consume();
+    test_compaction();
+    test_growth();
+    test_max_len();
+    return test_report("port_outq");
+}
@@ -0,0 +1,151 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+/* Tests of the single-producer/single-consumer ring, single-threaded and with a producer and a consumer thread */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "port_spsc_ring.h"
+#include "test.h"
+
+#define THREADED_CAPACITY 8
+#define THREADED_ELEMS 2000000
+
+/* Like the receive records of dual-core mode: a header, and data which must arrive intact */
+struct elem {
+    uint32_t seq;
+    uint8_t data[60];
+};
+
+static void fill(struct elem *e, uint32_t seq) {
+    e->seq = seq;
+    memset(e->data, (uint8_t) seq, sizeof(e->data));
+}
+
+static bool intact(const struct elem *e, uint32_t seq) {
+    if (e->seq != seq) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(e->data); i++) {
+        if (e->data[i] != (uint8_t) seq) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void test_init(void) {
+    struct port_spsc_ring ring;
+    struct elem storage[8];
+    TEST_CHECK_EQ(port_spsc_ring_init(&ring, storage, sizeof(struct elem), 0), -1);
+    TEST_CHECK_EQ(port_spsc_ring_init(&ring, storage, sizeof(struct elem), 6), -1);
+    TEST_CHECK_EQ(port_spsc_ring_init(&ring, storage, sizeof(struct elem), 8), 0);
+    TEST_CHECK_EQ(port_spsc_ring_count(&ring), 0);
+    TEST_CHECK(port_spsc_ring_consumer_peek(&ring) == NULL);
+}
+
+/* Fill and empty the ring several times, so that the counters go around the storage */
+static void test_full_and_empty(void) {
+    struct port_spsc_ring ring;
+    struct elem storage[4];
+    port_spsc_ring_init(&ring, storage, sizeof(struct elem), 4);
+    uint32_t produced = 0;
+    uint32_t consumed = 0;
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 4; i++) {
+            struct elem *e = port_spsc_ring_producer_slot(&ring);
+            TEST_CHECK(e != NULL);
+            if (e == NULL) {
+                return;
+            }
+            /* Not visible before it is produced */
+            TEST_CHECK_EQ(port_spsc_ring_count(&ring), i);
+            fill(e, produced++);
+            port_spsc_ring_produce(&ring);
+        }
+        TEST_CHECK(port_spsc_ring_producer_slot(&ring) == NULL);
+        TEST_CHECK_EQ(port_spsc_ring_count(&ring), 4);
+
+        /* Peeking again returns the same element until it is consumed */
+        TEST_CHECK(port_spsc_ring_consumer_peek(&ring) == port_spsc_ring_consumer_peek(&ring));
+        struct elem *e;
+        while ((e = port_spsc_ring_consumer_peek(&ring)) != NULL) {
+            TEST_CHECK(intact(e, consumed));
+            consumed++;
+            port_spsc_ring_consume(&ring);
+        }
+        TEST_CHECK_EQ(consumed, produced);
+        TEST_CHECK_EQ(port_spsc_ring_count(&ring), 0);
+    }
+}
+
+static struct port_spsc_ring threaded_ring;
+
+static void *producer_thread(void *arg) {
+    for (uint32_t seq = 0; seq < THREADED_ELEMS; seq++) {
+        struct elem *e;
+        while ((e = port_spsc_ring_producer_slot(&threaded_ring)) == NULL) {
+            sched_yield();
+        }
+        fill(e, seq);
+        port_spsc_ring_produce(&threaded_ring);
+    }
+    return NULL;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* A small ring, so that the producer and the consumer keep catching up with each other. Every element must arrive once, in order,
+ * with the contents the producer wrote. */
+static void test_threads(void) {
+    static struct elem storage[THREADED_CAPACITY];
+    port_spsc_ring_init(&threaded_ring, storage, sizeof(struct elem), THREADED_CAPACITY);
+
+    uint64_t start_ns = now_ns();
+    pthread_t producer;
+    pthread_create(&producer, NULL, producer_thread, NULL);
+    uint32_t corrupt = 0;
+    for (uint32_t seq = 0; seq < THREADED_ELEMS; seq++) {
+        struct elem *e;
+        while ((e = port_spsc_ring_consumer_peek(&threaded_ring)) == NULL) {
+            sched_yield();
+        }
+        if (!intact(e, seq)) {
+            corrupt++;
+        }
+        port_spsc_ring_consume(&threaded_ring);
+    }
+    pthread_join(producer, NULL);
+    uint64_t elapsed_ns = now_ns() - start_ns;
+
+    TEST_CHECK_EQ(corrupt, 0);
+    TEST_CHECK_EQ(port_spsc_ring_count(&threaded_ring), 0);
+    printf("%u elements of %u bytes through a ring of %u in %llu ms, %llu elements/s\n", THREADED_ELEMS, 
+            (unsigned int) sizeof(struct elem), THREADED_CAPACITY, (unsigned long long) (elapsed_ns / 1000000), 
+            (unsigned long long) THREADED_ELEMS * 1000000000 / (elapsed_ns ? elapsed_ns : 1));
+}
+
+int main(void) {
+    test_init();
+    test_full_and_empty();
+    test_threads();
+    return test_report("port_spsc_ring");
+}
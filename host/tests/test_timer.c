@@ -0,0 +1,91 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+/* Tests of the timer wheel, with the clock of the port under the control of the test */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "port_timer.h"
+#include "test.h"
+
+static int64_t clock_us;
+
+int64_t time_helper_monotonic_us(void) {
+    return clock_us;
+}
+
+static void set_ticks(uint32_t ticks) {
+    clock_us = (int64_t) ticks * PORT_TIMER_TICK_MS * 1000;
+}
+
+static int fired;
+
+static void count_cb(void *arg) {
+    fired++;
+}
+
+/* Level 0 wraps around before its first timer: a timer in the next level 1 slot expires first */
+static void test_next_timeout_across_level0_wrap(void) {
+    static port_timer_t early;
+    static port_timer_t late;
+    set_ticks(0x100);
+    port_timer_wheel_init();
+    fired = 0;
+    port_timer_init(&early, count_cb, NULL);
+    port_timer_init(&late, count_cb, NULL);
+
+    /* 0x100 ticks away, into level 1 */
+    port_timer_start(&early, 0x100 * PORT_TIMER_TICK_MS, 0);
+    set_ticks(0x1f0);
+    port_timer_run();
+    /* 0xf0 ticks away, into level 0 */
+    port_timer_start(&late, 0xf0 * PORT_TIMER_TICK_MS, 0);
+
+    TEST_CHECK_EQ(port_timer_next_timeout_ms(100000), 0x10 * PORT_TIMER_TICK_MS);
+
+    set_ticks(0x200);
+    port_timer_run();
+    TEST_CHECK_EQ(fired, 1);
+    TEST_CHECK(!port_timer_is_pending(&early));
+    TEST_CHECK_EQ(port_timer_next_timeout_ms(100000), 0xe0 * PORT_TIMER_TICK_MS);
+
+    set_ticks(0x2e0);
+    port_timer_run();
+    TEST_CHECK_EQ(fired, 2);
+    TEST_CHECK_EQ(port_timer_next_timeout_ms(100000), 100000);
+}
+
+/* A timer in level 2 which is due before any in level 1 */
+static void test_next_timeout_level2_first(void) {
+    static port_timer_t far;
+    static port_timer_t farther;
+    set_ticks(0);
+    port_timer_wheel_init();
+    port_timer_init(&far, count_cb, NULL);
+    port_timer_init(&farther, count_cb, NULL);
+
+    /* 0x4000 ticks away, into level 2 */
+    port_timer_start(&far, 0x4000 * PORT_TIMER_TICK_MS, 0);
+    set_ticks(0x3f00);
+    port_timer_run();
+    /* 0x180 ticks away, into level 1 */
+    port_timer_start(&farther, 0x180 * PORT_TIMER_TICK_MS, 0);
+
+    TEST_CHECK_EQ(port_timer_next_timeout_ms(100000), 0x100 * PORT_TIMER_TICK_MS);
+}
+
+int main(void) {
+    test_next_timeout_across_level0_wrap();
+    test_next_timeout_level2_first();
+    return test_report("port_timer");
+}
@@ -0,0 +1,225 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+/* Tests of the local discovery filters: the string lookup in raw datagrams, the token buckets and the dedupe table, with the clock of
+ * the port under the control of the test */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "port_wld.h"
+#include "port_main.h"
+#include "test.h"
+#include "test_advert.h"
+
+static int64_t clock_us = 1000000000;
+
+int64_t time_helper_monotonic_us(void) {
+    return clock_us;
+}
+
+static void advance_ms(uint32_t ms) {
+    clock_us += (int64_t) ms * 1000;
+}
+
+static int num_fed;
+
+void wish_ldiscover_feed(wish_core_t *core, wish_ip_addr_t *ip, uint16_t port, uint8_t *buffer, size_t buffer_len) {
+    num_fed++;
+}
+
+void port_advert_trigger(void) {
+}
+
+static wish_ip_addr_t ip_of(uint8_t last) {
+    wish_ip_addr_t ip = { { 192, 168, 1, last } };
+    return ip;
+}
+
+static void test_find_string(void) {
+    uint8_t buf[128];
+    size_t len = test_advert(buf, "a.b", "kitchen");
+    size_t str_len = 0;
+
+    const char *s = port_wld_find_string(buf, len, "class", &str_len);
+    TEST_CHECK(s != NULL && str_len == 3 && memcmp(s, "a.b", 4) == 0);
+    s = port_wld_find_string(buf, len, "alias", &str_len);
+    TEST_CHECK(s != NULL && str_len == 7 && memcmp(s, "kitchen", 8) == 0);
+    TEST_CHECK(port_wld_find_string(buf, len, "name", &str_len) == NULL);
+    /* The key must match up to its terminating zero */
+    TEST_CHECK(port_wld_find_string(buf, len, "clas", &str_len) == NULL);
+}
+
+/* The datagrams come from the network: no length field may make the lookup read outside of them */
+static void test_find_string_bounds(void) {
+    uint8_t buf[128];
+    size_t pos = test_advert_begin(buf);
+    size_t elem = pos;
+    pos = test_advert_string(buf, pos, "class", "a.b");
+    size_t len = test_advert_end(buf, pos);
+    /* Offset of the length field of the string */
+    size_t len_field = elem + 1 + 6;
+    size_t str_len;
+
+    /* Cut in the middle of the string */
+    TEST_CHECK(port_wld_find_string(buf, len_field + 4 + 2, "class", &str_len) == NULL);
+    /* Cut right after the length field, and inside it */
+    TEST_CHECK(port_wld_find_string(buf, len_field + 4, "class", &str_len) == NULL);
+    TEST_CHECK(port_wld_find_string(buf, len_field + 2, "class", &str_len) == NULL);
+    /* Exactly up to the terminating zero of the string */
+    TEST_CHECK(port_wld_find_string(buf, len_field + 4 + 4, "class", &str_len) != NULL);
+
+    test_put_le32(buf + len_field, 0xffffffff);
+    TEST_CHECK(port_wld_find_string(buf, len, "class", &str_len) == NULL);
+    test_put_le32(buf + len_field, 0x80000000);
+    TEST_CHECK(port_wld_find_string(buf, len, "class", &str_len) == NULL);
+    test_put_le32(buf + len_field, len - len_field - 4 + 1);
+    TEST_CHECK(port_wld_find_string(buf, len, "class", &str_len) == NULL);
+    test_put_le32(buf + len_field, 0);
+    TEST_CHECK(port_wld_find_string(buf, len, "class", &str_len) == NULL);
+
+    /* A string without its terminating zero */
+    test_put_le32(buf + len_field, 4);
+    buf[len_field + 4 + 3] = 'x';
+    TEST_CHECK(port_wld_find_string(buf, len, "class", &str_len) == NULL);
+
+    TEST_CHECK(port_wld_find_string(buf, 0, "class", &str_len) == NULL);
+}
+
+static void set_rates(uint32_t source_per_s, uint32_t source_burst, uint32_t global_per_s, uint32_t global_burst) {
+    struct mist_port_esp32_wld_rate_limit limit = { source_per_s, source_burst, global_per_s, global_burst };
+    mist_port_esp32_set_wld_rate_limit(&limit);
+}
+
+static int count_within(const wish_ip_addr_t *ip, uint16_t port, int n) {
+    int within = 0;
+    for (int i = 0; i < n; i++) {
+        if (port_wld_within_rate(ip, port)) {
+            within++;
+        }
+    }
+    return within;
+}
+
+static void test_source_bucket(void) {
+    wish_ip_addr_t ip = ip_of(1);
+    struct mist_port_esp32_wld_stats before, after;
+    set_rates(2, 5, 1000, 1000);
+    mist_port_esp32_get_wld_stats(&before);
+
+    /* A new source starts with a full bucket */
+    TEST_CHECK_EQ(count_within(&ip, 9090, 7), 5);
+    /* 2 per second: a token every 500 ms */
+    advance_ms(499);
+    TEST_CHECK_EQ(count_within(&ip, 9090, 1), 0);
+    advance_ms(1);
+    TEST_CHECK_EQ(count_within(&ip, 9090, 2), 1);
+    /* Refilled up to the burst, no more */
+    advance_ms(60000);
+    TEST_CHECK_EQ(count_within(&ip, 9090, 7), 5);
+
+    /* Another core on the same host has a bucket of its own */
+    TEST_CHECK_EQ(count_within(&ip, 9091, 5), 5);
+
+    mist_port_esp32_get_wld_stats(&after);
+    TEST_CHECK_EQ(after.received - before.received, 22);
+    TEST_CHECK_EQ(after.rate_limited_source - before.rate_limited_source, 6);
+    TEST_CHECK_EQ(after.rate_limited_global - before.rate_limited_global, 0);
+}
+
+static void test_global_bucket(void) {
+    struct mist_port_esp32_wld_stats before, after;
+    set_rates(2, 5, 10, 3);
+    mist_port_esp32_get_wld_stats(&before);
+
+    int within = 0;
+    for (uint8_t i = 10; i < 15; i++) {
+        wish_ip_addr_t ip = ip_of(i);
+        within += count_within(&ip, 9090, 1);
+    }
+    TEST_CHECK_EQ(within, 3);
+    /* 10 per second: a token every 100 ms */
+    advance_ms(100);
+    wish_ip_addr_t ip = ip_of(20);
+    TEST_CHECK_EQ(count_within(&ip, 9090, 2), 1);
+
+    mist_port_esp32_get_wld_stats(&after);
+    TEST_CHECK_EQ(after.rate_limited_global - before.rate_limited_global, 3);
+
+    /* Setting the rates starts over with full buckets */
+    set_rates(2, 5, 10, 3);
+    TEST_CHECK_EQ(count_within(&ip, 9090, 4), 3);
+}
+
+static void test_dedupe(void) {
+    uint8_t buf[128];
+    size_t len = test_advert(buf, "a.b", "kitchen");
+    wish_ip_addr_t ip = ip_of(30);
+    struct mist_port_esp32_wld_stats before, after;
+    mist_port_esp32_get_wld_stats(&before);
+    num_fed = 0;
+
+    port_wld_feed(NULL, &ip, 9090, buf, len);
+    port_wld_feed(NULL, &ip, 9090, buf, len);
+    TEST_CHECK_EQ(num_fed, 1);
+    /* The same advert from another source, or a changed advert, is not a duplicate */
+    port_wld_feed(NULL, &ip, 9091, buf, len);
+    TEST_CHECK_EQ(num_fed, 2);
+    len = test_advert(buf, "a.b", "kitchen2");
+    port_wld_feed(NULL, &ip, 9090, buf, len);
+    TEST_CHECK_EQ(num_fed, 3);
+
+    advance_ms(MIST_PORT_WLD_DEDUPE_WINDOW_MS - 1);
+    port_wld_feed(NULL, &ip, 9090, buf, len);
+    TEST_CHECK_EQ(num_fed, 3);
+    /* The window is counted from when the advert was last fed */
+    advance_ms(1);
+    port_wld_feed(NULL, &ip, 9090, buf, len);
+    TEST_CHECK_EQ(num_fed, 4);
+
+    mist_port_esp32_get_wld_stats(&after);
+    TEST_CHECK_EQ(after.fed - before.fed, 4);
+    TEST_CHECK_EQ(after.duplicates - before.duplicates, 2);
+}
+
+static void test_class_filter(void) {
+    uint8_t buf[128];
+    wish_ip_addr_t ip = ip_of(40);
+    const char *classes[] = { "a.b" };
+    TEST_CHECK_EQ(mist_port_esp32_set_wld_class_filter(classes, 1), 0);
+    num_fed = 0;
+
+    size_t len = test_advert(buf, "a.bc", NULL);
+    port_wld_feed(NULL, &ip, 9090, buf, len);
+    TEST_CHECK_EQ(num_fed, 0);
+    len = test_advert(buf, "a.b", NULL);
+    port_wld_feed(NULL, &ip, 9090, buf, len);
+    TEST_CHECK_EQ(num_fed, 1);
+    /* Without a class, the core decides */
+    size_t pos = test_advert_begin(buf);
+    len = test_advert_end(buf, test_advert_string(buf, pos, "alias", "x"));
+    port_wld_feed(NULL, &ip, 9090, buf, len);
+    TEST_CHECK_EQ(num_fed, 2);
+
+    TEST_CHECK_EQ(mist_port_esp32_set_wld_class_filter(NULL, 0), 0);
+}
+
+int main(void) {
+    test_find_string();
+    test_find_string_bounds();
+    test_source_bucket();
+    test_global_bucket();
+    test_dedupe();
+    test_class_filter();
+    return test_report("port_wld");
+}
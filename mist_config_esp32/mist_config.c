@@ -30,6 +30,7 @@
 #include "wish_identity.h"
 #include "wish_connection.h"
 #include "port_net.h"
+#include "port_main.h"
 
 #include "driver/uart.h"
  
@@ -53,6 +54,7 @@
 
 static enum mist_error wifi_read(mist_ep* ep, wish_protocol_peer_t* peer, int request_id);
 static enum mist_error wifi_invoke(mist_ep* ep, wish_protocol_peer_t* peer, int request_id, bson* args);
+static enum mist_error wld_neighbours_invoke(mist_ep* ep, wish_protocol_peer_t* peer, int request_id, bson* args);
 
 static mist_app_t* mist_app;
 static wish_app_t *app;
@@ -68,6 +70,10 @@ static mist_ep mist_commissioning_ep = { .id = "wifiCommissioning", .label = "wi
 
 static mist_ep uptime_ep = {.id = "uptime", .label = "Uptime", .type = MIST_TYPE_INT, .read = wifi_read};
 static mist_ep port_version_ep = { .id = "portVersion", .label = "Port version", .type = MIST_TYPE_STRING, .read = wifi_read };
+static mist_ep wld_neighbours_ep = { .id = "wldNeighbours", .label = "Local discovery neighbours", .type = MIST_TYPE_INVOKE, .invoke = wld_neighbours_invoke };
+
+/* The number of neighbours in one reply of wldNeighbours, so that a reply fits in the RPC buffers */
+#define WLD_NEIGHBOURS_PAGE 8
 
 static int uptime_minutes;
 
@@ -286,6 +292,68 @@ static enum mist_error wifi_invoke(mist_ep* ep, wish_protocol_peer_t* peer, int
     return MIST_NO_ERROR;
 }
 
+/**
+ * Handler for endpoint wldNeighbours: list the hosts heard advertising on the local network, from the neighbour table of the port,
+ * which holds more of them than the wld.list of the core.
+ *
+ * The table is listed a page at a time. Start with cursor 0, and invoke again with the returned cursor while more is true:
+ *
+ * mist.control.invoke(peers[45], "wldNeighbours", { cursor: 0 })
+ *
+ * { list: { '0': { ip: '192.168.1.23', port: 37008, heardMsAgo: 1200, alias: 'Kitchen', class: 'fi.controlthings.switch' },
+ *           ... },
+ *   cursor: 8,
+ *   more: true }
+ */
+static enum mist_error wld_neighbours_invoke(mist_ep* ep, wish_protocol_peer_t* peer, int request_id, bson* args) {
+    unsigned int cursor = 0;
+    bson_iterator it;
+    if (bson_find(&it, args, "args") == BSON_OBJECT) {
+        bson_iterator sit;
+        bson_iterator_subiterator(&it, &sit);
+        bson_find_fieldpath_value("cursor", &sit);
+        if (bson_iterator_type(&sit) == BSON_INT && bson_iterator_int(&sit) >= 0) {
+            cursor = bson_iterator_int(&sit);
+        }
+    }
+
+    struct mist_port_esp32_wld_neighbour neighbours[WLD_NEIGHBOURS_PAGE];
+    int num = mist_port_esp32_get_wld_neighbours(&cursor, neighbours, WLD_NEIGHBOURS_PAGE);
+
+    bson bs;
+    bson_init(&bs);
+    bson_append_start_object(&bs, "data");
+    bson_append_start_object(&bs, "list");
+    for (int i = 0; i < num; i++) {
+        char arr_index[4];
+        char ip_str[16];
+        snprintf(arr_index, sizeof(arr_index), "%i", i);
+        snprintf(ip_str, sizeof(ip_str), "%i.%i.%i.%i", neighbours[i].ip[0], neighbours[i].ip[1], neighbours[i].ip[2], 
+                neighbours[i].ip[3]);
+        bson_append_start_object(&bs, arr_index);
+        bson_append_string(&bs, "ip", ip_str);
+        bson_append_int(&bs, "port", neighbours[i].port);
+        bson_append_int(&bs, "heardMsAgo", neighbours[i].heard_ms_ago);
+        bson_append_string(&bs, "alias", neighbours[i].alias);
+        bson_append_string(&bs, "class", neighbours[i].advert_class);
+        bson_append_finish_object(&bs);
+    }
+    bson_append_finish_object(&bs);
+    bson_append_int(&bs, "cursor", cursor);
+    bson_append_bool(&bs, "more", num == WLD_NEIGHBOURS_PAGE);
+    bson_append_finish_object(&bs);
+    bson_finish(&bs);
+
+    if (bs.err) {
+        WISHDEBUG(LOG_CRITICAL, "BSON error while listing the neighbours");
+        bson_destroy(&bs);
+        return MIST_ERROR;
+    }
+    mist_invoke_response(ep->model->mist_app, ep->id, request_id, &bs);
+    bson_destroy(&bs);
+    return MIST_NO_ERROR;
+}
+
 static void friend_request_accept_cb(rpc_client_req* req, void* ctx, const uint8_t* data, size_t data_len) {
     WISHDEBUG(LOG_CRITICAL, "Friend request accept cb, data_len = %i", data_len);
     bson_visit("Friend request accept cb", data);
@@ -551,6 +619,7 @@ void mist_config_init(void) {
     mist_ep_add(&(mist_app->model), mist_super_ep.id, &mist_commissioning_ep);
     mist_ep_add(&(mist_app->model), NULL, &uptime_ep);
     mist_ep_add(&(mist_app->model), NULL, &port_version_ep);
+    mist_ep_add(&(mist_app->model), NULL, &wld_neighbours_ep);
 
     ota_update_init(&(mist_app->model));
 
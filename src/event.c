@@ -19,13 +19,13 @@
 #include "wish_platform.h"
 
 #include "port_log.h"
+#include "port_event.h"
 
 #define TAG "port event.c"
 
 int event_read = 0;
 int event_write = 0;
 int num_curr_events = 0;
-#define EVENT_QUEUE_LEN 40
 struct wish_event events[EVENT_QUEUE_LEN];
 
 void wish_message_processor_notify(struct wish_event *ev) {
@@ -48,3 +48,6 @@ struct wish_event * wish_get_next_event() {
     return ev;
 }
 
+int port_event_queue_len(void) {
+    return num_curr_events;
+}
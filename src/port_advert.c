@@ -0,0 +1,198 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "port_advert.h"
+#include "port_main.h"
+#include "port_net.h"
+#include "port_timer.h"
+#include "port_wakeup.h"
+#include "port_dualcore.h"
+#include "port_log.h"
+#include "time_helper.h"
+
+#define TAG "port_advert"
+
+/* The core produces the adverts of all local identities in one go. An advert offered later than this after the first one of the
+ * round starts a new round. */
+#define ROUND_GAP_MS 100
+
+struct kept_advert {
+    size_t len;
+    uint8_t msg[MIST_PORT_ADVERT_MAX_LEN];
+};
+
+static struct kept_advert kept[MIST_PORT_ADVERT_CACHE_SLOTS];
+static int num_kept = 0;
+/* The number of adverts kept of the previous round, which the adverts of this round are compared with */
+static int num_kept_prev = 0;
+static uint32_t round_start_ms;
+static bool round_started = false;
+static uint32_t produced_ms;
+
+static port_timer_t advert_timer;
+/* The interval after the next round, and the one after the last round */
+static uint32_t interval_ms = MIST_PORT_ADVERT_INTERVAL_MIN_MS;
+static uint32_t current_interval_ms = MIST_PORT_ADVERT_INTERVAL_MIN_MS;
+static uint32_t last_sent_ms;
+static bool sent_any = false;
+/* When the earliest trigger not yet followed by an advert round happened */
+static uint32_t trigger_ms;
+static bool trigger_pending = false;
+
+static volatile bool burst_requested = false;
+
+static struct mist_port_esp32_advert_stats advert_stats;
+static uint32_t latency_ms[MIST_PORT_ADVERT_LATENCY_SAMPLES];
+static int latency_next = 0;
+static int latency_count = 0;
+/* The rounds sent per minute of the last hour, and the minute since boot they were last updated at */
+static uint16_t minute_rounds[60];
+static uint32_t minute_now = 0;
+
+static uint32_t now_ms(void) {
+    return (uint32_t) (time_helper_monotonic_us() / 1000);
+}
+
+static void advance_minutes(uint32_t minute) {
+    if (minute - minute_now >= 60) {
+        memset(minute_rounds, 0, sizeof(minute_rounds));
+        minute_now = minute;
+        return;
+    }
+    while (minute_now != minute) {
+        minute_now++;
+        minute_rounds[minute_now % 60] = 0;
+    }
+}
+
+static void count_round(uint32_t now) {
+    advert_stats.rounds++;
+    advance_minutes(now / 60000);
+    minute_rounds[minute_now % 60]++;
+    if (trigger_pending) {
+        trigger_pending = false;
+        latency_ms[latency_next] = now - trigger_ms;
+        latency_next = (latency_next + 1) % MIST_PORT_ADVERT_LATENCY_SAMPLES;
+        if (latency_count < MIST_PORT_ADVERT_LATENCY_SAMPLES) {
+            latency_count++;
+        }
+    }
+}
+
+static void send_round(void *arg) {
+    uint32_t now = now_ms();
+    if (num_kept == 0 || now - produced_ms > MIST_PORT_ADVERT_CACHE_TTL_MS) {
+        /* Nothing to send until the core produces adverts again */
+        return;
+    }
+    for (int i = 0; i < num_kept; i++) {
+        port_net_send_advertizement(kept[i].msg, kept[i].len);
+    }
+    count_round(now);
+    last_sent_ms = now;
+    sent_any = true;
+    port_timer_start(&advert_timer, interval_ms, 0);
+    current_interval_ms = interval_ms;
+    interval_ms = interval_ms < MIST_PORT_ADVERT_INTERVAL_MAX_MS / 2 ? interval_ms * 2 : MIST_PORT_ADVERT_INTERVAL_MAX_MS;
+}
+
+void port_advert_init(void) {
+    port_timer_init(&advert_timer, send_round, NULL);
+    /* Boot is a trigger: the first adverts of the core go out right away */
+    port_advert_trigger();
+}
+
+void port_advert_trigger(void) {
+    uint32_t now = now_ms();
+    advert_stats.triggers++;
+    if (!trigger_pending) {
+        trigger_pending = true;
+        trigger_ms = now;
+    }
+    interval_ms = MIST_PORT_ADVERT_INTERVAL_MIN_MS;
+    /* Many triggers in a row, such as adverts from many new peers, do not make the rounds more frequent than the minimum interval */
+    uint32_t delay_ms = 0;
+    if (sent_any && now - last_sent_ms < MIST_PORT_ADVERT_INTERVAL_MIN_MS) {
+        delay_ms = MIST_PORT_ADVERT_INTERVAL_MIN_MS - (now - last_sent_ms);
+    }
+    port_timer_start(&advert_timer, delay_ms, 0);
+}
+
+bool port_advert_offer(const uint8_t *ad_msg, size_t ad_len) {
+    uint32_t now = now_ms();
+    if (!round_started || now - round_start_ms > ROUND_GAP_MS) {
+        round_started = true;
+        round_start_ms = now;
+        num_kept_prev = num_kept;
+        num_kept = 0;
+    }
+    if (num_kept >= MIST_PORT_ADVERT_CACHE_SLOTS || ad_len > MIST_PORT_ADVERT_MAX_LEN) {
+        return false;
+    }
+    struct kept_advert *k = &kept[num_kept];
+    bool changed = num_kept >= num_kept_prev || k->len != ad_len || memcmp(k->msg, ad_msg, ad_len) != 0;
+    if (changed) {
+        memcpy(k->msg, ad_msg, ad_len);
+        k->len = ad_len;
+    }
+    num_kept++;
+    produced_ms = now;
+    /* The schedule has stopped if the kept adverts had expired */
+    if (changed || !port_timer_is_pending(&advert_timer)) {
+        port_advert_trigger();
+    }
+    return true;
+}
+
+void port_advert_poll(void) {
+    if (burst_requested) {
+        burst_requested = false;
+        port_advert_trigger();
+    }
+}
+
+void mist_port_esp32_advert_burst(void) {
+    burst_requested = true;
+    /* Interrupt the main loop's wait, so that the adverts go out right away */
+    if (port_dualcore_active()) {
+        port_dualcore_wakeup_protocol();
+    }
+    else {
+        port_wakeup_signal();
+    }
+}
+
+void mist_port_esp32_get_advert_stats(struct mist_port_esp32_advert_stats *stats) {
+    *stats = advert_stats;
+    stats->interval_ms = current_interval_ms;
+
+    advance_minutes(now_ms() / 60000);
+    stats->rounds_last_hour = 0;
+    for (int i = 0; i < 60; i++) {
+        stats->rounds_last_hour += minute_rounds[i];
+    }
+
+    /* Insertion sort of a copy, there are only a few samples */
+    uint32_t sorted[MIST_PORT_ADVERT_LATENCY_SAMPLES];
+    for (int i = 0; i < latency_count; i++) {
+        int j = i;
+        for (; j > 0 && sorted[j - 1] > latency_ms[i]; j--) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = latency_ms[i];
+    }
+    stats->median_latency_ms = latency_count > 0 ? sorted[latency_count / 2] : 0;
+}
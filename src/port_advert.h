@@ -0,0 +1,76 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file port_advert.h
+ * @brief Adaptive schedule of the local discovery adverts.
+ *
+ * The core produces its adverts on a fixed cadence, and gives them to wish_send_advertizement(). The port keeps the adverts of the
+ * latest round, and sends them on a schedule of its own: every MIST_PORT_ADVERT_INTERVAL_MIN_MS right after a trigger, then backing
+ * off exponentially to MIST_PORT_ADVERT_INTERVAL_MAX_MS. The triggers are boot, the link coming up, a changed advert,
+ * mist_port_esp32_advert_burst(), for example when the commissioning AP starts or a station joins it, and an advert from a peer not
+ * heard from recently. A peer which has just come up advertises itself, and gets an advert back right away.
+ *
+ * If the core stops producing adverts, for example because local discovery was disabled, the kept adverts expire after
+ * MIST_PORT_ADVERT_CACHE_TTL_MS, and nothing is sent.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/** The advert interval right after a trigger */
+#ifndef MIST_PORT_ADVERT_INTERVAL_MIN_MS
+#define MIST_PORT_ADVERT_INTERVAL_MIN_MS 1000
+#endif
+
+/** The advert interval backs off to this on a stable network */
+#ifndef MIST_PORT_ADVERT_INTERVAL_MAX_MS
+#define MIST_PORT_ADVERT_INTERVAL_MAX_MS 30000
+#endif
+
+/** Adverts which the core has not produced again for this long are not sent anymore */
+#ifndef MIST_PORT_ADVERT_CACHE_TTL_MS
+#define MIST_PORT_ADVERT_CACHE_TTL_MS 60000
+#endif
+
+/** The number of adverts kept of one round, one per local identity */
+#ifndef MIST_PORT_ADVERT_CACHE_SLOTS
+#define MIST_PORT_ADVERT_CACHE_SLOTS 2
+#endif
+
+/** The longest advert which is kept. A longer one is sent right away on the cadence of the core. */
+#ifndef MIST_PORT_ADVERT_MAX_LEN
+#define MIST_PORT_ADVERT_MAX_LEN 512
+#endif
+
+/** The number of latest trigger-to-advert delays the median discovery latency is taken of */
+#ifndef MIST_PORT_ADVERT_LATENCY_SAMPLES
+#define MIST_PORT_ADVERT_LATENCY_SAMPLES 16
+#endif
+
+/** Initialise the schedule, and start it fast. Called by mist_port_esp32_init(). */
+void port_advert_init(void);
+
+/**
+ * Keep an advert produced by the core, to be sent on the schedule of the port.
+ *
+ * @return true if the advert was kept, false if it did not fit and must be sent right away
+ */
+bool port_advert_offer(const uint8_t *ad_msg, size_t ad_len);
+
+/** Send the adverts as soon as the minimum interval allows, and start backing off again from the minimum interval */
+void port_advert_trigger(void);
+
+/** Act on mist_port_esp32_advert_burst() calls from other tasks. Called by the main loop. */
+void port_advert_poll(void);
@@ -0,0 +1,148 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "wish_connection.h"
+
+#include "port_conntrace.h"
+#include "port_net.h"
+#include "port_log.h"
+#include "time_helper.h"
+
+#define TAG "port_conntrace"
+
+/* The traces of the connections in progress, indexed like core->connection_pool */
+struct active_trace {
+    bool active;
+    struct port_conntrace trace;
+};
+
+static struct active_trace active[WISH_PORT_CONTEXT_POOL_SZ];
+
+/* The completed traces. ring_next is where the next one goes, ring_count saturates at the ring length. */
+static struct port_conntrace ring[MIST_PORT_CONNTRACE_RING_LEN];
+static int ring_next = 0;
+static int ring_count = 0;
+
+static const char *outcome_names[] = {
+    [PORT_CONNTRACE_CLOSED] = "closed",
+    [PORT_CONNTRACE_HANDSHAKE_FAILED] = "handshake failed",
+    [PORT_CONNTRACE_DNS_FAILED] = "dns failed",
+    [PORT_CONNTRACE_CONNECT_FAILED] = "connect failed",
+    [PORT_CONNTRACE_CONNECT_TIMEOUT] = "connect timeout",
+    [PORT_CONNTRACE_RACE_LOST] = "race lost",
+    [PORT_CONNTRACE_LINK_LOST] = "link lost",
+};
+
+static struct active_trace *get_active(wish_connection_t *ctx) {
+    return &active[ctx - port_net_get_core()->connection_pool];
+}
+
+static uint32_t elapsed_ms(const struct port_conntrace *trace) {
+    return (uint32_t) ((time_helper_monotonic_us() - trace->start_us) / 1000);
+}
+
+void port_conntrace_begin(wish_connection_t *ctx, bool incoming) {
+    struct active_trace *at = get_active(ctx);
+    if (at->active) {
+        return;
+    }
+    memset(&at->trace, 0, sizeof(at->trace));
+    at->active = true;
+    at->trace.start_us = time_helper_monotonic_us();
+    for (int i = 0; i < PORT_CONNTRACE_NUM_MARKS; i++) {
+        at->trace.mark_ms[i] = PORT_CONNTRACE_NOT_REACHED;
+    }
+    at->trace.incoming = incoming;
+    at->trace.via_relay = ctx->via_relay;
+}
+
+void port_conntrace_set_peer(wish_connection_t *ctx, const uint8_t ip[4], uint16_t port) {
+    struct active_trace *at = get_active(ctx);
+    if (!at->active) {
+        return;
+    }
+    memcpy(at->trace.ip, ip, sizeof(at->trace.ip));
+    at->trace.port = port;
+}
+
+void port_conntrace_mark(wish_connection_t *ctx, enum port_conntrace_mark mark) {
+    struct active_trace *at = get_active(ctx);
+    if (!at->active || mark >= PORT_CONNTRACE_NUM_MARKS || at->trace.mark_ms[mark] != PORT_CONNTRACE_NOT_REACHED) {
+        return;
+    }
+    at->trace.mark_ms[mark] = elapsed_ms(&at->trace);
+}
+
+bool port_conntrace_has_mark(wish_connection_t *ctx, enum port_conntrace_mark mark) {
+    struct active_trace *at = get_active(ctx);
+    return at->active && mark < PORT_CONNTRACE_NUM_MARKS && at->trace.mark_ms[mark] != PORT_CONNTRACE_NOT_REACHED;
+}
+
+void port_conntrace_end(wish_connection_t *ctx, enum port_conntrace_outcome outcome) {
+    struct active_trace *at = get_active(ctx);
+    if (!at->active) {
+        return;
+    }
+    at->active = false;
+    if (outcome == PORT_CONNTRACE_CLOSED && at->trace.mark_ms[PORT_CONNTRACE_HANDSHAKE_DONE] == PORT_CONNTRACE_NOT_REACHED) {
+        outcome = PORT_CONNTRACE_HANDSHAKE_FAILED;
+    }
+    at->trace.outcome = outcome;
+    at->trace.lifetime_ms = elapsed_ms(&at->trace);
+
+    ring[ring_next] = at->trace;
+    ring_next = (ring_next + 1) % MIST_PORT_CONNTRACE_RING_LEN;
+    if (ring_count < MIST_PORT_CONNTRACE_RING_LEN) {
+        ring_count++;
+    }
+}
+
+int port_conntrace_get(struct port_conntrace *traces, int max_traces) {
+    int n = 0;
+    for (; n < ring_count && n < max_traces; n++) {
+        traces[n] = ring[(ring_next - 1 - n + MIST_PORT_CONNTRACE_RING_LEN) % MIST_PORT_CONNTRACE_RING_LEN];
+    }
+    return n;
+}
+
+const char *port_conntrace_outcome_name(enum port_conntrace_outcome outcome) {
+    if ((unsigned int) outcome >= sizeof(outcome_names) / sizeof(outcome_names[0])) {
+        return "unknown";
+    }
+    return outcome_names[outcome];
+}
+
+/* The duration between two marks, or -1 if either was not reached */
+static int mark_delta(const struct port_conntrace *trace, int from, int to) {
+    uint32_t from_ms = from < 0 ? 0 : trace->mark_ms[from];
+    if (from_ms == PORT_CONNTRACE_NOT_REACHED || trace->mark_ms[to] == PORT_CONNTRACE_NOT_REACHED) {
+        return -1;
+    }
+    return trace->mark_ms[to] - from_ms;
+}
+
+void port_conntrace_log(void) {
+    for (int n = 0; n < ring_count; n++) {
+        const struct port_conntrace *t = &ring[(ring_next - 1 - n + MIST_PORT_CONNTRACE_RING_LEN) % MIST_PORT_CONNTRACE_RING_LEN];
+        PORT_LOGINFO(TAG, "%s %u.%u.%u.%u:%u%s: %s after %u ms, before connect %i connect %i handshake %i first frame %i ms",
+                t->incoming ? "in" : "out", t->ip[0], t->ip[1], t->ip[2], t->ip[3], t->port, t->via_relay ? " (relay)" : "",
+                port_conntrace_outcome_name(t->outcome), t->lifetime_ms,
+                mark_delta(t, -1, PORT_CONNTRACE_CONNECT_START),
+                mark_delta(t, PORT_CONNTRACE_CONNECT_START, PORT_CONNTRACE_CONNECTED),
+                mark_delta(t, PORT_CONNTRACE_CONNECTED, PORT_CONNTRACE_HANDSHAKE_DONE),
+                mark_delta(t, PORT_CONNTRACE_HANDSHAKE_DONE, PORT_CONNTRACE_FIRST_FRAME));
+    }
+}
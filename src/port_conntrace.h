@@ -0,0 +1,115 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file port_conntrace.h
+ * @brief Lifecycle traces of Wish connections.
+ *
+ * Each Wish connection has a trace record, where the time of each transition of the connection setup is recorded: DNS resolving,
+ * TCP connect(), the Wish handshake and the first frame after it. When the connection ends, its record is moved to a ring of the
+ * most recent traces, with the peer address and the outcome. The ring can be read with port_conntrace_get(), to find out where the
+ * setup time of slow connections goes.
+ *
+ * The hooks are called by the port from the task running the Wish core, and port_conntrace_get() must be called from that task too.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "wish_connection.h"
+
+/** The number of completed traces kept */
+#ifndef MIST_PORT_CONNTRACE_RING_LEN
+#define MIST_PORT_CONNTRACE_RING_LEN 16
+#endif
+
+/** The transitions of a connection, in the order in which they happen */
+enum port_conntrace_mark {
+    /** connect() was called, after DNS resolving if any. For an incoming connection, accept() returned. */
+    PORT_CONNTRACE_CONNECT_START,
+    /** connect() completed */
+    PORT_CONNTRACE_CONNECTED,
+    /** The Wish handshake completed */
+    PORT_CONNTRACE_HANDSHAKE_DONE,
+    /** The first data was received after the handshake */
+    PORT_CONNTRACE_FIRST_FRAME,
+    PORT_CONNTRACE_NUM_MARKS
+};
+
+enum port_conntrace_outcome {
+    /** The connection was open and closed after the handshake */
+    PORT_CONNTRACE_CLOSED,
+    /** The connection was closed after connect() but before the Wish handshake completed */
+    PORT_CONNTRACE_HANDSHAKE_FAILED,
+    PORT_CONNTRACE_DNS_FAILED,
+    PORT_CONNTRACE_CONNECT_FAILED,
+    PORT_CONNTRACE_CONNECT_TIMEOUT,
+    /** The other transport to the same peer connected first */
+    PORT_CONNTRACE_RACE_LOST,
+    /** The connection was closed because the station lost its link or changed its address */
+    PORT_CONNTRACE_LINK_LOST,
+};
+
+/** Value of a mark which was not reached */
+#define PORT_CONNTRACE_NOT_REACHED UINT32_MAX
+
+struct port_conntrace {
+    /** time_helper_monotonic_us() when the connection was started: resolving, connect() or accept() */
+    int64_t start_us;
+    /** Milliseconds from start_us to each transition, PORT_CONNTRACE_NOT_REACHED if it did not happen */
+    uint32_t mark_ms[PORT_CONNTRACE_NUM_MARKS];
+    /** Milliseconds from start_us to the end of the connection */
+    uint32_t lifetime_ms;
+    /** The peer address, all zeroes if unknown, e.g. when resolving failed */
+    uint8_t ip[4];
+    uint16_t port;
+    bool incoming;
+    bool via_relay;
+    enum port_conntrace_outcome outcome;
+};
+
+/**
+ * Start tracing a connection. Does nothing if the connection is already being traced, for example when connect() follows DNS
+ * resolving.
+ */
+void port_conntrace_begin(wish_connection_t *ctx, bool incoming);
+
+/** Record the peer address of a traced connection */
+void port_conntrace_set_peer(wish_connection_t *ctx, const uint8_t ip[4], uint16_t port);
+
+/** Record a transition of a traced connection, if it has not been recorded yet */
+void port_conntrace_mark(wish_connection_t *ctx, enum port_conntrace_mark mark);
+
+/** Check if a transition of a traced connection has been recorded */
+bool port_conntrace_has_mark(wish_connection_t *ctx, enum port_conntrace_mark mark);
+
+/**
+ * End the trace of a connection, and move it to the ring of completed traces. Does nothing if the connection is not being traced,
+ * so the most specific outcome is the one recorded first. PORT_CONNTRACE_CLOSED becomes PORT_CONNTRACE_HANDSHAKE_FAILED if the
+ * handshake had not completed.
+ */
+void port_conntrace_end(wish_connection_t *ctx, enum port_conntrace_outcome outcome);
+
+/**
+ * Get the most recent completed traces, newest first.
+ *
+ * @return The number of traces copied, at most max_traces
+ */
+int port_conntrace_get(struct port_conntrace *traces, int max_traces);
+
+const char *port_conntrace_outcome_name(enum port_conntrace_outcome outcome);
+
+/**
+ * Print out the completed traces in the ring.
+ */
+void port_conntrace_log(void);
@@ -20,16 +20,22 @@
 #include "lwip/ip4_addr.h"
 #include "lwip/dns.h"
 
+#include "wish_core.h"
 #include "wish_ip_addr.h"
 #include "port_dns.h"
 #include "wish_connection_mgr.h"
 #include "port_relay_client.h"
 #include "port_log.h"
+#include "port_wakeup.h"
+#include "port_dualcore.h"
+#include "port_conntrace.h"
 
 QueueHandle_t dnsResultQueue;
 
 struct dns_callback_arg {
     wish_connection_t *conn;
+    /* The resolve_id of the connection when the query was started */
+    uint32_t id;
     wish_relay_client_t *relay;
     wish_core_t *core;
 };
@@ -38,12 +44,21 @@ struct dns_result_item {
     bool error; 
     wish_ip_addr_t ip; 
     wish_connection_t *conn;
+    uint32_t id;
     wish_relay_client_t *relay;
     wish_core_t *core;
 };
 
 #define TAG "port_dns"
 
+/* Incremented when a query is started for a Wish connection, and when it is cancelled. lwIP cannot cancel a query, so a result whose
+ * id is not the current one of its connection is dropped instead. Owned by the task running Wish. */
+static uint32_t resolve_id[WISH_PORT_CONTEXT_POOL_SZ];
+
+static int conn_index(wish_connection_t *conn) {
+    return conn - conn->core->connection_pool;
+}
+
 /** The callback to dns_gethostbyname(). 
  * Note that this is called by an other thread (not the main thread which runs Wish and Mist). Hence the IPC messaging.
  */
@@ -79,10 +94,19 @@ void dns_resolve_cb(const char *name, const ip_addr_t *ip_addr, void *arg) {
     }
     
     queue_item.conn = callback_arg->conn;
+    queue_item.id = callback_arg->id;
     queue_item.relay = callback_arg->relay;
     queue_item.core = callback_arg->core;
     if (xQueueSend(dnsResultQueue, &queue_item, 0) != pdTRUE) {
         PORT_LOGERR(TAG, "Cannot put to DNS result queue!");
+        return;
+    }
+    /* Interrupt the main loop's wait, so that the connection is opened right away */
+    if (port_dualcore_active()) {
+        port_dualcore_wakeup_protocol();
+    }
+    else {
+        port_wakeup_signal_from_lwip();
     }
 }
 
@@ -95,14 +119,19 @@ void port_dns_init(void) {
  */
 void port_dns_poll_result(void) {
     
-    /* Poll message queue and pick result. If error, signal error to wish connection or relay client */
+    /* Poll message queue and pick all results. If error, signal error to wish connection or relay client */
     struct dns_result_item item_in;
-    if (xQueueReceive(dnsResultQueue, &item_in, 0) == pdTRUE) {
+    while (xQueueReceive(dnsResultQueue, &item_in, 0) == pdTRUE) {
         /* Handle item */
         if (item_in.conn) {
             /* Wish connection resolving ready */
+            if (item_in.id != resolve_id[conn_index(item_in.conn)]) {
+                /* The connection was closed while resolving */
+                continue;
+            }
             if (item_in.error) {
                 /* Resolving resulted to an error */
+                port_conntrace_end(item_in.conn, PORT_CONNTRACE_DNS_FAILED);
                 wish_core_signal_tcp_event(item_in.core, item_in.conn, TCP_DISCONNECTED);
             }
             else {
@@ -138,6 +167,7 @@ int port_dns_start_resolving_wish_conn(wish_connection_t *conn, char *qname) {
     }
     memset(arg, 0, sizeof (struct dns_callback_arg));
     arg->conn = conn;
+    arg->id = ++resolve_id[conn_index(conn)];
     arg->relay = NULL;
     arg->core = conn->core;
     
@@ -173,6 +203,10 @@ int port_dns_start_resolving_wish_conn(wish_connection_t *conn, char *qname) {
     return 0;
 }
 
+void port_dns_resolver_cancel_by_wish_connection(wish_connection_t *conn) {
+    resolve_id[conn_index(conn)]++;
+}
+
 int port_dns_start_resolving_relay_client(wish_core_t *core, wish_relay_client_t *rc, char *qname) {
     ip_addr_t cached_ip_addr;
     IP_ADDR4( &cached_ip_addr, 0,0,0,0 );
@@ -0,0 +1,596 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "utlist.h"
+
+#include "wish_connection.h"
+#include "wish_connection_mgr.h"
+#include "wish_relay_client.h"
+#include "wish_local_discovery.h"
+#include "wish_event.h"
+
+#include "port_dualcore.h"
+#include "port_spsc_ring.h"
+#include "port_reactor.h"
+#include "port_net.h"
+#include "port_wakeup.h"
+#include "port_main.h"
+#include "port_wld.h"
+#include "port_log.h"
+
+#define TAG "port_dualcore"
+
+enum io_record_type {
+    /** Data was read from the socket */
+    IO_REC_DATA,
+    /** The peer closed the connection, or there was a read error. The I/O task has stopped watching the socket. */
+    IO_REC_CLOSED,
+    /** A pending connect() succeeded, the I/O task now watches the socket for readability */
+    IO_REC_CONNECTED,
+    /** A pending connect() failed. The I/O task has stopped watching the socket. */
+    IO_REC_CONNECT_FAILED,
+    /** A connection was accepted on the server socket. The socket is not watched yet. */
+    IO_REC_ACCEPTED,
+    /** A local discovery datagram was received */
+    IO_REC_WLD,
+    /** A connected socket has become writable. The I/O task has stopped watching it for writability. */
+    IO_REC_WRITABLE,
+};
+
+/* A record in the receive ring, from the I/O task to the protocol task */
+struct io_record {
+    enum io_record_type type;
+    enum port_reactor_kind kind;
+    int fd;
+    void *cookie;
+    uint32_t tag;
+    uint16_t len;
+    /* How much of data has been fed to the core, when the Wish receive ring buffer could not take all of it at once */
+    uint16_t offset;
+    /* Source of an IO_REC_WLD datagram */
+    wish_ip_addr_t ip;
+    uint16_t port;
+    uint8_t data[MIST_PORT_DUAL_CORE_RX_CHUNK];
+    /* Link of a record set aside from the ring */
+    struct io_record *next;
+};
+
+enum io_cmd_type {
+    IO_CMD_WATCH,
+    IO_CMD_REWATCH,
+    IO_CMD_CLOSE,
+};
+
+/* A command in the command ring, from the protocol task to the I/O task */
+struct io_cmd {
+    enum io_cmd_type type;
+    int fd;
+    uint8_t interest;
+    enum port_reactor_kind kind;
+    void *cookie;
+    uint32_t tag;
+};
+
+static bool active = false;
+static TaskHandle_t io_task_handle;
+static TaskHandle_t protocol_task_handle;
+
+static struct port_spsc_ring rx_ring;
+static struct port_spsc_ring cmd_ring;
+
+/* The protocol task bumps the epoch of a connection slot each time a socket is watched for it, and the I/O task tags the socket with
+ * it. Records carrying an older epoch belong to an earlier socket of the same slot, and are dropped. */
+static uint32_t conn_epoch[WISH_PORT_CONTEXT_POOL_SZ];
+
+/* Records of connections whose Wish receive ring buffer was full, set aside so that the records behind them in the receive ring are
+ * not held up. The records of a connection which has records set aside are appended to its list, so that they are fed in order. */
+static struct io_record *aside_storage;
+static struct io_record *aside_free;
+static struct io_record *aside[WISH_PORT_CONTEXT_POOL_SZ];
+
+/* Tag bit set by the I/O task on sockets which were watched for writability from the start, i.e. connect() is in progress. Writable
+ * then means that connect() has completed, and after that that there is room in the socket send buffer. */
+#define TAG_CONNECTING (1UL << 31)
+
+bool port_dualcore_active(void) {
+    return active;
+}
+
+/* I/O task */
+
+static void apply_commands(void) {
+    struct io_cmd *cmd;
+    while ((cmd = port_spsc_ring_consumer_peek(&cmd_ring)) != NULL) {
+        switch (cmd->type) {
+            case IO_CMD_WATCH:
+                if (port_reactor_register(cmd->fd, cmd->interest, cmd->kind, cmd->cookie) == 0) {
+                    port_reactor_set_tag(cmd->fd, (cmd->interest & PORT_REACTOR_WRITE) ? cmd->tag | TAG_CONNECTING : cmd->tag);
+                }
+                break;
+            case IO_CMD_REWATCH:
+                port_reactor_modify(cmd->fd, cmd->interest);
+                break;
+            case IO_CMD_CLOSE:
+                port_reactor_unregister(cmd->fd);
+                close(cmd->fd);
+                break;
+        }
+        port_spsc_ring_consume(&cmd_ring);
+    }
+}
+
+/* Handle one ready socket, filling in rec. Returns true if the record should be passed to the protocol task. */
+static bool io_handle_event(struct port_reactor_event *ev, struct io_record *rec) {
+    rec->kind = ev->kind;
+    rec->fd = ev->fd;
+    rec->cookie = ev->cookie;
+    rec->tag = ev->tag;
+    rec->len = 0;
+    rec->offset = 0;
+
+    if (ev->kind == PORT_REACTOR_KIND_SERVER) {
+        int newsockfd = port_net_accept(ev->fd);
+        if (newsockfd < 0) {
+            return false;
+        }
+        rec->type = IO_REC_ACCEPTED;
+        rec->fd = newsockfd;
+        return true;
+    }
+
+    if (ev->kind == PORT_REACTOR_KIND_WAKEUP) {
+        /* The commands are applied at the top of the I/O loop */
+        port_wakeup_drain();
+        return false;
+    }
+
+    if (ev->kind == PORT_REACTOR_KIND_WLD) {
+        /* The datagrams over the rates are dropped here, so that a flood costs only the reads, and leaves the ring to the Wish
+         * connections */
+        for (int i = 0; i < MIST_PORT_WLD_DRAIN_MAX; i++) {
+            int blen = port_net_recv_local_discovery(ev->fd, rec->data, sizeof(rec->data), &rec->ip, &rec->port);
+            if (blen <= 0) {
+                return false;
+            }
+            if (port_wld_within_rate(&rec->ip, rec->port)) {
+                rec->type = IO_REC_WLD;
+                rec->len = blen;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /* Wish connections and relay control connections */
+    if ((ev->events & PORT_REACTOR_WRITE) && !(ev->tag & TAG_CONNECTING)) {
+        /* Stop watching for writability until the protocol task has written out what it had queued, and asks for it again */
+        port_reactor_modify(ev->fd, port_reactor_get_interest(ev->fd) & ~PORT_REACTOR_WRITE);
+        rec->type = IO_REC_WRITABLE;
+        return true;
+    }
+
+    if (ev->events & PORT_REACTOR_WRITE) {
+        int connect_error = 0;
+        socklen_t connect_error_len = sizeof(connect_error);
+        if (getsockopt(ev->fd, SOL_SOCKET, SO_ERROR, &connect_error, &connect_error_len) == -1 || connect_error != 0) {
+            port_reactor_unregister(ev->fd);
+            rec->type = IO_REC_CONNECT_FAILED;
+        }
+        else {
+            port_reactor_modify(ev->fd, PORT_REACTOR_READ);
+            port_reactor_set_tag(ev->fd, ev->tag & ~TAG_CONNECTING);
+            rec->type = IO_REC_CONNECTED;
+        }
+        return true;
+    }
+
+    int read_len = read(ev->fd, rec->data, sizeof(rec->data));
+    if (read_len > 0) {
+        rec->type = IO_REC_DATA;
+        rec->len = read_len;
+        return true;
+    }
+    if (read_len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return false;
+    }
+    if (read_len < 0) {
+        PORT_LOGERR(TAG, "read() on fd %i: %s", ev->fd, strerror(errno));
+    }
+    /* The socket is closed by the protocol task, when it has cleaned up */
+    port_reactor_unregister(ev->fd);
+    rec->type = IO_REC_CLOSED;
+    return true;
+}
+
+static void io_task(void *arg) {
+    struct port_reactor_event events[PORT_REACTOR_MAX_HANDLES];
+    int num_events = 0;
+    int next = 0;
+    /* Records produced from the current event, for the sockets which are drained with several records */
+    int num_drained = 0;
+
+    while (1) {
+        apply_commands();
+
+        if (next >= num_events) {
+            num_events = port_reactor_wait(MIST_PORT_DUAL_CORE_IO_POLL_MS, events, PORT_REACTOR_MAX_HANDLES);
+            next = 0;
+            if (num_events < 0) {
+                PORT_LOGERR(TAG, "select error: %s", strerror(errno));
+                num_events = 0;
+                vTaskDelay(1);
+                continue;
+            }
+        }
+
+        bool produced = false;
+        while (next < num_events) {
+            struct port_reactor_event *ev = &events[next];
+            if (port_reactor_event_is_stale(ev)) {
+                next++;
+                continue;
+            }
+            struct io_record *rec = port_spsc_ring_producer_slot(&rx_ring);
+            if (rec == NULL) {
+                /* Receive ring full, the rest of the events are handled when the protocol task has made space */
+                break;
+            }
+            if (io_handle_event(ev, rec)) {
+                port_spsc_ring_produce(&rx_ring);
+                produced = true;
+                if (ev->kind == PORT_REACTOR_KIND_SERVER && ++num_drained < MIST_PORT_SERVER_BACKLOG) {
+                    /* Keep accepting until the listen backlog is drained */
+                    continue;
+                }
+                if (ev->kind == PORT_REACTOR_KIND_WLD && ++num_drained < MIST_PORT_WLD_DRAIN_MAX) {
+                    /* Keep reading adverts until the socket is empty */
+                    continue;
+                }
+            }
+            num_drained = 0;
+            next++;
+        }
+
+        if (produced) {
+            xTaskNotifyGive(protocol_task_handle);
+        }
+        if (next < num_events) {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MIST_PORT_DUAL_CORE_IO_POLL_MS) + 1);
+        }
+    }
+}
+
+int port_dualcore_start(int core, unsigned int priority, void *protocol_task) {
+    size_t rx_storage_len = MIST_PORT_DUAL_CORE_RX_RING_LEN * sizeof(struct io_record);
+    size_t cmd_storage_len = MIST_PORT_DUAL_CORE_CMD_RING_LEN * sizeof(struct io_cmd);
+    void *rx_storage = malloc(rx_storage_len);
+    void *cmd_storage = malloc(cmd_storage_len);
+    aside_storage = malloc(MIST_PORT_DUAL_CORE_RX_ASIDE_LEN * sizeof(struct io_record));
+    if (rx_storage == NULL || cmd_storage == NULL || aside_storage == NULL) {
+        PORT_LOGERR(TAG, "Could not allocate rings");
+        free(rx_storage);
+        free(cmd_storage);
+        free(aside_storage);
+        return -1;
+    }
+    if (port_spsc_ring_init(&rx_ring, rx_storage, sizeof(struct io_record), MIST_PORT_DUAL_CORE_RX_RING_LEN) != 0
+            || port_spsc_ring_init(&cmd_ring, cmd_storage, sizeof(struct io_cmd), MIST_PORT_DUAL_CORE_CMD_RING_LEN) != 0) {
+        PORT_LOGERR(TAG, "Ring lengths must be powers of two");
+        free(rx_storage);
+        free(cmd_storage);
+        free(aside_storage);
+        return -1;
+    }
+    memset(conn_epoch, 0, sizeof(conn_epoch));
+    memset(aside, 0, sizeof(aside));
+    aside_free = NULL;
+    for (int i = 0; i < MIST_PORT_DUAL_CORE_RX_ASIDE_LEN; i++) {
+        LL_PREPEND(aside_free, &aside_storage[i]);
+    }
+    protocol_task_handle = protocol_task;
+
+    /* From now on, the reactor belongs to the I/O task */
+    active = true;
+    if (xTaskCreatePinnedToCore(io_task, "mist_io", MIST_PORT_DUAL_CORE_IO_STACK_SZ, NULL, priority, &io_task_handle, core) != pdPASS) {
+        PORT_LOGERR(TAG, "Could not create I/O task");
+        active = false;
+        return -1;
+    }
+    return 0;
+}
+
+/* Protocol task */
+
+static void post_cmd(const struct io_cmd *cmd) {
+    struct io_cmd *slot;
+    while ((slot = port_spsc_ring_producer_slot(&cmd_ring)) == NULL) {
+        /* Should not happen, the I/O task is woken up for every command */
+        PORT_LOGWARN(TAG, "Command ring full, waiting");
+        vTaskDelay(1);
+    }
+    memcpy(slot, cmd, sizeof(struct io_cmd));
+    port_spsc_ring_produce(&cmd_ring);
+    /* The I/O task is either in select() or, when the receive ring is full, waiting for a notification */
+    port_wakeup_signal();
+    xTaskNotifyGive(io_task_handle);
+}
+
+static int conn_index(wish_connection_t *ctx) {
+    return ctx - port_net_get_core()->connection_pool;
+}
+
+void port_dualcore_watch(int fd, uint8_t interest, enum port_reactor_kind kind, void *cookie) {
+    struct io_cmd cmd = { .type = IO_CMD_WATCH, .fd = fd, .interest = interest, .kind = kind, .cookie = cookie, .tag = 0 };
+    if (kind == PORT_REACTOR_KIND_WISH_CONN) {
+        int i = conn_index(cookie);
+        conn_epoch[i] = (conn_epoch[i] + 1) & ~TAG_CONNECTING;
+        cmd.tag = conn_epoch[i];
+    }
+    post_cmd(&cmd);
+}
+
+void port_dualcore_rewatch(int fd, uint8_t interest) {
+    struct io_cmd cmd = { .type = IO_CMD_REWATCH, .fd = fd, .interest = interest };
+    post_cmd(&cmd);
+}
+
+void port_dualcore_close(int fd) {
+    struct io_cmd cmd = { .type = IO_CMD_CLOSE, .fd = fd };
+    post_cmd(&cmd);
+}
+
+void port_dualcore_wakeup_protocol(void) {
+    xTaskNotifyGive(protocol_task_handle);
+}
+
+static bool wish_conn_record_is_current(wish_core_t *core, struct io_record *rec) {
+    wish_connection_t *ctx = rec->cookie;
+    if (ctx->context_state == WISH_CONTEXT_FREE) {
+        return false;
+    }
+    return port_net_conn_fd(ctx) == rec->fd && (rec->tag & ~TAG_CONNECTING) == conn_epoch[conn_index(ctx)];
+}
+
+/* Returns false if the record could not be completely handled now */
+static bool process_wish_conn_record(wish_core_t *core, struct io_record *rec) {
+    wish_connection_t *ctx = rec->cookie;
+
+    if (!wish_conn_record_is_current(core, rec)) {
+        /* The connection was closed after the I/O task produced the record */
+        return true;
+    }
+
+    switch (rec->type) {
+        case IO_REC_DATA: {
+            int rb_free = wish_core_get_rx_buffer_free(core, ctx);
+            if (rb_free < 0) {
+                PORT_LOGERR(TAG, "Error getting ring buffer free sz");
+                PORT_ABORT();
+            }
+            int feed_len = rec->len - rec->offset;
+            if (feed_len > rb_free) {
+                feed_len = rb_free;
+            }
+            if (feed_len > 0) {
+                wish_core_feed(core, ctx, rec->data + rec->offset, feed_len);
+                port_net_count_rx(ctx, feed_len);
+                rec->offset += feed_len;
+                struct wish_event ev = { .event_type = WISH_EVENT_NEW_DATA, .context = ctx };
+                wish_message_processor_notify(&ev);
+            }
+            if (rec->offset == rec->len) {
+                return true;
+            }
+            /* The ring buffer is full. Stop the I/O task from reading more from the socket, and feed the rest after the message
+             * processor has consumed some. */
+            port_net_park_rx(ctx);
+            return false;
+        }
+        case IO_REC_CLOSED:
+            PORT_LOGINFO(TAG, "Wish connection closed.");
+            port_net_release_connection(ctx);
+            wish_core_signal_tcp_event(core, ctx, TCP_DISCONNECTED);
+            break;
+        case IO_REC_WRITABLE:
+            port_net_flush_outq(ctx);
+            break;
+        case IO_REC_CONNECTED:
+            if (ctx->curr_transport_state == TRANSPORT_STATE_CONNECTING) {
+                if (ctx->via_relay) {
+                    connected_cb_relay(ctx);
+                }
+                else {
+                    connected_cb(ctx);
+                }
+            }
+            else {
+                PORT_LOGERR(TAG, "There is somekind of state inconsistency");
+                PORT_ABORT();
+            }
+            break;
+        case IO_REC_CONNECT_FAILED:
+            PORT_LOGERR(TAG, "wish connection connect() failed");
+            /* connect_fail_cb() closes the socket */
+            connect_fail_cb(ctx);
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+static void process_relay_record(wish_core_t *core, struct io_record *rec) {
+    wish_relay_client_t *relay = rec->cookie;
+    if (relay->sockfd != rec->fd) {
+        return;
+    }
+
+    switch (rec->type) {
+        case IO_REC_DATA:
+            /* The relay client expects to be fed one byte at a time */
+            for (int i = 0; i < rec->len; i++) {
+                wish_relay_client_feed(core, relay, &rec->data[i], 1);
+                wish_relay_client_periodic(core, relay);
+            }
+            break;
+        case IO_REC_CLOSED:
+            PORT_LOGWARN(TAG, "Relay control connection disconnected");
+            relay_ctrl_disconnect_cb(core, relay);
+            port_net_close_socket(rec->fd);
+            break;
+        case IO_REC_CONNECTED:
+            relay_ctrl_connected_cb(core, relay);
+            wish_relay_client_periodic(core, relay);
+            break;
+        case IO_REC_CONNECT_FAILED:
+            PORT_LOGERR(TAG, "relay control connect() failed");
+            relay_ctrl_connect_fail_cb(core, relay);
+            port_net_close_socket(rec->fd);
+            break;
+        default:
+            break;
+    }
+}
+
+static void process_accepted(wish_core_t *core, struct io_record *rec) {
+    /* Start the wish core with null IDs. The actual IDs will be established during handshake */
+    uint8_t null_id[WISH_ID_LEN] = { 0 };
+    wish_connection_t *ctx = wish_connection_init(core, null_id, null_id);
+    if (ctx == NULL) {
+        /* Fail... no more contexts in our pool */
+        PORT_LOGERR(TAG, "No new Wish connections can be accepted!");
+        port_net_count_accept(true);
+        port_net_close_socket(rec->fd);
+        return;
+    }
+    port_net_count_accept(false);
+    /* New wish connection can be accepted */
+    port_net_attach(ctx, rec->fd, false);
+    port_net_watch(rec->fd, PORT_REACTOR_READ, PORT_REACTOR_KIND_WISH_CONN, ctx);
+    wish_core_signal_tcp_event(core, ctx, TCP_CLIENT_CONNECTED);
+}
+
+/* Copy a record of a Wish connection to the end of the list of the connection. Returns false if there is no room. */
+static bool set_aside(struct io_record *rec) {
+    struct io_record *copy = aside_free;
+    if (copy == NULL) {
+        return false;
+    }
+    LL_DELETE(aside_free, copy);
+    memcpy(copy, rec, offsetof(struct io_record, data) + rec->len);
+    copy->next = NULL;
+    LL_APPEND(aside[conn_index(rec->cookie)], copy);
+    return true;
+}
+
+/* Feed the records set aside, each connection until its Wish receive ring buffer is full again */
+static void process_aside(wish_core_t *core) {
+    for (int i = 0; i < WISH_PORT_CONTEXT_POOL_SZ; i++) {
+        while (aside[i] != NULL && process_wish_conn_record(core, aside[i])) {
+            struct io_record *rec = aside[i];
+            LL_DELETE(aside[i], rec);
+            LL_PREPEND(aside_free, rec);
+        }
+    }
+}
+
+/* Whether process_wish_conn_record() would handle the record completely, or at least feed some of its data */
+static bool wish_conn_record_can_progress(wish_core_t *core, struct io_record *rec) {
+    if (!wish_conn_record_is_current(core, rec) || rec->type != IO_REC_DATA) {
+        return true;
+    }
+    return wish_core_get_rx_buffer_free(core, rec->cookie) > 0;
+}
+
+/* Whether port_dualcore_process() has something to do now, as opposed to waiting for the message processor or the I/O task */
+static bool rx_work_ready(wish_core_t *core) {
+    for (int i = 0; i < WISH_PORT_CONTEXT_POOL_SZ; i++) {
+        if (aside[i] != NULL && wish_conn_record_can_progress(core, aside[i])) {
+            return true;
+        }
+    }
+    struct io_record *rec = port_spsc_ring_consumer_peek(&rx_ring);
+    if (rec == NULL) {
+        return false;
+    }
+    if (aside_free != NULL || rec->type == IO_REC_ACCEPTED || rec->type == IO_REC_WLD || rec->kind == PORT_REACTOR_KIND_RELAY) {
+        return true;
+    }
+    /* A record which cannot be set aside is stuck at the head of the ring until its connection can take it */
+    return aside[conn_index(rec->cookie)] == NULL && wish_conn_record_can_progress(core, rec);
+}
+
+void port_dualcore_wait(uint32_t timeout_ms) {
+    if (rx_work_ready(port_net_get_core())) {
+        return;
+    }
+    ulTaskNotifyTake(pdTRUE, (timeout_ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS);
+}
+
+bool port_dualcore_rx_set_aside(wish_connection_t *ctx) {
+    return aside[conn_index(ctx)] != NULL;
+}
+
+bool port_dualcore_process(wish_core_t *core, unsigned int max_records) {
+    unsigned int num_processed = 0;
+    struct io_record *rec;
+
+    process_aside(core);
+
+    while (num_processed < max_records && (rec = port_spsc_ring_consumer_peek(&rx_ring)) != NULL) {
+        if (rec->type == IO_REC_ACCEPTED) {
+            process_accepted(core, rec);
+        }
+        else if (rec->type == IO_REC_WLD) {
+            port_wld_feed(core, &rec->ip, rec->port, rec->data, rec->len);
+        }
+        else if (rec->kind == PORT_REACTOR_KIND_RELAY) {
+            process_relay_record(core, rec);
+        }
+        else {
+            bool done;
+            if (aside[conn_index(rec->cookie)] != NULL && wish_conn_record_is_current(core, rec)) {
+                /* Behind data which is waiting for the Wish receive ring buffer */
+                done = set_aside(rec);
+            }
+            else {
+                /* When the connection cannot take all of the data, the rest waits aside, and the records of the other
+                 * connections go on */
+                done = process_wish_conn_record(core, rec) || set_aside(rec);
+            }
+            if (!done) {
+                /* Nothing more can be set aside: the record waits at the head of the ring for its connection */
+                break;
+            }
+        }
+        port_spsc_ring_consume(&rx_ring);
+        num_processed++;
+    }
+
+    if (num_processed > 0) {
+        /* The I/O task may be waiting for space in the ring */
+        xTaskNotifyGive(io_task_handle);
+    }
+    return rx_work_ready(core);
+}
@@ -0,0 +1,111 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file port_dualcore.h
+ * @brief Dual-core mode of the port: socket I/O in one task, Wish/Mist protocol processing in another.
+ *
+ * The I/O task owns the reactor. It completes accept() and connect(), and reads received data straight into the records of a
+ * single-producer/single-consumer ring, from which the protocol task feeds them to the Wish core. In the other direction, the
+ * protocol task asks the I/O task to start watching, re-watch or close sockets through a command ring. Outgoing data is written
+ * directly by the protocol task; what does not fit in the socket send buffer is queued, and the I/O task tells when to retry.
+ *
+ * This is started with mist_port_esp32_start_dual_core(), see port_main.h.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "wish_connection.h"
+#include "port_reactor.h"
+
+/** Size of the data buffer in one receive record. Data read from a socket in one go is at most this much. */
+#ifndef MIST_PORT_DUAL_CORE_RX_CHUNK
+#define MIST_PORT_DUAL_CORE_RX_CHUNK 1024
+#endif
+
+/** Number of records in the receive ring from the I/O task to the protocol task. Must be a power of two. */
+#ifndef MIST_PORT_DUAL_CORE_RX_RING_LEN
+#define MIST_PORT_DUAL_CORE_RX_RING_LEN 8
+#endif
+
+/** Number of receive records which can be set aside, when the Wish receive ring buffer of their connection is full, so that the
+ * records of the other connections behind them in the receive ring are not held up. When all are in use, the receive ring waits
+ * for the connection at its head. */
+#ifndef MIST_PORT_DUAL_CORE_RX_ASIDE_LEN
+#define MIST_PORT_DUAL_CORE_RX_ASIDE_LEN 4
+#endif
+
+/** Number of commands in the ring from the protocol task to the I/O task. Must be a power of two. */
+#ifndef MIST_PORT_DUAL_CORE_CMD_RING_LEN
+#define MIST_PORT_DUAL_CORE_CMD_RING_LEN 32
+#endif
+
+/** The maximum time the I/O task blocks in select(). New commands from the protocol task wake it up earlier. */
+#ifndef MIST_PORT_DUAL_CORE_IO_POLL_MS
+#define MIST_PORT_DUAL_CORE_IO_POLL_MS 100
+#endif
+
+#ifndef MIST_PORT_DUAL_CORE_IO_STACK_SZ
+#define MIST_PORT_DUAL_CORE_IO_STACK_SZ 4096
+#endif
+
+/**
+ * Start the I/O task. After this, sockets must be watched and closed through port_dualcore_watch() etc., which port_net_watch()
+ * and port_net_close_socket() do automatically.
+ *
+ * @param core The core where the I/O task is pinned
+ * @param priority FreeRTOS priority of the I/O task
+ * @param protocol_task The task which consumes the receive ring, it is notified when records are available
+ * @return 0 for success, -1 if the rings or the task could not be created
+ */
+int port_dualcore_start(int core, unsigned int priority, void *protocol_task);
+
+/**
+ * @return true if dual-core mode has been started
+ */
+bool port_dualcore_active(void);
+
+/** Protocol task: ask the I/O task to start watching a socket */
+void port_dualcore_watch(int fd, uint8_t interest, enum port_reactor_kind kind, void *cookie);
+
+/** Protocol task: ask the I/O task to change the interest of a socket */
+void port_dualcore_rewatch(int fd, uint8_t interest);
+
+/** Protocol task: ask the I/O task to stop watching a socket and close it */
+void port_dualcore_close(int fd);
+
+/**
+ * Protocol task: block until there are receive records which can be handled, or the timeout expires.
+ */
+void port_dualcore_wait(uint32_t timeout_ms);
+
+/**
+ * Any task: interrupt port_dualcore_wait(), after queueing work for the protocol task, such as a DNS result.
+ */
+void port_dualcore_wakeup_protocol(void);
+
+/**
+ * Protocol task: handle receive records, feeding data to the core and completing connection state changes.
+ *
+ * @param core The Wish core
+ * @param max_records The maximum number of records to handle
+ * @return true if records were left over which can be handled right away. Records waiting for a full Wish receive ring buffer do
+ * not count.
+ */
+bool port_dualcore_process(wish_core_t *core, unsigned int max_records);
+
+/**
+ * Protocol task: whether received data of the connection is waiting aside for room in its Wish receive ring buffer
+ */
+bool port_dualcore_rx_set_aside(wish_connection_t *ctx);
@@ -0,0 +1,20 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/** The length of the Wish event queue implemented in event.c */
+#define EVENT_QUEUE_LEN 40
+
+/**
+ * Get the number of Wish events waiting to be processed by wish_message_processor_task().
+ */
+int port_event_queue_len(void);
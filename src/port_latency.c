@@ -0,0 +1,99 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "port_latency.h"
+#include "time_helper.h"
+#include "port_log.h"
+
+#define TAG "port_latency"
+
+static struct port_latency_stats phase_stats[PORT_LATENCY_NUM_PHASES];
+
+static const char *phase_names[PORT_LATENCY_NUM_PHASES] = {
+    [PORT_LATENCY_SELECT] = "select",
+    [PORT_LATENCY_SOCKET_IO] = "socket io",
+    [PORT_LATENCY_EVENT_DRAIN] = "event drain",
+    [PORT_LATENCY_IPC_DRAIN] = "ipc drain",
+    [PORT_LATENCY_PERIODIC] = "periodic",
+};
+
+uint32_t port_latency_now(void) {
+    /* The same on both cores, unlike CCOUNT */
+    return (uint32_t) time_helper_monotonic_us();
+}
+
+static int log2_bucket(uint32_t us) {
+    int bucket = 0;
+    while (us > 1) {
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void port_latency_record(enum port_latency_phase phase, uint32_t start) {
+    uint32_t us = port_latency_now() - start;
+    struct port_latency_stats *stats = &phase_stats[phase];
+
+    stats->count++;
+    stats->sum += us;
+    if (us > stats->max) {
+        stats->max = us;
+    }
+    stats->buckets[log2_bucket(us)]++;
+}
+
+void port_latency_get(enum port_latency_phase phase, struct port_latency_stats *stats) {
+    memcpy(stats, &phase_stats[phase], sizeof(struct port_latency_stats));
+}
+
+uint32_t port_latency_percentile_us(const struct port_latency_stats *stats, unsigned int permille) {
+    if (stats->count == 0) {
+        return 0;
+    }
+    uint64_t target = ((uint64_t) stats->count * permille + 999) / 1000;
+    uint64_t cumulative = 0;
+    uint32_t us = stats->max;
+    for (int i = 0; i < PORT_LATENCY_NUM_BUCKETS; i++) {
+        cumulative += stats->buckets[i];
+        if (cumulative >= target) {
+            uint32_t upper = (i == PORT_LATENCY_NUM_BUCKETS - 1) ? UINT32_MAX : (2U << i) - 1;
+            if (upper < us) {
+                us = upper;
+            }
+            break;
+        }
+    }
+    return us;
+}
+
+const char *port_latency_phase_name(enum port_latency_phase phase) {
+    if (phase >= PORT_LATENCY_NUM_PHASES) {
+        return "unknown";
+    }
+    return phase_names[phase];
+}
+
+void port_latency_reset(void) {
+    memset(phase_stats, 0, sizeof(phase_stats));
+}
+
+void port_latency_log(void) {
+    for (int i = 0; i < PORT_LATENCY_NUM_PHASES; i++) {
+        const struct port_latency_stats *stats = &phase_stats[i];
+        uint32_t mean_us = stats->count ? stats->sum / stats->count : 0;
+        PORT_LOGINFO(TAG, "%-12s n=%u mean=%u us p99=%u us max=%u us", phase_names[i], stats->count, mean_us, 
+                port_latency_percentile_us(stats, 990), stats->max);
+    }
+}
@@ -0,0 +1,93 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file port_latency.h
+ * @brief Per-phase latency histograms of the Mist main loop.
+ *
+ * Each phase of mist_port_esp32_periodic() is timed in microseconds, and the durations are accumulated into fixed-size log2
+ * histograms. Bucket n counts the durations of 2^n ... 2^(n+1)-1 us. The histograms are dumped by the 10 s periodic log, and can be
+ * read with port_latency_get().
+ *
+ * The clock is esp_timer_get_time(), not the CPU cycle counter: CCOUNT is per core, and a main loop task which is not pinned to a
+ * core may start a phase on one core and end it on the other.
+ */
+
+#include <stdint.h>
+
+/** The phases of the main loop */
+enum port_latency_phase {
+    /** Blocking in select() (or epoll_wait()) */
+    PORT_LATENCY_SELECT,
+    /** Handling one ready socket: read() and feeding the data to the core, accept() or connect() completion */
+    PORT_LATENCY_SOCKET_IO,
+    /** Draining the Wish event queue with wish_message_processor_task() */
+    PORT_LATENCY_EVENT_DRAIN,
+    /** Draining the service IPC queue with port_service_ipc_task() */
+    PORT_LATENCY_IPC_DRAIN,
+    /** Running expired timers, that is the periodic work of the port and apps */
+    PORT_LATENCY_PERIODIC,
+    PORT_LATENCY_NUM_PHASES
+};
+
+#define PORT_LATENCY_NUM_BUCKETS 32
+
+struct port_latency_stats {
+    /** Number of recorded durations */
+    uint32_t count;
+    /** Sum of the recorded durations, in microseconds */
+    uint64_t sum;
+    /** The longest recorded duration, in microseconds */
+    uint32_t max;
+    uint32_t buckets[PORT_LATENCY_NUM_BUCKETS];
+};
+
+/**
+ * Read the clock, in microseconds. The value wraps around every 71 minutes, so compare values only by subtracting them. Use as the
+ * start argument of port_latency_record(), or for any other short duration which may span a task switch.
+ */
+uint32_t port_latency_now(void);
+
+/**
+ * Record the duration of a phase.
+ *
+ * @param phase The phase which was timed
+ * @param start The value returned by port_latency_now() when the phase started
+ */
+void port_latency_record(enum port_latency_phase phase, uint32_t start);
+
+/**
+ * Get a copy of the histogram of a phase.
+ */
+void port_latency_get(enum port_latency_phase phase, struct port_latency_stats *stats);
+
+/**
+ * Estimate a percentile of the durations of a histogram. The result is the upper bound of the bucket where the percentile falls,
+ * but never more than the recorded maximum.
+ *
+ * @param permille The percentile multiplied by 10, for example 990 for p99
+ * @return The duration in microseconds
+ */
+uint32_t port_latency_percentile_us(const struct port_latency_stats *stats, unsigned int permille);
+
+const char *port_latency_phase_name(enum port_latency_phase phase);
+
+/**
+ * Clear all histograms.
+ */
+void port_latency_reset(void);
+
+/**
+ * Print out count, mean, p99 and max of each phase.
+ */
+void port_latency_log(void);
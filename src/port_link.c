@@ -0,0 +1,168 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "wish_core.h"
+#include "port_link.h"
+#include "port_advert.h"
+#include "port_main.h"
+#include "port_net.h"
+#include "port_relay_client.h"
+#include "port_timer.h"
+#include "port_wakeup.h"
+#include "port_dualcore.h"
+#include "port_log.h"
+#include "time_helper.h"
+
+#define TAG "port_link"
+
+/* How often opening the server socket again is retried, if the old one was not closed yet */
+#define LINK_REARM_RETRY_MS 1000
+
+enum link_event_type {
+    LINK_EVENT_DOWN,
+    LINK_EVENT_IP_LOST,
+    LINK_EVENT_UP,
+};
+
+struct link_event {
+    enum link_event_type type;
+    uint32_t ip;
+};
+
+static QueueHandle_t link_event_queue;
+
+/* The rest is owned by the task running Wish */
+static bool link_up;
+/* The address of the station, 0 if it has none */
+static uint32_t link_ip;
+/* time_helper_monotonic_us() when the link was lost */
+static int64_t link_down_us;
+static port_timer_t grace_timer;
+static port_timer_t rearm_timer;
+/* The server and local discovery sockets may have gone with the address they were used with, and are opened again when the link
+ * comes up. Not set for the first address after boot, nor for a dropout after which the address stays the same. */
+static bool sockets_stale;
+
+static void post_event(enum link_event_type type, uint32_t ip) {
+    struct link_event ev = { .type = type, .ip = ip };
+    if (link_event_queue == NULL || xQueueSend(link_event_queue, &ev, 0) != pdTRUE) {
+        PORT_LOGERR(TAG, "Cannot queue link event %i", type);
+        return;
+    }
+    /* Interrupt the main loop's wait, so that the event is acted on right away */
+    if (port_dualcore_active()) {
+        port_dualcore_wakeup_protocol();
+    }
+    else {
+        port_wakeup_signal();
+    }
+}
+
+void mist_port_esp32_link_down(void) {
+    post_event(LINK_EVENT_DOWN, 0);
+}
+
+void mist_port_esp32_ip_lost(void) {
+    post_event(LINK_EVENT_IP_LOST, 0);
+}
+
+void mist_port_esp32_link_up(uint32_t ip) {
+    post_event(LINK_EVENT_UP, ip);
+}
+
+static void close_connections(wish_core_t *core, const char *reason) {
+    int num_closed = port_net_close_all_connections(core);
+    int num_relays = port_relay_client_close_all(core);
+    PORT_LOGINFO(TAG, "%s: closed %i connections and %i relay connections", reason, num_closed, num_relays);
+}
+
+static void grace_timer_cb(void *arg) {
+    close_connections(arg, "Link did not come back");
+}
+
+static void rearm_timer_cb(void *arg) {
+    if (port_net_rearm_server(arg)) {
+        port_timer_stop(&rearm_timer);
+    }
+}
+
+static void handle_down(wish_core_t *core) {
+    if (!link_up) {
+        return;
+    }
+    link_up = false;
+    link_down_us = time_helper_monotonic_us();
+    /* TCP survives a short dropout, if the address stays the same */
+    port_timer_start(&grace_timer, MIST_PORT_LINK_LOSS_GRACE_MS, 0);
+}
+
+static void handle_ip_lost(wish_core_t *core) {
+    link_up = false;
+    link_ip = 0;
+    sockets_stale = true;
+    port_timer_stop(&grace_timer);
+    close_connections(core, "IP address lost");
+}
+
+static void handle_up(wish_core_t *core, uint32_t ip) {
+    bool was_down = !link_up;
+    port_timer_stop(&grace_timer);
+    link_up = true;
+    if (link_ip != 0 && ip != link_ip) {
+        /* The connections are bound to the old address, and the peers cannot reach it anymore */
+        close_connections(core, "IP address changed");
+        sockets_stale = true;
+    }
+    link_ip = ip;
+    if (was_down && link_down_us != 0) {
+        PORT_LOGINFO(TAG, "Link back after %u ms", (unsigned int) ((time_helper_monotonic_us() - link_down_us) / 1000));
+    }
+
+    if (sockets_stale) {
+        sockets_stale = false;
+        if (!port_net_rearm_server(core)) {
+            port_timer_start(&rearm_timer, LINK_REARM_RETRY_MS, LINK_REARM_RETRY_MS);
+        }
+        port_net_rearm_local_discovery();
+    }
+    /* Peers on the network, perhaps a new one, learn about the device soon */
+    port_advert_trigger();
+    /* Do not wait for the reconnect timer of the relay client */
+    port_relay_client_reconnect_all(core);
+}
+
+void port_link_init(void) {
+    link_event_queue = xQueueCreate(8, sizeof(struct link_event));
+    port_timer_init(&grace_timer, grace_timer_cb, port_net_get_core());
+    port_timer_init(&rearm_timer, rearm_timer_cb, port_net_get_core());
+}
+
+void port_link_poll(wish_core_t *core) {
+    struct link_event ev;
+    while (xQueueReceive(link_event_queue, &ev, 0) == pdTRUE) {
+        switch (ev.type) {
+            case LINK_EVENT_DOWN:
+                handle_down(core);
+                break;
+            case LINK_EVENT_IP_LOST:
+                handle_ip_lost(core);
+                break;
+            case LINK_EVENT_UP:
+                handle_up(core, ev.ip);
+                break;
+        }
+    }
+}
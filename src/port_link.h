@@ -0,0 +1,30 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file port_link.h
+ * @brief Recovery of the connections on link and IP address changes of the station.
+ *
+ * The link events are given with mist_port_esp32_link_down(), mist_port_esp32_ip_lost() and mist_port_esp32_link_up() from the
+ * event handler task, and queued to the task running Wish, which acts on them in port_link_poll(): dead Wish and relay control
+ * connections are closed, and when the link is back, the server and local discovery sockets are opened again if the address was
+ * lost or changed, and the relay client reconnects. Without this, the connections would be left to the Wish ping timeout, and the relay client to its reconnect timer.
+ */
+
+#include "wish_core.h"
+
+/** Create the event queue and the timers. Called by mist_port_esp32_init(). */
+void port_link_init(void);
+
+/** Act on the queued link events. Called by the main loop. */
+void port_link_poll(wish_core_t *core);
@@ -33,4 +33,7 @@
 /** Log definition for warninig print-outs */
 #define PORT_LOGWARN(tag, msg, ...) ESP_LOGW(tag, msg, ##__VA_ARGS__)
 
+/** Log definition for debug print-outs */
+#define PORT_LOGDEBUG(tag, msg, ...) ESP_LOGD(tag, msg, ##__VA_ARGS__)
+
 #define PORT_ABORT() ESP_ERROR_CHECK(ESP_FAIL)
\ No newline at end of file
@@ -22,6 +22,8 @@
 
 /* FreeRTOS includes */
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
 
 /* Wish and Mist lib includes */
 #include "wish_connection.h"
@@ -41,16 +43,83 @@
 #include "port_platform.h"
 #include "port_net.h"
 #include "port_dns.h"
+#include "port_link.h"
+#include "port_advert.h"
+#include "port_reactor.h"
+#include "port_timer.h"
+#include "port_latency.h"
+#include "port_event.h"
+#include "port_dualcore.h"
+#include "port_wakeup.h"
 #include "port_service_ipc.h"
 #include "port_main.h"
 #include "port_log.h"
 
 static bool listen_to_adverts = true;
 static bool as_server = true;
-static bool as_relay_client = true;
 
 #define TAG "port_main"
 
+static struct mist_port_esp32_budget budget = {
+    .max_events = MIST_PORT_EVENT_BUDGET,
+    .max_ipc_msgs = MIST_PORT_IPC_BUDGET,
+    .max_read_bytes_per_conn = MIST_PORT_READ_BUDGET,
+    .max_bulk_tx_bytes = MIST_PORT_BULK_TX_BUDGET,
+};
+
+/* Set when the previous call left work over, so that the next one must not block */
+static bool work_carried_over = false;
+
+/* Rotating start position for dispatching ready sockets, so that no connection is always served first */
+static unsigned int dispatch_rr = 0;
+
+void mist_port_esp32_set_budget(const struct mist_port_esp32_budget *new_budget) {
+    budget.max_events = new_budget->max_events ? new_budget->max_events : MIST_PORT_EVENT_BUDGET;
+    budget.max_ipc_msgs = new_budget->max_ipc_msgs ? new_budget->max_ipc_msgs : MIST_PORT_IPC_BUDGET;
+    budget.max_read_bytes_per_conn = new_budget->max_read_bytes_per_conn ? new_budget->max_read_bytes_per_conn : MIST_PORT_READ_BUDGET;
+    budget.max_bulk_tx_bytes = new_budget->max_bulk_tx_bytes ? new_budget->max_bulk_tx_bytes : MIST_PORT_BULK_TX_BUDGET;
+}
+
+void mist_port_esp32_get_budget(struct mist_port_esp32_budget *current) {
+    *current = budget;
+}
+
+static port_timer_t one_sec_timer;
+static port_timer_t heap_log_timer;
+
+static void one_sec_periodic(void *arg) {
+    /* Perform periodic action one second interval */
+    wish_time_report_periodic(port_net_get_core());
+#ifndef WITHOUT_MIST_CONFIG_APP
+    mist_config_periodic();
+#endif //WITHOUT_MIST_CONFIG_APP
+}
+
+static void heap_log_periodic(void *arg) {
+    /* Perform periodic action 10s interval */
+    PORT_LOGINFO(TAG, "System free heap: %i bytes.", esp_get_free_heap_size());
+    struct mist_port_esp32_accept_stats accept_stats;
+    mist_port_esp32_get_accept_stats(&accept_stats);
+    PORT_LOGINFO(TAG, "Incoming connections: %u accepted, %u rejected (pool full), %u accept errors", accept_stats.accepted, 
+            accept_stats.rejected_pool_full, accept_stats.accept_errors);
+    struct mist_port_esp32_connect_stats connect_stats;
+    mist_port_esp32_get_connect_stats(&connect_stats);
+    PORT_LOGINFO(TAG, "Outgoing connections: %u connected, %u failed, %u timed out, %u lost a race, deadline %u ms direct, %u ms relayed", 
+            connect_stats.connected, connect_stats.failed, connect_stats.timed_out, connect_stats.raced_cancelled, 
+            connect_stats.direct_deadline_ms, connect_stats.relayed_deadline_ms);
+    struct mist_port_esp32_wld_stats wld_stats;
+    mist_port_esp32_get_wld_stats(&wld_stats);
+    PORT_LOGINFO(TAG, "Local discovery: %u received, %u rate limited (%u per source, %u global), %u filtered by class, %u duplicates, "
+            "%u fed to core", wld_stats.received, wld_stats.rate_limited_source + wld_stats.rate_limited_global, 
+            wld_stats.rate_limited_source, wld_stats.rate_limited_global, wld_stats.filtered, wld_stats.duplicates, wld_stats.fed);
+    PORT_LOGINFO(TAG, "Neighbours: %u, %u evicted", wld_stats.neighbours, wld_stats.neighbours_evicted);
+    struct mist_port_esp32_advert_stats advert_stats;
+    mist_port_esp32_get_advert_stats(&advert_stats);
+    PORT_LOGINFO(TAG, "Adverts: %u rounds, %u in the last hour, interval %u ms, median latency %u ms", advert_stats.rounds, 
+            advert_stats.rounds_last_hour, advert_stats.interval_ms, advert_stats.median_latency_ms);
+    port_latency_log();
+}
+
 void mist_port_esp32_init(char* default_alias) {
 
     port_platform_deps();
@@ -58,6 +127,9 @@ void mist_port_esp32_init(char* default_alias) {
     /* Start initialising Wish core */
     wish_core_t *core = port_net_get_core();
     
+    port_reactor_init();
+    port_timer_wheel_init();
+    
     wish_core_init(core);
     
     port_platform_load_ensure_identities(core, default_alias);
@@ -70,345 +142,370 @@ void mist_port_esp32_init(char* default_alias) {
         setup_wish_local_discovery();
     }
     
+    port_wakeup_init();
     port_dns_init();
+    port_link_init();
+    port_advert_init();
 #ifndef WITHOUT_MIST_CONFIG_APP
     mist_config_init();
 #endif //WITHOUT_MIST_CONFIG_APP
-}
 
-static int max_fd = 0;
-
-static void update_max_fd(int fd) {
-    if (fd >= max_fd) {
-        max_fd = fd + 1;
-    }
+    port_timer_init(&one_sec_timer, one_sec_periodic, NULL);
+    port_timer_start(&one_sec_timer, 1000, 1000);
+    port_timer_init(&heap_log_timer, heap_log_periodic, NULL);
+    port_timer_start(&heap_log_timer, 10000, 10000);
 }
 
-static void network_periodic(unsigned int max_block_time_ms) {
-    int wld_fd = get_wld_fd();
-    int server_fd = get_server_fd();
-    wish_core_t *core = port_net_get_core();
-    
-    port_dns_poll_result();
-    fd_set rfds;
-    fd_set wfds;
-    struct timeval tv;
-
-    FD_ZERO(&rfds);
-    FD_ZERO(&wfds);
-
-    if (as_server) {
-        FD_SET(server_fd, &rfds);
-        update_max_fd(server_fd);
-    }
-
-    if (listen_to_adverts) {
-        FD_SET(wld_fd, &rfds);
-        update_max_fd(wld_fd);
-    }
-
-    if (as_relay_client) {
-        wish_relay_client_t* relay;
+static void handle_relay_event(wish_core_t *core, wish_relay_client_t *relay, uint8_t events) {
+    if (events & PORT_REACTOR_WRITE) {
+        int connect_error = 0;
+        socklen_t connect_error_len = sizeof(connect_error);
+        if (getsockopt(relay->sockfd, SOL_SOCKET, SO_ERROR, 
+                &connect_error, &connect_error_len) == -1) {
+            perror("Unexepected getsockopt error");
+            PORT_ABORT();
+        }
+        if (connect_error == 0) {
+            /* connect() succeeded, the connection is open */
+            //printf("Relay client connected\n");
+            port_net_rewatch(relay->sockfd, PORT_REACTOR_READ);
+            relay_ctrl_connected_cb(core, relay);
+            wish_relay_client_periodic(core, relay);
+        }
+        else {
+            /* connect fails. Note that perror() or the
+             * global errno is not valid now */
+            PORT_LOGERR(TAG, "relay control connect() failed: %s", strerror(errno));
 
-        LL_FOREACH(core->relay_db, relay) {
-            if (relay->curr_state == WISH_RELAY_CLIENT_CONNECTING) {
-                FD_SET(relay->sockfd, &wfds);
-                update_max_fd(relay->sockfd);
-            }
-            else if (relay->curr_state == WISH_RELAY_CLIENT_WAIT_RECONNECT) {
-                /* connect to relay server has failed or disconnected and we wait some time before retrying */
-            }
-            else if (relay->curr_state == WISH_RELAY_CLIENT_RESOLVING) {
-                /* Don't do anything as the resolver is resolving. relay->sockfd is not valid as it has not yet been initted! */
-            }
-            else if (relay->curr_state != WISH_RELAY_CLIENT_INITIAL) {
-                FD_SET(relay->sockfd, &rfds);
-                update_max_fd(relay->sockfd);
-            }
+            // FIXME only one relay context assumed!
+            relay_ctrl_connect_fail_cb(core, relay);
+            port_net_close_socket(relay->sockfd);
         }
+        return;
     }
 
-    int i = -1;
-    for (i = 0; i < WISH_PORT_CONTEXT_POOL_SZ; i++) {
-        wish_connection_t* ctx = &(core->connection_pool[i]);
-        if (ctx->context_state == WISH_CONTEXT_FREE) {
-            continue;
+    if (events & PORT_REACTOR_READ) {
+        uint8_t byte;   /* That's right, we read just one
+            byte at a time! */
+        int read_len = read(relay->sockfd, &byte, 1);
+        if (read_len > 0) {
+            wish_relay_client_feed(core, relay, &byte, 1);
+            wish_relay_client_periodic(core, relay);
         }
-        else if (ctx->curr_transport_state == TRANSPORT_STATE_RESOLVING) {
-            /* The transport host addr is being resolved, sockfd is not valid and indeed should not be added to any of the sets! */
-            continue;
-        }
-        if (ctx->send_arg == NULL) {
-            PORT_LOGERR(TAG, "context in state %i but send_arg is NULL", ctx->context_state);
-            
-            /* Here we should abandon the connection, since this occurs when everything else fails too, e.g. when all socket resources have been exhausted */
-            wish_core_signal_tcp_event(core, ctx, TCP_DISCONNECTED);
-            continue;
-        }
-        int sockfd = *((int *) ctx->send_arg);
-        if (ctx->curr_transport_state == TRANSPORT_STATE_CONNECTING) {
-            /* If the socket has currently a pending connect(), set
-             * the socket in the set of writable FDs so that we can
-             * detect when connect() is ready */
-            FD_SET(sockfd, &wfds);
+        else if (read_len == 0) {
+            PORT_LOGWARN(TAG, "Relay control connection disconnected");
+            relay_ctrl_disconnect_cb(core, relay);
+            port_net_close_socket(relay->sockfd);
         }
         else {
-            FD_SET(sockfd, &rfds);
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                PORT_LOGWARN(TAG, "relay control read(), errno: %s, this causes no further actions", strerror(errno));
+            }
+            else {
+                PORT_LOGERR(TAG, "relay control read(), errno: %s", strerror(errno));
+                relay_ctrl_disconnect_cb(core, relay);
+                port_net_close_socket(relay->sockfd);
+            }
         }
-        update_max_fd(sockfd);
     }
+}
 
-
-    tv.tv_sec = 0;
-    tv.tv_usec = max_block_time_ms*1000;
-    int select_ret = select( max_fd, &rfds, &wfds, NULL, &tv );
-
-    /* Zero fds ready means we timed out */
-    if ( select_ret > 0 ) {
-        //printf("there is a fd ready\n");
-        if (FD_ISSET(wld_fd, &rfds)) {
-            read_wish_local_discovery();
-        }
-
-        if (as_relay_client) {
-            wish_relay_client_t* relay;
-
-            LL_FOREACH(core->relay_db, relay) {
-
-                if (FD_ISSET(relay->sockfd, &wfds)) {
-                    int connect_error = 0;
-                    socklen_t connect_error_len = sizeof(connect_error);
-                    if (getsockopt(relay->sockfd, SOL_SOCKET, SO_ERROR, 
-                            &connect_error, &connect_error_len) == -1) {
-                        perror("Unexepected getsockopt error");
-                        PORT_ABORT();
-                    }
-                    if (connect_error == 0) {
-                        /* connect() succeeded, the connection is open */
-                        //printf("Relay client connected\n");
-                        relay_ctrl_connected_cb(core, relay);
-                        wish_relay_client_periodic(core, relay);
-                    }
-                    else {
-                        /* connect fails. Note that perror() or the
-                         * global errno is not valid now */
-                        PORT_LOGERR(TAG, "relay control connect() failed: %s", strerror(errno));
-
-                        // FIXME only one relay context assumed!
-                        relay_ctrl_connect_fail_cb(core, relay);
-                        close(relay->sockfd);
-                    }
-                }
-
-                if (FD_ISSET(relay->sockfd, &rfds)) {
-                    uint8_t byte;   /* That's right, we read just one
-                        byte at a time! */
-                    int read_len = read(relay->sockfd, &byte, 1);
-                    if (read_len > 0) {
-                        wish_relay_client_feed(core, relay, &byte, 1);
-                        wish_relay_client_periodic(core, relay);
-                    }
-                    else if (read_len == 0) {
-                        PORT_LOGWARN(TAG, "Relay control connection disconnected");
-                        relay_ctrl_disconnect_cb(core, relay);
-                        close(relay->sockfd);
-                    }
-                    else {
-                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                            PORT_LOGWARN(TAG, "relay control read(), errno: %s, this causes no further actions", strerror(errno));
-                        }
-                        else {
-                            PORT_LOGERR(TAG, "relay control read(), errno: %s", strerror(errno));
-                            relay_ctrl_disconnect_cb(core, relay);
-                            close(relay->sockfd);
-                        }
-                    }
-                }
+/* Receive buffer shared by all Wish connections. Only the task running the main loop reads from the sockets. */
+static uint8_t rx_scratch[MIST_PORT_RX_SCRATCH_SZ];
+
+static void handle_wish_conn_event(wish_core_t *core, wish_connection_t *ctx, int sockfd, uint8_t events) {
+    if (events & PORT_REACTOR_READ) {
+        //printf("wish socket readable\n");
+        /* The Wish connection socket is now readable. Data
+         * can be read without blocking */
+        /* Drain the socket until it would block, the ring buffer is full or the read budget is used. Whatever is left stays in the
+         * socket, which remains readable for the next iteration. */
+        unsigned int budget_left = budget.max_read_bytes_per_conn;
+        bool fed = false;
+        while (budget_left > 0) {
+            int rb_free = wish_core_get_rx_buffer_free(core, ctx);
+            if (rb_free == 0) {
+                /* Cannot read at this time because ring buffer
+                 * is full. Stop watching the socket until the message processor has consumed from the ring buffer, instead of
+                 * having select() return immediately for it on every iteration. */
+                port_net_park_rx(ctx);
+                break;
             }
-        }
-
-
-        int i = 0;
-         /* Check for Wish connections status changes */
-        for (i = 0; i < WISH_PORT_CONTEXT_POOL_SZ; i++) {
-            wish_connection_t* ctx = &(core->connection_pool[i]);
-            if (ctx->context_state == WISH_CONTEXT_FREE) {
-                continue;
+            if (rb_free < 0) {
+                PORT_LOGERR(TAG, "Error getting ring buffer free sz");
+                PORT_ABORT();
             }
-            if ((int *) ctx->send_arg == NULL) {
-                continue;
+            size_t read_buf_len = sizeof(rx_scratch);
+            if ((unsigned int) rb_free < read_buf_len) {
+                read_buf_len = rb_free;
             }
-            int sockfd = *((int *)ctx->send_arg);
-            if (FD_ISSET(sockfd, &rfds)) {
-                //printf("wish socket readable\n");
-                /* The Wish connection socket is now readable. Data
-                 * can be read without blocking */
-                int rb_free = wish_core_get_rx_buffer_free(core, ctx);
-                if (rb_free == 0) {
-                    /* Cannot read at this time because ring buffer
-                     * is full */
-                    PORT_LOGERR(TAG, "ring buffer full");
-                    continue;
-                }
-                if (rb_free < 0) {
-                    PORT_LOGERR(TAG, "Error getting ring buffer free sz");
-                    PORT_ABORT();
-                }
-                const size_t read_buf_len = rb_free;
-                uint8_t buffer[read_buf_len];
-                int read_len = read(sockfd, buffer, read_buf_len);
-                if (read_len > 0) {
-                    //printf("Read some data\n");
-                    wish_core_feed(core, ctx, buffer, read_len);
-                    struct wish_event ev = { 
-                        .event_type = WISH_EVENT_NEW_DATA,
-                        .context = ctx };
-                    wish_message_processor_notify(&ev);
-                }
-                else if (read_len == 0) {
-                    PORT_LOGINFO(TAG, "Wish connection closed.");
-                    close(sockfd);
-                    free(ctx->send_arg);
-                    wish_core_signal_tcp_event(core, ctx, TCP_DISCONNECTED);
-                    continue;
+            if (budget_left < read_buf_len) {
+                read_buf_len = budget_left;
+            }
+            int read_len = read(sockfd, rx_scratch, read_buf_len);
+            if (read_len > 0) {
+                //printf("Read some data\n");
+                wish_core_feed(core, ctx, rx_scratch, read_len);
+                port_net_count_rx(ctx, read_len);
+                fed = true;
+                budget_left -= read_len;
+                if ((size_t) read_len < read_buf_len) {
+                    /* Short read, the socket is drained. Saves the read() which would just return EAGAIN. */
+                    break;
                 }
-                else if (read_len < 0) {
-                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            }
+            else if (read_len == 0) {
+                PORT_LOGINFO(TAG, "Wish connection closed.");
+                port_net_release_connection(ctx);
+                wish_core_signal_tcp_event(core, ctx, TCP_DISCONNECTED);
+                return;
+            }
+            else {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    if (!fed) {
                         ESP_LOGW(TAG, "wish connection socket, errno=%s, just continuing", strerror(errno));
-                        continue;
-                    }
-                    else {
-                        ESP_LOGE(TAG, "wish connection socket read_len=%i: %s, closing connection", read_len, strerror(errno));
-                        close(sockfd);
-                        free(ctx->send_arg);
-                        wish_core_signal_tcp_event(core, ctx, TCP_DISCONNECTED);
-                        continue;
                     }
+                    break;
                 }
-
-                
+                ESP_LOGE(TAG, "wish connection socket read_len=%i: %s, closing connection", read_len, strerror(errno));
+                port_net_release_connection(ctx);
+                wish_core_signal_tcp_event(core, ctx, TCP_DISCONNECTED);
+                return;
             }
-            if (FD_ISSET(sockfd, &wfds)) {
-                /* The Wish connection socket is now writable. This
-                 * means that a previous connect succeeded. (because
-                 * normally we don't select for socket writability!)
-                 * */
-                int connect_error = 0;
-                socklen_t connect_error_len = sizeof(connect_error);
-                if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, 
-                        &connect_error, &connect_error_len) == -1) {
-                    PORT_LOGERR(TAG, "Unexepected getsockopt error, errno=%s", strerror(errno));
-                    PORT_ABORT();
-                }
-                if (connect_error == 0) {
-                    /* connect() succeeded, the connection is open
-                     * */
-                    if (ctx->curr_transport_state 
-                            == TRANSPORT_STATE_CONNECTING) {
-                        if (ctx->via_relay) {
-                            connected_cb_relay(ctx);
-                        }
-                        else {
-                            connected_cb(ctx);
-                        }
-                    }
-                    else {
-                        PORT_LOGERR(TAG, "There is somekind of state inconsistency");
-                        PORT_ABORT();
-                    }
+        }
+        if (fed) {
+            /* One notification for everything read in this wakeup */
+            struct wish_event ev = { 
+                .event_type = WISH_EVENT_NEW_DATA,
+                .context = ctx };
+            wish_message_processor_notify(&ev);
+        }
+    }
+
+    if ((events & PORT_REACTOR_WRITE) && !port_net_conn_is_connecting(ctx)) {
+        /* There is room in the socket send buffer for data that was queued */
+        port_net_flush_outq(ctx);
+    }
+    else if (events & PORT_REACTOR_WRITE) {
+        /* The Wish connection socket is now writable. This
+         * means that a previous connect succeeded. (because
+         * while connecting we select for socket writability only!)
+         * */
+        int connect_error = 0;
+        socklen_t connect_error_len = sizeof(connect_error);
+        if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, 
+                &connect_error, &connect_error_len) == -1) {
+            PORT_LOGERR(TAG, "Unexepected getsockopt error, errno=%s", strerror(errno));
+            PORT_ABORT();
+        }
+        if (connect_error == 0) {
+            /* connect() succeeded, the connection is open
+             * */
+            if (ctx->curr_transport_state 
+                    == TRANSPORT_STATE_CONNECTING) {
+                /* From now on, we are interested in incoming data only */
+                port_net_rewatch(sockfd, PORT_REACTOR_READ);
+                if (ctx->via_relay) {
+                    connected_cb_relay(ctx);
                 }
                 else {
-                    /* connect fails. Note that perror() or the
-                     * global errno is not valid now */
-                    PORT_LOGERR(TAG, "wish connection connect() failed: %s", strerror(errno));
-                    connect_fail_cb(ctx);
-                    close(sockfd);
+                    connected_cb(ctx);
                 }
             }
-
+            else {
+                PORT_LOGERR(TAG, "There is somekind of state inconsistency");
+                PORT_ABORT();
+            }
         }
+        else {
+            /* connect fails. Note that perror() or the
+             * global errno is not valid now */
+            PORT_LOGERR(TAG, "wish connection connect() failed: %s", strerror(errno));
+            /* connect_fail_cb() closes the socket */
+            connect_fail_cb(ctx);
+        }
+    }
+}
 
-
-        /* Check for incoming Wish connections to our server */
-        if (as_server) {
-            if (FD_ISSET(server_fd, &rfds)) {
-                PORT_LOGINFO(TAG, "Detected incoming connection!");
-                int newsockfd = accept(server_fd, NULL, NULL);
-                if (newsockfd < 0) {
-                    PORT_LOGERR(TAG, "on accept: errno %s, abandoning incoming connection", strerror(errno));
-                }
-                else {                
-                    socket_set_nonblocking(newsockfd);
-                    /* Start the wish core with null IDs. 
-                    * The actual IDs will be established during handshake
-                    * */
-                    uint8_t null_id[WISH_ID_LEN] = { 0 };
-                    wish_connection_t *ctx = wish_connection_init(core, null_id, null_id);
-                    if (ctx == NULL) {
-                        /* Fail... no more contexts in our pool */
-                        PORT_LOGERR(TAG, "No new Wish connections can be accepted!");
-                        close(newsockfd);
-                    }
-                    else {
-                        int *fd_ptr = malloc(sizeof(int));
-                        *fd_ptr = newsockfd;
-                        /* New wish connection can be accepted */
-                        wish_core_register_send(core, ctx, write_to_socket, fd_ptr);
-                        wish_core_signal_tcp_event(core, ctx, TCP_CLIENT_CONNECTED);
-                    }
-                }
-            }
+static void handle_server_event(wish_core_t *core, int server_fd) {
+    /* Check for incoming Wish connections to our server. Accept as many as there are free connection contexts, so that a burst of
+     * reconnecting peers is not delayed by whole loop iterations. When the pool is full, one connection is accepted and closed. */
+    int max_accepts = port_net_free_connection_slots(core);
+    if (max_accepts == 0) {
+        max_accepts = 1;
+    }
+    for (int i = 0; i < max_accepts; i++) {
+        int newsockfd = port_net_accept(server_fd);
+        if (newsockfd < 0) {
+            break;
+        }
+        PORT_LOGINFO(TAG, "Detected incoming connection!");
+        /* Start the wish core with null IDs. 
+        * The actual IDs will be established during handshake
+        * */
+        uint8_t null_id[WISH_ID_LEN] = { 0 };
+        wish_connection_t *ctx = wish_connection_init(core, null_id, null_id);
+        if (ctx == NULL) {
+            /* Fail... no more contexts in our pool */
+            PORT_LOGERR(TAG, "No new Wish connections can be accepted!");
+            port_net_count_accept(true);
+            close(newsockfd);
+            continue;
         }
+        port_net_count_accept(false);
+        /* New wish connection can be accepted */
+        port_net_watch(newsockfd, PORT_REACTOR_READ, PORT_REACTOR_KIND_WISH_CONN, ctx);
+        port_net_attach(ctx, newsockfd, false);
+        wish_core_signal_tcp_event(core, ctx, TCP_CLIENT_CONNECTED);
+    }
+}
 
+static void network_periodic(unsigned int max_block_time_ms) {
+    wish_core_t *core = port_net_get_core();
+    
+    port_net_signal_failed_opens(core);
 
+    struct port_reactor_event events[PORT_REACTOR_MAX_HANDLES];
+    uint32_t select_start = port_latency_now();
+    int num_events = port_reactor_wait(max_block_time_ms, events, PORT_REACTOR_MAX_HANDLES);
+    port_latency_record(PORT_LATENCY_SELECT, select_start);
 
-    }
-    else if (select_ret == 0) {
-        //printf("select timeout\n");
-    }
-    else {
+    if (num_events < 0) {
         PORT_LOGERR(TAG, "select error: %s", strerror(errno));
         PORT_ABORT();
         exit(0);
     }
+
+    /* Collect what is written during this iteration, process_queues_and_timers() writes it out at the end */
+    port_net_cork();
+
+    /* Zero events means we timed out */
+    unsigned int first = num_events > 0 ? dispatch_rr++ % num_events : 0;
+    for (int i = 0; i < num_events; i++) {
+        struct port_reactor_event *ev = &events[(first + i) % num_events];
+        if (port_reactor_event_is_stale(ev)) {
+            /* The socket was closed while handling an earlier event */
+            continue;
+        }
+        uint32_t io_start = port_latency_now();
+        switch (ev->kind) {
+            case PORT_REACTOR_KIND_WLD:
+                read_wish_local_discovery(ev->fd);
+                break;
+            case PORT_REACTOR_KIND_RELAY:
+                handle_relay_event(core, ev->cookie, ev->events);
+                break;
+            case PORT_REACTOR_KIND_WISH_CONN:
+                handle_wish_conn_event(core, ev->cookie, ev->fd, ev->events);
+                break;
+            case PORT_REACTOR_KIND_SERVER:
+                handle_server_event(core, ev->fd);
+                break;
+            case PORT_REACTOR_KIND_WAKEUP:
+                port_wakeup_drain();
+                break;
+        }
+        port_latency_record(PORT_LATENCY_SOCKET_IO, io_start);
+    }
+
+    /* Handle the DNS results and link events in the same wakeup, they may have been what interrupted the wait */
+    port_dns_poll_result();
+    port_link_poll(core);
+    port_advert_poll();
 }
 
-void mist_port_esp32_periodic(unsigned int max_block_time_ms) {
-    network_periodic(max_block_time_ms);
-    wish_core_t *core = port_net_get_core();
-    
-    while (1) {
-        /* FIXME this loop is bad! Think of something safer */
+/* Drain the Wish event and service IPC queues within the budget, and run the timers. Returns true if work was left over. */
+static bool process_queues_and_timers(wish_core_t *core) {
+    uint32_t phase_start = port_latency_now();
+    unsigned int num_processed = 0;
+    while (num_processed < budget.max_events) {
         /* Call wish core's connection handler task */
         struct wish_event *ev = wish_get_next_event();
         if (ev != NULL) {
+            bool new_data = ev->event_type == WISH_EVENT_NEW_DATA;
+            wish_connection_t *ctx = ev->context;
             wish_message_processor_task(core, ev);
+            if (new_data) {
+                /* The message processor consumes every complete frame in the receive ring buffer */
+                port_net_rx_processed(ctx);
+            }
+            num_processed++;
         }
         else {
             /* There is nothing more to do, exit the loop */
             break;
         }
     }
-
-    while (port_service_ipc_task_has_more()) {
+    /* The message processor may have made space for connections that were parked because their receive ring buffer was full */
+    port_net_resume_rx(core);
+    port_net_poll_handshakes(core);
+    port_net_flush_overdue_corks(core);
+    port_latency_record(PORT_LATENCY_EVENT_DRAIN, phase_start);
+
+    phase_start = port_latency_now();
+    num_processed = 0;
+    while (num_processed < budget.max_ipc_msgs && port_service_ipc_task_has_more()) {
         port_service_ipc_task();
+        num_processed++;
         taskYIELD();
     }
+    port_net_flush_overdue_corks(core);
+    port_latency_record(PORT_LATENCY_IPC_DRAIN, phase_start);
     
-    static time_t one_sec_ts = 0;
-    if (time(NULL) > one_sec_ts) {
-        /* Perform periodic action one second interval */
-        one_sec_ts = time(NULL);
-        wish_time_report_periodic(core);
-#ifndef WITHOUT_MIST_CONFIG_APP
-        mist_config_periodic();
-#endif //WITHOUT_MIST_CONFIG_APP
+    phase_start = port_latency_now();
+    port_timer_run();
+    bool tx_left = port_net_uncork(core, budget.max_bulk_tx_bytes);
+    port_latency_record(PORT_LATENCY_PERIODIC, phase_start);
+
+    return port_event_queue_len() > 0 || port_service_ipc_task_has_more() || tx_left;
+}
+
+void mist_port_esp32_periodic(unsigned int max_block_time_ms) {
+    /* Block in select() only until the nearest timer deadline, and not at all if there is work left over from the previous call */
+    network_periodic(work_carried_over ? 0 : port_timer_next_timeout_ms(max_block_time_ms));
+    work_carried_over = process_queues_and_timers(port_net_get_core());
+}
+
+static void protocol_task(void *arg) {
+    wish_core_t *core = port_net_get_core();
+    bool rx_carried_over = false;
+
+    /* Wait until mist_port_esp32_start_dual_core() has handed the reactor over to the I/O task */
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    while (1) {
+        port_net_signal_failed_opens(core);
+
+        uint32_t wait_start = port_latency_now();
+        port_dualcore_wait(work_carried_over || rx_carried_over ? 0 : port_timer_next_timeout_ms(MIST_PORT_DUAL_CORE_MAX_BLOCK_MS));
+        port_latency_record(PORT_LATENCY_SELECT, wait_start);
+
+        port_net_cork();
+        port_dns_poll_result();
+        port_link_poll(core);
+        port_advert_poll();
+
+        uint32_t io_start = port_latency_now();
+        rx_carried_over = port_dualcore_process(core, MIST_PORT_DUAL_CORE_RX_RING_LEN);
+        port_latency_record(PORT_LATENCY_SOCKET_IO, io_start);
+
+        work_carried_over = process_queues_and_timers(core);
     }
-    
-    static time_t timestamp = 0;
-    if (time(NULL) > timestamp + 10) {
-        timestamp = time(NULL);
-        /* Perform periodic action 10s interval */
-        PORT_LOGINFO(TAG, "System free heap: %i bytes.", esp_get_free_heap_size());
+}
+
+int mist_port_esp32_start_dual_core(int io_core, int protocol_core, unsigned int priority) {
+    TaskHandle_t protocol_task_handle;
+
+    if (xTaskCreatePinnedToCore(protocol_task, "mist_protocol", MIST_PORT_DUAL_CORE_PROTOCOL_STACK_SZ, NULL, priority, 
+            &protocol_task_handle, protocol_core) != pdPASS) {
+        PORT_LOGERR(TAG, "Could not create protocol task");
+        return -1;
     }
-}
\ No newline at end of file
+    if (port_dualcore_start(io_core, priority, protocol_task_handle) != 0) {
+        vTaskDelete(protocol_task_handle);
+        return -1;
+    }
+    xTaskNotifyGive(protocol_task_handle);
+    PORT_LOGINFO(TAG, "Dual-core mode started, I/O on core %i, protocol on core %i", io_core, protocol_core);
+    return 0;
+}
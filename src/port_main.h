@@ -12,6 +12,53 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
+
+#include "wish_port_config.h"
+
+/** Default for mist_port_esp32_budget.max_events. Keep this above the number of events one main loop iteration can generate (about
+ * one per socket), so that the Wish event queue cannot grow without bounds. */
+#ifndef MIST_PORT_EVENT_BUDGET
+#define MIST_PORT_EVENT_BUDGET (2 * WISH_PORT_CONTEXT_POOL_SZ)
+#endif
+
+/** Default for mist_port_esp32_budget.max_ipc_msgs */
+#ifndef MIST_PORT_IPC_BUDGET
+#define MIST_PORT_IPC_BUDGET 16
+#endif
+
+/** Default for mist_port_esp32_budget.max_read_bytes_per_conn. By default a readable connection is drained until its receive ring
+ * buffer is full. */
+#ifndef MIST_PORT_READ_BUDGET
+#define MIST_PORT_READ_BUDGET WISH_PORT_RX_RB_SZ
+#endif
+
+/** Default for mist_port_esp32_budget.max_bulk_tx_bytes */
+#ifndef MIST_PORT_BULK_TX_BUDGET
+#define MIST_PORT_BULK_TX_BUDGET (8 * 1460)
+#endif
+
+/** The size of the static buffer which Wish connection sockets are read into, before feeding the data to Wish. A socket is read in
+ * chunks of this size until it would block, so this only affects the number of read() calls. */
+#ifndef MIST_PORT_RX_SCRATCH_SZ
+#define MIST_PORT_RX_SCRATCH_SZ 1460
+#endif
+
+/**
+ * The work budgets of one mist_port_esp32_periodic() call. Work that does not fit in the budget is carried over to the next call,
+ * which then does not block in select(). This bounds the time one call can take, so that a burst on one connection cannot starve the
+ * other connections, socket polling or timers.
+ */
+struct mist_port_esp32_budget {
+    /** The maximum number of Wish events processed by wish_message_processor_task() */
+    unsigned int max_events;
+    /** The maximum number of service IPC messages delivered between the core and apps */
+    unsigned int max_ipc_msgs;
+    /** The maximum number of bytes read from one Wish connection */
+    unsigned int max_read_bytes_per_conn;
+    /** The maximum number of bytes of bulk data written to all Wish connections, see MIST_PORT_BULK_FRAME_BYTES */
+    unsigned int max_bulk_tx_bytes;
+};
 /**
  * Initialize the ESP32 Wish and Mist port.
  * @param default_alias The prefix string from which the identity alias ("user name") will default to.
@@ -22,13 +69,332 @@ void mist_port_esp32_init(char* default_alias);
  * Worker function of the Mist esp32 port.
  * This function runs the networking function for Mist, and invokes callbacks into Wish core and Mist at required intervals.
  * 
- * This function can and should be called as often as possible to ensure low network latency. It maintains internal timestamps to regulate the periodic callbacks.
+ * This function can and should be called as often as possible to ensure low network latency. The periodic callbacks, and any timers registered with port_timer_start(), are run from this function.
  * 
- * \param max_block_time_ms The maximum time, in milliseconds, to block execution in select() while waiting for socket status changes. A value of 0 disables the blocking, and makes the function to return immediately after examining socket status.
+ * \param max_block_time_ms The maximum time, in milliseconds, to block execution in select() while waiting for socket status changes. The actual block time is shortened to the nearest timer deadline. A value of 0 disables the blocking, and makes the function to return immediately after examining socket status.
  * 
  * \note A typical max_block_time_ms is 100 ms.
  * 
  * \note if this function is run with block time of 0ms, then user must ensure by some other means that the calling process does not consume all CPU time.
  * 
  */
-void mist_port_esp32_periodic(unsigned int max_block_time_ms);
\ No newline at end of file
+void mist_port_esp32_periodic(unsigned int max_block_time_ms);
+
+/**
+ * Set the work budgets of mist_port_esp32_periodic(). A zero value in any field restores the default of that field.
+ */
+void mist_port_esp32_set_budget(const struct mist_port_esp32_budget *budget);
+
+/**
+ * Get the current work budgets of mist_port_esp32_periodic().
+ */
+void mist_port_esp32_get_budget(struct mist_port_esp32_budget *budget);
+
+/**
+ * The listen() backlog of the Wish TCP server. In dual-core mode, this is also the maximum number of connections the I/O task
+ * accepts from one wakeup, as it does not know how many connection contexts are free. The main loop accepts as many connections as
+ * there are free connection contexts.
+ */
+#ifndef MIST_PORT_SERVER_BACKLOG
+#define MIST_PORT_SERVER_BACKLOG 4
+#endif
+
+/** Counters of incoming Wish connections, since boot */
+struct mist_port_esp32_accept_stats {
+    /** Connections accepted and given a Wish connection context */
+    uint32_t accepted;
+    /** Connections closed right after accept(), because the Wish connection pool was full */
+    uint32_t rejected_pool_full;
+    /** Failed accept() calls */
+    uint32_t accept_errors;
+};
+
+/**
+ * Get the counters of incoming Wish connections.
+ */
+void mist_port_esp32_get_accept_stats(struct mist_port_esp32_accept_stats *stats);
+
+/** The connect() deadline of outgoing Wish connections, until the first connection of the kind (direct or relayed) has completed.
+ * After that, the deadline adapts to the observed connect times. */
+#ifndef MIST_PORT_CONNECT_TIMEOUT_INITIAL_MS
+#define MIST_PORT_CONNECT_TIMEOUT_INITIAL_MS 5000
+#endif
+
+/** The lower limit of the adaptive connect() deadline. lwIP retransmits a lost SYN after 3 s, keep this near that to survive one
+ * lost SYN on a fast network. */
+#ifndef MIST_PORT_CONNECT_TIMEOUT_MIN_MS
+#define MIST_PORT_CONNECT_TIMEOUT_MIN_MS 2000
+#endif
+
+/** When a relayed connection is opened to a peer while a direct connection to it is connecting, the head start of the direct
+ * connection before the relayed one is connected too. The one which connects first is kept. */
+#ifndef MIST_PORT_CONNECT_STAGGER_MS
+#define MIST_PORT_CONNECT_STAGGER_MS 300
+#endif
+
+/** The upper limit of the adaptive connect() deadline, also after backing off from timeouts */
+#ifndef MIST_PORT_CONNECT_TIMEOUT_MAX_MS
+#define MIST_PORT_CONNECT_TIMEOUT_MAX_MS 15000
+#endif
+
+/** Counters of outgoing Wish connections, since boot */
+struct mist_port_esp32_connect_stats {
+    /** Connections whose connect() completed */
+    uint32_t connected;
+    /** Connections whose connect() failed, for example because the peer refused */
+    uint32_t failed;
+    /** Connections cancelled because connect() did not complete by the deadline */
+    uint32_t timed_out;
+    /** Connections cancelled because the other transport to the same peer, direct or relayed, connected first */
+    uint32_t raced_cancelled;
+    /** The current connect() deadlines of direct and relayed connections */
+    uint32_t direct_deadline_ms;
+    uint32_t relayed_deadline_ms;
+};
+
+/**
+ * Get the counters of outgoing Wish connections.
+ */
+void mist_port_esp32_get_connect_stats(struct mist_port_esp32_connect_stats *stats);
+
+/** Counters of received Wish local discovery datagrams, since boot */
+struct mist_port_esp32_wld_stats {
+    /** Datagrams read from the local discovery socket */
+    uint32_t received;
+    /** Datagrams dropped because their source sent more than its rate allows */
+    uint32_t rate_limited_source;
+    /** Datagrams dropped because all sources together sent more than the global rate allows */
+    uint32_t rate_limited_global;
+    /** Adverts dropped because their class is not in the class filter */
+    uint32_t filtered;
+    /** Adverts dropped because the same advert from the same source was fed to the core recently */
+    uint32_t duplicates;
+    /** Adverts fed to the core */
+    uint32_t fed;
+    /** Hosts in the neighbour table, see mist_port_esp32_get_wld_neighbours() */
+    uint32_t neighbours;
+    /** Hosts removed from the full neighbour table to make way for a new one, before they expired */
+    uint32_t neighbours_evicted;
+};
+
+/**
+ * Get the counters of received local discovery datagrams.
+ */
+void mist_port_esp32_get_wld_stats(struct mist_port_esp32_wld_stats *stats);
+
+/**
+ * The rates of local discovery datagrams which are processed. Datagrams over the rates are dropped after reading, before any
+ * parsing.
+ */
+struct mist_port_esp32_wld_rate_limit {
+    /** Datagrams per second from one source address and port */
+    uint32_t source_per_s;
+    /** Datagrams one source address and port may send in a burst, at least the identities of a peer, which it advertises at once */
+    uint32_t source_burst;
+    /** Datagrams per second from all sources together */
+    uint32_t global_per_s;
+    /** Datagrams all sources together may send in a burst */
+    uint32_t global_burst;
+};
+
+/**
+ * Set the rates of local discovery datagrams which are processed. A zero value in any field restores the default of that field, see
+ * MIST_PORT_WLD_SOURCE_RATE in src/port_wld.h, and values are limited to 1000000. The buckets start over full.
+ */
+void mist_port_esp32_set_wld_rate_limit(const struct mist_port_esp32_wld_rate_limit *limit);
+
+/**
+ * Get the current rates of local discovery datagrams which are processed.
+ */
+void mist_port_esp32_get_wld_rate_limit(struct mist_port_esp32_wld_rate_limit *limit);
+
+/** The space for the alias of a neighbour, including the terminating zero. A longer alias is cut. */
+#ifndef MIST_PORT_WLD_NEIGHBOUR_ALIAS_LEN
+#define MIST_PORT_WLD_NEIGHBOUR_ALIAS_LEN 24
+#endif
+
+/** The space for the class of a neighbour, including the terminating zero. A longer class is cut. */
+#ifndef MIST_PORT_WLD_NEIGHBOUR_CLASS_LEN
+#define MIST_PORT_WLD_NEIGHBOUR_CLASS_LEN 32
+#endif
+
+/** A host heard advertising on the local network */
+struct mist_port_esp32_wld_neighbour {
+    /** The source address of the adverts */
+    uint8_t ip[4];
+    /** The source port of the adverts */
+    uint16_t port;
+    /** Milliseconds since the latest advert */
+    uint32_t heard_ms_ago;
+    /** The alias of the latest advert, empty if it had none */
+    char alias[MIST_PORT_WLD_NEIGHBOUR_ALIAS_LEN];
+    /** The class of the latest advert, empty if it had none */
+    char advert_class[MIST_PORT_WLD_NEIGHBOUR_CLASS_LEN];
+};
+
+/**
+ * List the hosts heard advertising on the local network, a page at a time, see src/port_neighbours.h. Start with *cursor at 0, and
+ * call again with the updated cursor until fewer than max_neighbours are returned. Between the calls, the table may change: a host
+ * which was added or removed after the listing started may be missing from it, but the other hosts are listed once. Call this from the task
+ * running Wish, for example from a Mist or Wish RPC handler.
+ *
+ * @param cursor The position in the table, updated to where the next page starts
+ * @return The number of hosts stored in neighbours
+ */
+int mist_port_esp32_get_wld_neighbours(unsigned int *cursor, struct mist_port_esp32_wld_neighbour *neighbours, 
+        unsigned int max_neighbours);
+
+/**
+ * Feed only the local discovery adverts of the given classes to the core. Adverts without a class are always fed. With no classes,
+ * which is the default, all adverts are fed. The strings are copied.
+ *
+ * @param num_classes At most MIST_PORT_WLD_CLASS_FILTER_MAX, each class shorter than MIST_PORT_WLD_CLASS_MAX_LEN
+ * @return 0 for success, -1 if there are too many classes or one is too long. The filter is not changed then.
+ */
+int mist_port_esp32_set_wld_class_filter(const char *const *classes, unsigned int num_classes);
+
+/** After the station has lost its link, the connections are kept for this long in case it comes back with the same address, as
+ * after a short dropout or a roam. Then they are closed, and so are the relay control connections. */
+#ifndef MIST_PORT_LINK_LOSS_GRACE_MS
+#define MIST_PORT_LINK_LOSS_GRACE_MS 3000
+#endif
+
+/**
+ * Tell the port that the station has lost its link, on SYSTEM_EVENT_STA_DISCONNECTED. If the link does not come back within
+ * MIST_PORT_LINK_LOSS_GRACE_MS, the Wish and relay control connections are closed, instead of waiting for them to time out. May be
+ * called from any task, such as the event handler of the application.
+ */
+void mist_port_esp32_link_down(void);
+
+/**
+ * Tell the port that the station has lost its IP address, on SYSTEM_EVENT_STA_LOST_IP. The connections are closed right away. May be
+ * called from any task.
+ */
+void mist_port_esp32_ip_lost(void);
+
+/**
+ * Tell the port that the station has an IP address, on SYSTEM_EVENT_STA_GOT_IP. If the address has changed, the connections are
+ * closed, as they cannot work anymore. After an address change or loss, the server and local discovery sockets are opened again.
+ * The relay control connections are reconnected right away. May be called from any task.
+ *
+ * @param ip The address in network byte order, as in tcpip_adapter_ip_info_t
+ */
+void mist_port_esp32_link_up(uint32_t ip);
+
+/**
+ * Tell the port that a station has associated to the soft-AP or left it, on SYSTEM_EVENT_AP_STACONNECTED and
+ * SYSTEM_EVENT_AP_STADISCONNECTED. The adverts sent in AP mode are unicast to each station, and the station list is read again at
+ * the next advert. May be called from any task.
+ */
+void mist_port_esp32_ap_stations_changed(void);
+
+/**
+ * Send the local discovery adverts right away, and then at a short interval backing off to MIST_PORT_ADVERT_INTERVAL_MAX_MS, see
+ * src/port_advert.h. Call this when peers are likely to be looking for the device, such as when the commissioning AP starts or a
+ * station joins it. May be called from any task.
+ */
+void mist_port_esp32_advert_burst(void);
+
+/** Counters of the local discovery adverts sent */
+struct mist_port_esp32_advert_stats {
+    /** Advert rounds sent, each to the broadcast address or to every soft-AP station */
+    uint32_t rounds;
+    /** Advert rounds sent during the last hour */
+    uint32_t rounds_last_hour;
+    /** Triggers which restarted the fast schedule, see src/port_advert.h */
+    uint32_t triggers;
+    /** The interval until the next round */
+    uint32_t interval_ms;
+    /** The median delay from a trigger to the advert round which followed it, such as from hearing a new peer to advertising to it */
+    uint32_t median_latency_ms;
+};
+
+/**
+ * Get the counters of the local discovery adverts sent.
+ */
+void mist_port_esp32_get_advert_stats(struct mist_port_esp32_advert_stats *stats);
+
+/** Default TCP keepalive of Wish connection sockets: seconds of idle time before the first probe. A dead peer is noticed after
+ * MIST_PORT_TCP_KEEPIDLE_S + MIST_PORT_TCP_KEEPCNT * MIST_PORT_TCP_KEEPINTVL_S seconds, instead of holding a connection context until
+ * the Wish ping times out. */
+#ifndef MIST_PORT_TCP_KEEPIDLE_S
+#define MIST_PORT_TCP_KEEPIDLE_S 30
+#endif
+
+/** Default TCP keepalive of Wish connection sockets: seconds between probes */
+#ifndef MIST_PORT_TCP_KEEPINTVL_S
+#define MIST_PORT_TCP_KEEPINTVL_S 5
+#endif
+
+/** Default TCP keepalive of Wish connection sockets: unanswered probes before the connection is dropped */
+#ifndef MIST_PORT_TCP_KEEPCNT
+#define MIST_PORT_TCP_KEEPCNT 3
+#endif
+
+/** The roles of the TCP sockets of the port, each of which has its own socket option profile */
+enum mist_port_esp32_socket_role {
+    /** Outgoing Wish connections directly to the peer */
+    MIST_PORT_SOCKET_DIRECT,
+    /** Outgoing Wish connections through a relay server */
+    MIST_PORT_SOCKET_RELAYED,
+    /** Incoming Wish connections accepted by the server */
+    MIST_PORT_SOCKET_INBOUND,
+    /** The control connection to the relay server */
+    MIST_PORT_SOCKET_RELAY_CONTROL,
+    MIST_PORT_SOCKET_NUM_ROLES
+};
+
+/**
+ * Socket options applied to the sockets of one role when they are created or accepted. Options which the TCP/IP stack does not
+ * support are skipped, with a debug log.
+ */
+struct mist_port_esp32_socket_profile {
+    /** Disable the Nagle algorithm, so that small messages such as Mist invokes and their replies are not delayed */
+    bool nodelay;
+    /** Enable TCP keepalive */
+    bool keepalive;
+    /** Keepalive idle time, probe interval and probe count. 0 leaves the stack default. */
+    uint16_t keepidle_s;
+    uint16_t keepintvl_s;
+    uint16_t keepcnt;
+    /** SO_SNDBUF and SO_RCVBUF in bytes. 0 leaves the stack default. */
+    int sndbuf;
+    int rcvbuf;
+};
+
+/**
+ * Set the socket option profile of a role. Applies to sockets created after the call, so call this before mist_port_esp32_init()
+ * or before starting dual-core mode to cover all sockets.
+ */
+void mist_port_esp32_set_socket_profile(enum mist_port_esp32_socket_role role, const struct mist_port_esp32_socket_profile *profile);
+
+/**
+ * Get the socket option profile of a role.
+ */
+void mist_port_esp32_get_socket_profile(enum mist_port_esp32_socket_role role, struct mist_port_esp32_socket_profile *profile);
+
+/** In dual-core mode, the maximum time the protocol task blocks waiting for received data, when no timer expires sooner */
+#ifndef MIST_PORT_DUAL_CORE_MAX_BLOCK_MS
+#define MIST_PORT_DUAL_CORE_MAX_BLOCK_MS 100
+#endif
+
+/** Stack size of the protocol task in dual-core mode. The Wish handshake crypto runs in this task. */
+#ifndef MIST_PORT_DUAL_CORE_PROTOCOL_STACK_SZ
+#define MIST_PORT_DUAL_CORE_PROTOCOL_STACK_SZ 8192
+#endif
+
+/**
+ * Start the port in dual-core mode, as an alternative to calling mist_port_esp32_periodic() from a loop of your own.
+ * 
+ * An I/O task takes care of select(), read(), accept() and connect() completion, and passes the received data through lock-free
+ * rings to a protocol task, which runs the Wish core and the Mist apps. The two tasks are pinned to their own cores, so that
+ * crypto-heavy handshakes do not block socket servicing.
+ * 
+ * Call this once after mist_port_esp32_init(). After this, mist_port_esp32_periodic() must not be called.
+ * 
+ * \param io_core The core for the I/O task. Core 0 is usually the best choice, as the Wi-Fi and lwIP tasks run there.
+ * \param protocol_core The core for the protocol task
+ * \param priority The FreeRTOS priority of both tasks
+ * \return 0 for success, -1 if the tasks could not be started
+ */
+int mist_port_esp32_start_dual_core(int io_core, int protocol_core, unsigned int priority);
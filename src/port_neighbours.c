@@ -0,0 +1,202 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "port_neighbours.h"
+#include "port_wld.h"
+#include "port_main.h"
+#include "time_helper.h"
+
+#if MIST_PORT_WLD_NEIGHBOURS > 254
+#error MIST_PORT_WLD_NEIGHBOURS must be at most 254
+#endif
+
+/* The links between the entries are the index of the entry plus one, so that 0, the initial value, is none */
+#define NONE 0
+#define REF(i) ((uint8_t) ((i) + 1))
+#define ENTRY(ref) (&table[(ref) - 1])
+
+struct neighbour {
+    uint32_t ip;
+    uint32_t digest;
+    uint32_t heard_ms;
+    uint16_t port;
+    bool in_use;
+    /* The next entry in the same hash bucket */
+    uint8_t bucket_next;
+    /* The neighbouring entries in least recently heard order */
+    uint8_t older;
+    uint8_t newer;
+    char alias[MIST_PORT_WLD_NEIGHBOUR_ALIAS_LEN];
+    char advert_class[MIST_PORT_WLD_NEIGHBOUR_CLASS_LEN];
+};
+
+static struct neighbour table[MIST_PORT_WLD_NEIGHBOURS];
+static uint8_t buckets[MIST_PORT_WLD_NEIGHBOURS];
+static uint8_t oldest = NONE;
+static uint8_t newest = NONE;
+static uint32_t num_neighbours = 0;
+static uint32_t num_evicted = 0;
+
+static uint32_t now_ms(void) {
+    return (uint32_t) (time_helper_monotonic_us() / 1000);
+}
+
+static unsigned int bucket_of(uint32_t ip, uint16_t port) {
+    uint32_t h = (ip ^ (port * 2654435761UL)) * 2654435761UL;
+    return (h >> 16) % MIST_PORT_WLD_NEIGHBOURS;
+}
+
+static void lru_unlink(uint8_t ref) {
+    struct neighbour *n = ENTRY(ref);
+    if (n->older != NONE) {
+        ENTRY(n->older)->newer = n->newer;
+    }
+    else {
+        oldest = n->newer;
+    }
+    if (n->newer != NONE) {
+        ENTRY(n->newer)->older = n->older;
+    }
+    else {
+        newest = n->older;
+    }
+    n->older = n->newer = NONE;
+}
+
+static void lru_push_newest(uint8_t ref) {
+    struct neighbour *n = ENTRY(ref);
+    n->older = newest;
+    n->newer = NONE;
+    if (newest != NONE) {
+        ENTRY(newest)->newer = ref;
+    }
+    else {
+        oldest = ref;
+    }
+    newest = ref;
+}
+
+static void remove_entry(uint8_t ref) {
+    struct neighbour *n = ENTRY(ref);
+    uint8_t *link = &buckets[bucket_of(n->ip, n->port)];
+    while (*link != ref) {
+        link = &ENTRY(*link)->bucket_next;
+    }
+    *link = n->bucket_next;
+    lru_unlink(ref);
+    n->in_use = false;
+    num_neighbours--;
+}
+
+static void expire(uint32_t now) {
+    while (oldest != NONE && now - ENTRY(oldest)->heard_ms > MIST_PORT_WLD_NEIGHBOUR_TTL_MS) {
+        remove_entry(oldest);
+    }
+}
+
+static void copy_string(char *dst, size_t dst_len, const uint8_t *data, size_t len, const char *key) {
+    size_t str_len;
+    const char *str = port_wld_find_string(data, len, key, &str_len);
+    if (str == NULL) {
+        dst[0] = 0;
+        return;
+    }
+    if (str_len >= dst_len) {
+        str_len = dst_len - 1;
+    }
+    memcpy(dst, str, str_len);
+    dst[str_len] = 0;
+}
+
+bool port_neighbours_heard(const wish_ip_addr_t *ip, uint16_t port, uint32_t digest, const uint8_t *data, size_t len) {
+    uint32_t now = now_ms();
+    expire(now);
+
+    uint32_t addr;
+    memcpy(&addr, ip->addr, sizeof(addr));
+    unsigned int bucket = bucket_of(addr, port);
+    uint8_t ref = buckets[bucket];
+    while (ref != NONE && (ENTRY(ref)->ip != addr || ENTRY(ref)->port != port)) {
+        ref = ENTRY(ref)->bucket_next;
+    }
+
+    bool is_new;
+    if (ref == NONE) {
+        is_new = true;
+        if (num_neighbours == MIST_PORT_WLD_NEIGHBOURS) {
+            /* There are more hosts around than the table holds, and they keep evicting each other */
+            is_new = now - ENTRY(oldest)->heard_ms >= MIST_PORT_WLD_NEIGHBOUR_QUIET_MS;
+            num_evicted++;
+            remove_entry(oldest);
+        }
+        int i = 0;
+        while (table[i].in_use) {
+            i++;
+        }
+        ref = REF(i);
+        struct neighbour *n = ENTRY(ref);
+        n->in_use = true;
+        n->ip = addr;
+        n->port = port;
+        /* Not a possible digest of this advert, so that the strings are looked up below */
+        n->digest = ~digest;
+        n->bucket_next = buckets[bucket];
+        buckets[bucket] = ref;
+        num_neighbours++;
+    }
+    else {
+        is_new = now - ENTRY(ref)->heard_ms >= MIST_PORT_WLD_NEIGHBOUR_QUIET_MS;
+        lru_unlink(ref);
+    }
+
+    struct neighbour *n = ENTRY(ref);
+    n->heard_ms = now;
+    lru_push_newest(ref);
+    if (n->digest != digest) {
+        n->digest = digest;
+        copy_string(n->alias, sizeof(n->alias), data, len, "alias");
+        copy_string(n->advert_class, sizeof(n->advert_class), data, len, "class");
+    }
+    return is_new;
+}
+
+void port_neighbours_get_stats(struct mist_port_esp32_wld_stats *stats) {
+    expire(now_ms());
+    stats->neighbours = num_neighbours;
+    stats->neighbours_evicted = num_evicted;
+}
+
+int mist_port_esp32_get_wld_neighbours(unsigned int *cursor, struct mist_port_esp32_wld_neighbour *neighbours, 
+        unsigned int max_neighbours) {
+    uint32_t now = now_ms();
+    expire(now);
+    unsigned int num = 0;
+    unsigned int i = *cursor;
+    for (; i < MIST_PORT_WLD_NEIGHBOURS && num < max_neighbours; i++) {
+        const struct neighbour *n = &table[i];
+        if (!n->in_use) {
+            continue;
+        }
+        struct mist_port_esp32_wld_neighbour *out = &neighbours[num++];
+        memcpy(out->ip, &n->ip, sizeof(out->ip));
+        out->port = n->port;
+        out->heard_ms_ago = now - n->heard_ms;
+        strcpy(out->alias, n->alias);
+        strcpy(out->advert_class, n->advert_class);
+    }
+    *cursor = i;
+    return num;
+}
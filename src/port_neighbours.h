@@ -0,0 +1,62 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file port_neighbours.h
+ * @brief Table of the hosts heard advertising on the local network.
+ *
+ * The local discovery table of the core holds WISH_LOCAL_DISCOVERY_MAX entries, as wld.list must reply with all of them in one RPC
+ * buffer, so in a room with many devices the peers keep evicting each other. The port keeps a table of its own, of up to
+ * MIST_PORT_WLD_NEIGHBOURS hosts, with the alias and class of their latest advert. It can be listed in pages with
+ * mist_port_esp32_get_wld_neighbours(), for example one page per RPC reply.
+ *
+ * The entries are indexed by a hash of the source address and port, and kept in least recently heard order. An entry not heard from
+ * for MIST_PORT_WLD_NEIGHBOUR_TTL_MS expires, and when the table is full, the least recently heard entry makes way for a new host.
+ * The table is owned by the task running Wish.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "wish_ip_addr.h"
+
+struct mist_port_esp32_wld_stats;
+
+/** The number of entries in the neighbour table, at most 254 */
+#ifndef MIST_PORT_WLD_NEIGHBOURS
+#define MIST_PORT_WLD_NEIGHBOURS 64
+#endif
+
+/** An entry not heard from for this long is removed */
+#ifndef MIST_PORT_WLD_NEIGHBOUR_TTL_MS
+#define MIST_PORT_WLD_NEIGHBOUR_TTL_MS 120000
+#endif
+
+/** A host heard again after being quiet for this long counts as new, as it has probably been restarted or away */
+#ifndef MIST_PORT_WLD_NEIGHBOUR_QUIET_MS
+#define MIST_PORT_WLD_NEIGHBOUR_QUIET_MS 60000
+#endif
+
+/**
+ * Record an advert which passed the rate limits. The alias and class are looked up in the advert only when it differs from the
+ * previous one of the host.
+ *
+ * @param digest A digest of the advert and its source
+ * @return true if the host is new: not in the table, or not heard from for MIST_PORT_WLD_NEIGHBOUR_QUIET_MS. When the table is full
+ * of hosts heard more recently than that, a host missing from it may just have been evicted, and does not count as new.
+ */
+bool port_neighbours_heard(const wish_ip_addr_t *ip, uint16_t port, uint32_t digest, const uint8_t *data, size_t len);
+
+/** Fill in the neighbour table counters of the local discovery stats */
+void port_neighbours_get_stats(struct mist_port_esp32_wld_stats *stats);
@@ -39,7 +39,18 @@
 
 #include "port_net.h"
 #include "port_dns.h"
+#include "port_reactor.h"
+#include "port_dualcore.h"
+#include "port_wld.h"
+#include "port_advert.h"
+#include "port_main.h"
+#include "port_outq.h"
+#include "port_sockopt.h"
+#include "port_timer.h"
+#include "port_conntrace.h"
+#include "port_latency.h"
 #include "port_log.h"
+#include "time_helper.h"
 
 #define TAG "port_net"
 
@@ -78,68 +89,635 @@ void socket_set_nonblocking(int sockfd) {
 }
 
 
+void port_net_watch(int sockfd, uint8_t interest, enum port_reactor_kind kind, void *cookie) {
+    if (port_dualcore_active()) {
+        /* The reactor belongs to the I/O task */
+        port_dualcore_watch(sockfd, interest, kind, cookie);
+    }
+    else if (port_reactor_register(sockfd, interest, kind, cookie) != 0) {
+        PORT_LOGERR(TAG, "Could not watch socket %i", sockfd);
+    }
+}
+
+void port_net_rewatch(int sockfd, uint8_t interest) {
+    if (port_dualcore_active()) {
+        port_dualcore_rewatch(sockfd, interest);
+    }
+    else {
+        port_reactor_modify(sockfd, interest);
+    }
+}
+
+void port_net_close_socket(int sockfd) {
+    if (sockfd < 0) {
+        return;
+    }
+    if (port_dualcore_active()) {
+        /* The I/O task may be waiting on the socket, so it must do the closing */
+        port_dualcore_close(sockfd);
+        return;
+    }
+    /* The socket must leave the reactor's interest set before the fd can be reused */
+    port_reactor_unregister(sockfd);
+    close(sockfd);
+}
+
+/* Connections whose opening failed before there was a socket to watch. They are signaled disconnected from the main loop, and not
+ * from inside wish_open_connection(), because the core is in the middle of setting up the connection when it calls us. */
+static wish_connection_t *failed_opens[WISH_PORT_CONTEXT_POOL_SZ];
+static int num_failed_opens = 0;
+
+void port_net_signal_failed_opens(wish_core_t *core) {
+    while (num_failed_opens > 0) {
+        wish_connection_t *ctx = failed_opens[--num_failed_opens];
+        if (ctx->context_state != WISH_CONTEXT_FREE) {
+            wish_core_signal_tcp_event(core, ctx, TCP_DISCONNECTED);
+        }
+    }
+}
+
+enum port_conn_state {
+    /* No socket */
+    PORT_CONN_FREE,
+    /* A relayed connection whose connect() is held back, to give a direct connection to the same peer a head start */
+    PORT_CONN_STAGGERED,
+    /* connect() is in progress, the socket is watched for writability to find out when it completes */
+    PORT_CONN_CONNECTING,
+    PORT_CONN_OPEN,
+};
+
+/* Port state of the Wish connections, indexed by the connection's position in the connection pool. The send_arg of a connection
+ * points to its record, so no allocation is needed per connection. */
+struct port_conn {
+    int fd;
+    enum port_conn_state state;
+    /* Links of the list of connections which have a socket, as indexes to conns[], -1 for none */
+    int8_t prev_active;
+    int8_t next_active;
+    /* The other transport of the same peer which this connection is racing against, as an index to conns[], -1 for none */
+    int8_t rival;
+    bool relayed;
+    struct sockaddr_in addr;
+    /* The receive ring buffer was full, the socket is not watched for readability until the core has consumed some */
+    bool rx_parked;
+    /* The message processor has handled everything fed so far, so what is left in the receive ring buffer is an incomplete frame */
+    bool rx_processed;
+    /* The outbound queue went above MIST_PORT_OUTQ_HIGH_WATER, reading is paused until it has been flushed to the low water mark */
+    bool tx_backpressure;
+    /* Data was written while corked, the outbound queue is flushed at the latest by port_net_uncork() */
+    bool corked;
+    /* port_latency_now() when the connection was corked */
+    uint32_t corked_at;
+    /* Bulk data is queued, it is written by schedule_bulk(). Anything written after it is queued too, to keep the frames in order. */
+    bool bulk_backlog;
+    /* The last write to the socket would have blocked, it is watched for writability */
+    bool tx_blocked;
+    /* The bytes of bulk data the connection may still write in the current round robin round */
+    uint32_t deficit;
+    /* The interest the socket is watched for, valid if interest_known. Saves redundant re-watching after each flush. */
+    bool interest_known;
+    uint8_t interest;
+    struct port_outq outq;
+    struct port_net_conn_stats stats;
+    /* Cancels the connection if connect() has not completed by the deadline */
+    port_timer_t connect_timer;
+};
+
+static struct port_conn conns[WISH_PORT_CONTEXT_POOL_SZ];
+/* The first connection which has a socket, -1 if none. The loops over connections visit only these. */
+static int active_head = -1;
+static int num_rx_parked = 0;
+
+/* Set between port_net_cork() and port_net_uncork() */
+static bool corking = false;
+static int num_corked = 0;
+static int num_bulk_backlogged = 0;
+/* Where schedule_bulk() continues the round robin from, so that the connections early in the list are not favored */
+static int bulk_cursor = -1;
+
+/* The observed connect() completion times of direct or relayed connections, smoothed like round-trip times for the TCP
+ * retransmission timer (RFC 6298) */
+struct connect_rtt {
+    bool valid;
+    uint32_t srtt_ms;
+    uint32_t rttvar_ms;
+    /* The deadline is doubled for each consecutive timeout, so that a slower network than the history suggests can be connected to */
+    uint8_t backoff;
+};
+
+static struct connect_rtt connect_rtt[2];
+static struct mist_port_esp32_connect_stats connect_stats;
+
+static struct connect_rtt *get_connect_rtt(wish_connection_t *ctx) {
+    return &connect_rtt[ctx->via_relay ? 1 : 0];
+}
+
+static uint32_t connect_deadline_ms(const struct connect_rtt *rtt) {
+    uint32_t deadline = MIST_PORT_CONNECT_TIMEOUT_INITIAL_MS;
+    if (rtt->valid) {
+        deadline = rtt->srtt_ms + 4 * rtt->rttvar_ms;
+    }
+    deadline <<= rtt->backoff;
+    if (deadline < MIST_PORT_CONNECT_TIMEOUT_MIN_MS) {
+        deadline = MIST_PORT_CONNECT_TIMEOUT_MIN_MS;
+    }
+    if (deadline > MIST_PORT_CONNECT_TIMEOUT_MAX_MS) {
+        deadline = MIST_PORT_CONNECT_TIMEOUT_MAX_MS;
+    }
+    return deadline;
+}
+
+static void connect_rtt_sample(struct connect_rtt *rtt, uint32_t sample_ms) {
+    if (!rtt->valid) {
+        rtt->srtt_ms = sample_ms;
+        rtt->rttvar_ms = sample_ms / 2;
+        rtt->valid = true;
+    }
+    else {
+        uint32_t err = rtt->srtt_ms > sample_ms ? rtt->srtt_ms - sample_ms : sample_ms - rtt->srtt_ms;
+        rtt->rttvar_ms = (3 * rtt->rttvar_ms + err) / 4;
+        rtt->srtt_ms = (7 * rtt->srtt_ms + sample_ms) / 8;
+    }
+    rtt->backoff = 0;
+}
+
+void mist_port_esp32_get_connect_stats(struct mist_port_esp32_connect_stats *stats) {
+    *stats = connect_stats;
+    stats->direct_deadline_ms = connect_deadline_ms(&connect_rtt[0]);
+    stats->relayed_deadline_ms = connect_deadline_ms(&connect_rtt[1]);
+}
+
+static struct port_conn *get_conn(wish_connection_t *ctx) {
+    return &conns[ctx - core->connection_pool];
+}
+
+int port_net_conn_fd(wish_connection_t *ctx) {
+    struct port_conn *pc = get_conn(ctx);
+    return pc->state != PORT_CONN_FREE ? pc->fd : -1;
+}
+
+const struct port_net_conn_stats *port_net_conn_stats(wish_connection_t *ctx) {
+    return &get_conn(ctx)->stats;
+}
+
+static void start_connect(wish_connection_t *ctx);
+
+static void connect_timer_cb(void *arg) {
+    wish_connection_t *ctx = arg;
+    struct port_conn *pc = get_conn(ctx);
+    if (pc->state == PORT_CONN_STAGGERED) {
+        /* The head start of the direct connection is over */
+        start_connect(ctx);
+        return;
+    }
+    if (pc->state != PORT_CONN_CONNECTING) {
+        return;
+    }
+    struct connect_rtt *rtt = get_connect_rtt(ctx);
+    PORT_LOGWARN(TAG, "connect() on fd %i did not complete in %u ms, cancelling", pc->fd, connect_deadline_ms(rtt));
+    connect_stats.timed_out++;
+    port_conntrace_end(ctx, PORT_CONNTRACE_CONNECT_TIMEOUT);
+    if (connect_deadline_ms(rtt) < MIST_PORT_CONNECT_TIMEOUT_MAX_MS) {
+        rtt->backoff++;
+    }
+    /* Closes the socket, which frees the connection context in the core */
+    port_net_release_connection(ctx);
+    wish_core_signal_tcp_event(ctx->core, ctx, TCP_DISCONNECTED);
+}
+
+/* Called when connect() has completed, for both direct and relayed connections */
+static void connect_completed(wish_connection_t *ctx) {
+    struct port_conn *pc = get_conn(ctx);
+    if (pc->state == PORT_CONN_CONNECTING) {
+        port_timer_stop(&pc->connect_timer);
+        connect_rtt_sample(get_connect_rtt(ctx), (uint32_t) ((time_helper_monotonic_us() - pc->stats.opened_us) / 1000));
+        connect_stats.connected++;
+        port_conntrace_mark(ctx, PORT_CONNTRACE_CONNECTED);
+    }
+    pc->state = PORT_CONN_OPEN;
+
+    if (pc->rival >= 0) {
+        /* This transport won the race, the other one is not needed */
+        wish_connection_t *loser = &core->connection_pool[pc->rival];
+        conns[pc->rival].rival = -1;
+        pc->rival = -1;
+        PORT_LOGINFO(TAG, "%s connection won, cancelling the %s one", pc->relayed ? "Relayed" : "Direct", 
+                pc->relayed ? "direct" : "relayed");
+        connect_stats.raced_cancelled++;
+        port_conntrace_end(loser, PORT_CONNTRACE_RACE_LOST);
+        port_net_release_connection(loser);
+        wish_core_signal_tcp_event(core, loser, TCP_DISCONNECTED);
+    }
+}
+
+/* Find a direct connection attempt to the peer of a relayed one, or the other way round */
+static int find_rival(wish_connection_t *ctx, bool relaying) {
+    for (int i = active_head; i >= 0; i = conns[i].next_active) {
+        wish_connection_t *other = &core->connection_pool[i];
+        if (other == ctx || conns[i].rival >= 0 || conns[i].relayed == relaying) {
+            continue;
+        }
+        if (conns[i].state != PORT_CONN_CONNECTING && conns[i].state != PORT_CONN_STAGGERED) {
+            continue;
+        }
+        if (memcmp(other->luid, ctx->luid, sizeof(ctx->luid)) == 0 && memcmp(other->ruid, ctx->ruid, sizeof(ctx->ruid)) == 0
+                && memcmp(other->rhid, ctx->rhid, sizeof(ctx->rhid)) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void port_net_attach(wish_connection_t *ctx, int sockfd, bool connecting) {
+    int i = ctx - core->connection_pool;
+    struct port_conn *pc = &conns[i];
+    if (pc->state != PORT_CONN_FREE) {
+        PORT_LOGERR(TAG, "Connection %i already has socket %i, replacing it with %i", i, pc->fd, sockfd);
+        port_net_release_connection(ctx);
+    }
+    pc->fd = sockfd;
+    pc->state = connecting ? PORT_CONN_CONNECTING : PORT_CONN_OPEN;
+    pc->rival = -1;
+    memset(&pc->stats, 0, sizeof(pc->stats));
+    pc->stats.opened_us = time_helper_monotonic_us();
+    port_timer_init(&pc->connect_timer, connect_timer_cb, ctx);
+    if (!connecting) {
+        /* An accepted connection */
+        port_conntrace_begin(ctx, true);
+        port_conntrace_mark(ctx, PORT_CONNTRACE_CONNECT_START);
+        port_conntrace_mark(ctx, PORT_CONNTRACE_CONNECTED);
+        struct sockaddr_in peer;
+        socklen_t peer_len = sizeof(peer);
+        if (getpeername(sockfd, (struct sockaddr *) &peer, &peer_len) == 0 && peer.sin_family == AF_INET) {
+            uint32_t addr = ntohl(peer.sin_addr.s_addr);
+            uint8_t ip[4] = { addr >> 24, addr >> 16, addr >> 8, addr };
+            port_conntrace_set_peer(ctx, ip, ntohs(peer.sin_port));
+        }
+    }
+
+    pc->prev_active = -1;
+    pc->next_active = active_head;
+    if (active_head >= 0) {
+        conns[active_head].prev_active = i;
+    }
+    active_head = i;
+
+    wish_core_register_send(core, ctx, write_to_socket, pc);
+}
+
+static void unlink_active(int i) {
+    struct port_conn *pc = &conns[i];
+    if (pc->prev_active >= 0) {
+        conns[pc->prev_active].next_active = pc->next_active;
+    }
+    else {
+        active_head = pc->next_active;
+    }
+    if (pc->next_active >= 0) {
+        conns[pc->next_active].prev_active = pc->prev_active;
+    }
+}
+
+void port_net_count_rx(wish_connection_t *ctx, size_t len) {
+    struct port_conn *pc = get_conn(ctx);
+    pc->stats.bytes_in += len;
+    pc->rx_processed = false;
+    pc->stats.last_rx_us = time_helper_monotonic_us();
+    if (port_conntrace_has_mark(ctx, PORT_CONNTRACE_HANDSHAKE_DONE)) {
+        port_conntrace_mark(ctx, PORT_CONNTRACE_FIRST_FRAME);
+    }
+}
+
+void port_net_poll_handshakes(wish_core_t *core) {
+    for (int i = active_head; i >= 0; i = conns[i].next_active) {
+        wish_connection_t *ctx = &core->connection_pool[i];
+        if (conns[i].state == PORT_CONN_OPEN && ctx->context_state == WISH_CONTEXT_CONNECTED) {
+            /* Only the first call for a connection records the time */
+            port_conntrace_mark(ctx, PORT_CONNTRACE_HANDSHAKE_DONE);
+        }
+    }
+}
+
+static void count_tx(struct port_conn *pc, size_t len) {
+    if (len > 0) {
+        pc->stats.bytes_out += len;
+        pc->stats.last_tx_us = time_helper_monotonic_us();
+    }
+}
+
+/* Watch the socket of a connected Wish connection for what it is waiting for */
+static void update_interest(wish_connection_t *ctx) {
+    struct port_conn *pc = get_conn(ctx);
+    int sockfd = port_net_conn_fd(ctx);
+    if (pc->state != PORT_CONN_OPEN) {
+        return;
+    }
+    uint8_t interest = 0;
+    if (!pc->rx_parked && !pc->tx_backpressure) {
+        interest |= PORT_REACTOR_READ;
+    }
+    if (pc->tx_blocked) {
+        interest |= PORT_REACTOR_WRITE;
+    }
+    if (pc->interest_known && pc->interest == interest) {
+        return;
+    }
+    pc->interest_known = true;
+    pc->interest = interest;
+    port_net_rewatch(sockfd, interest);
+}
+
+bool port_net_conn_is_connecting(wish_connection_t *ctx) {
+    return get_conn(ctx)->state == PORT_CONN_CONNECTING;
+}
+
+void port_net_park_rx(wish_connection_t *ctx) {
+    struct port_conn *pc = get_conn(ctx);
+    if (pc->rx_parked) {
+        return;
+    }
+    /* While parked, the socket is not watched for readability, so the data stays in the TCP receive window and the peer is slowed
+     * down */
+    pc->rx_parked = true;
+    num_rx_parked++;
+    update_interest(ctx);
+}
+
+void port_net_rx_processed(wish_connection_t *ctx) {
+    get_conn(ctx)->rx_processed = true;
+}
+
+void port_net_resume_rx(wish_core_t *core) {
+    for (int i = active_head; num_rx_parked > 0 && i >= 0; i = conns[i].next_active) {
+        if (!conns[i].rx_parked) {
+            continue;
+        }
+        wish_connection_t *ctx = &core->connection_pool[i];
+        int rb_free = wish_core_get_rx_buffer_free(core, ctx);
+        /* A frame which does not fit in the space left can only be completed by reading more, however little space there is */
+        if (rb_free < MIST_PORT_RX_RESUME_BYTES && !(rb_free > 0 && conns[i].rx_processed)) {
+            continue;
+        }
+        if (port_dualcore_active() && port_dualcore_rx_set_aside(ctx)) {
+            /* Data read earlier is fed first, see port_dualcore_process() */
+            continue;
+        }
+        conns[i].rx_parked = false;
+        num_rx_parked--;
+        update_interest(ctx);
+    }
+}
+
+static void end_bulk_backlog(struct port_conn *pc) {
+    if (pc->bulk_backlog) {
+        pc->bulk_backlog = false;
+        pc->deficit = 0;
+        num_bulk_backlogged--;
+    }
+}
+
+/* Write at most max bytes of the outbound queue, until the socket would block. Returns the number of bytes written, or -1 if the
+ * connection failed and was closed. */
+static int write_outq(wish_connection_t *ctx, size_t max) {
+    struct port_conn *pc = get_conn(ctx);
+    int sockfd = port_net_conn_fd(ctx);
+    int total = 0;
+    while (port_outq_len(&pc->outq) > 0 && (size_t) total < max) {
+        size_t len = port_outq_len(&pc->outq);
+        if (len > max - total) {
+            len = max - total;
+        }
+        int write_ret = write(sockfd, port_outq_data(&pc->outq), len);
+        if (write_ret > 0) {
+            port_outq_consume(&pc->outq, write_ret);
+            count_tx(pc, write_ret);
+            total += write_ret;
+        }
+        else if (write_ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            pc->tx_blocked = true;
+            break;
+        }
+        else {
+            PORT_LOGERR(TAG, "flushing fd %i: write_ret %i, errno: %s, closing connection", sockfd, write_ret, strerror(errno));
+            wish_close_connection(core, ctx);
+            return -1;
+        }
+    }
+    if (port_outq_len(&pc->outq) == 0) {
+        pc->tx_blocked = false;
+        end_bulk_backlog(pc);
+    }
+    if (pc->tx_backpressure && port_outq_len(&pc->outq) <= MIST_PORT_OUTQ_LOW_WATER) {
+        pc->tx_backpressure = false;
+    }
+    return total;
+}
+
+static void flush_outq(wish_connection_t *ctx) {
+    struct port_conn *pc = get_conn(ctx);
+    if (pc->corked) {
+        pc->corked = false;
+        num_corked--;
+    }
+    if (port_net_conn_fd(ctx) < 0) {
+        return;
+    }
+    if (write_outq(ctx, SIZE_MAX) < 0) {
+        return;
+    }
+    update_interest(ctx);
+}
+
+void port_net_flush_outq(wish_connection_t *ctx) {
+    struct port_conn *pc = get_conn(ctx);
+    /* In dual-core mode, the I/O task has stopped watching the socket for writability before telling about it */
+    pc->interest_known = false;
+    pc->tx_blocked = false;
+    if (pc->bulk_backlog) {
+        /* Bulk data is left for schedule_bulk() */
+        update_interest(ctx);
+        return;
+    }
+    flush_outq(ctx);
+}
+
+void port_net_cork(void) {
+    corking = true;
+}
+
+/* Flush the connections which have been corked for at least max_delay_us */
+static void flush_corked(wish_core_t *core, uint32_t max_delay_us) {
+    uint32_t now = port_latency_now();
+    int next;
+    for (int i = active_head; num_corked > 0 && i >= 0; i = next) {
+        /* Flushing may close the connection, which unlinks it */
+        next = conns[i].next_active;
+        if (conns[i].corked && now - conns[i].corked_at >= max_delay_us) {
+            flush_outq(&core->connection_pool[i]);
+        }
+    }
+}
+
+void port_net_flush_overdue_corks(wish_core_t *core) {
+    flush_corked(core, MIST_PORT_CORK_MAX_DELAY_US);
+}
+
+/* Write the queued bulk data of the connections in deficit round robin: each connection may write MIST_PORT_DRR_QUANTUM bytes per
+ * round, and what it does not use because its socket is full is carried over to the next round, as long as it has bulk data queued.
+ * Returns true if bulk data which could be written now was left over. */
+static bool schedule_bulk(wish_core_t *core, size_t max_bytes) {
+    size_t budget_left = max_bytes;
+    int i = bulk_cursor >= 0 && conns[bulk_cursor].state != PORT_CONN_FREE ? bulk_cursor : active_head;
+    /* Stop after a full round of connections without any progress */
+    int num_idle = 0;
+    while (num_bulk_backlogged > 0 && budget_left > 0 && i >= 0 && num_idle <= WISH_PORT_CONTEXT_POOL_SZ) {
+        struct port_conn *pc = &conns[i];
+        int next = pc->next_active >= 0 ? pc->next_active : active_head;
+        if (pc->bulk_backlog && !pc->tx_blocked) {
+            wish_connection_t *ctx = &core->connection_pool[i];
+            pc->deficit += MIST_PORT_DRR_QUANTUM;
+            int written = write_outq(ctx, pc->deficit < budget_left ? pc->deficit : budget_left);
+            if (written < 0) {
+                /* The connection was closed and unlinked */
+                next = active_head;
+                num_idle++;
+            }
+            else {
+                if (pc->bulk_backlog) {
+                    pc->deficit -= written;
+                }
+                budget_left -= written;
+                num_idle = written > 0 ? 0 : num_idle + 1;
+                update_interest(ctx);
+            }
+        }
+        else {
+            num_idle++;
+        }
+        i = next;
+    }
+    bulk_cursor = i;
+
+    for (i = active_head; num_bulk_backlogged > 0 && i >= 0; i = conns[i].next_active) {
+        if (conns[i].bulk_backlog && !conns[i].tx_blocked) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool port_net_uncork(wish_core_t *core, size_t max_bulk_bytes) {
+    corking = false;
+    flush_corked(core, 0);
+    return schedule_bulk(core, max_bulk_bytes);
+}
+
+void port_net_release_connection(wish_connection_t *ctx) {
+    struct port_conn *pc = get_conn(ctx);
+    if (pc->state == PORT_CONN_FREE) {
+        return;
+    }
+    port_conntrace_end(ctx, PORT_CONNTRACE_CLOSED);
+    port_timer_stop(&pc->connect_timer);
+    port_net_close_socket(pc->fd);
+    unlink_active(ctx - core->connection_pool);
+    pc->fd = -1;
+    pc->state = PORT_CONN_FREE;
+    if (pc->rival >= 0) {
+        /* This transport lost, or was closed by the core. The other one need not wait for its head start any more. */
+        struct port_conn *rival = &conns[pc->rival];
+        wish_connection_t *rival_ctx = &core->connection_pool[pc->rival];
+        rival->rival = -1;
+        pc->rival = -1;
+        if (rival->state == PORT_CONN_STAGGERED) {
+            port_timer_stop(&rival->connect_timer);
+            start_connect(rival_ctx);
+        }
+    }
+    if (pc->rx_parked) {
+        num_rx_parked--;
+    }
+    if (pc->corked) {
+        num_corked--;
+    }
+    port_outq_clear(&pc->outq);
+    pc->rx_parked = false;
+    pc->rx_processed = false;
+    pc->tx_backpressure = false;
+    pc->corked = false;
+    end_bulk_backlog(pc);
+    pc->tx_blocked = false;
+    pc->interest_known = false;
+}
+
+int port_net_close_all_connections(wish_core_t *core) {
+    int num_closed = 0;
+    /* Closing a connection unlinks it, and may start connecting a staggered rival, which is then closed too */
+    while (active_head >= 0) {
+        wish_connection_t *ctx = &core->connection_pool[active_head];
+        port_conntrace_end(ctx, PORT_CONNTRACE_LINK_LOST);
+        wish_close_connection(core, ctx);
+        num_closed++;
+    }
+    /* Connections waiting for DNS have no socket yet, so they are not in the active list */
+    for (int i = 0; i < WISH_PORT_CONTEXT_POOL_SZ; i++) {
+        wish_connection_t *ctx = &core->connection_pool[i];
+        if (ctx->context_state != WISH_CONTEXT_FREE && ctx->curr_transport_state == TRANSPORT_STATE_RESOLVING) {
+            port_conntrace_end(ctx, PORT_CONNTRACE_LINK_LOST);
+            wish_close_connection(core, ctx);
+            num_closed++;
+        }
+    }
+    return num_closed;
+}
+
 /* When the wish connection "i" is connecting and connect succeeds
  * (socket becomes writable) this function is called */
 void connected_cb(wish_connection_t *ctx) {
+    connect_completed(ctx);
     //PORT_LOGINFO(TAG, "Signaling wish session connected");
     wish_core_signal_tcp_event(ctx->core, ctx, TCP_CONNECTED);
 }
 
 void connected_cb_relay(wish_connection_t *ctx) {
+    connect_completed(ctx);
     //PORT_LOGINFO(TAG, "Signaling relayed wish session connected \n");
     wish_core_signal_tcp_event(ctx->core, ctx, TCP_RELAY_SESSION_CONNECTED);
 }
 
 void connect_fail_cb(wish_connection_t *ctx) {
     PORT_LOGWARN(TAG, "Connect fail...");
-    if (ctx->send_arg != NULL) {
-        int sockfd = *((int *)ctx->send_arg);
-        close(sockfd);
-        free(ctx->send_arg);
-    }
+    connect_stats.failed++;
+    port_conntrace_end(ctx, PORT_CONNTRACE_CONNECT_FAILED);
+    port_net_release_connection(ctx);
     wish_core_signal_tcp_event(ctx->core, ctx, TCP_DISCONNECTED);
 }
 
-int wish_open_connection(wish_core_t* core, wish_connection_t *ctx, wish_ip_addr_t *ip, uint16_t port, bool relaying) {
-    ctx->core = core;
-    //PORT_LOGINFO(TAG, "should start connect\n");
-    int *sockfd_ptr = malloc(sizeof(int));
-    if (sockfd_ptr == NULL) {
-        PORT_LOGERR(TAG, "Malloc fail");
-        exit(1);
-    }
-    *(sockfd_ptr) = socket(AF_INET, SOCK_STREAM, 0);
-    
-
-    
-    int sockfd = *(sockfd_ptr);
-    if (sockfd < 0) {
-        PORT_LOGINFO(TAG, "ERROR opening socket, errno: %s", strerror(errno));
-        return 1;
-    }
-    
-    socket_set_nonblocking(sockfd);
+static void start_connect(wish_connection_t *ctx) {
+    struct port_conn *pc = get_conn(ctx);
+    int sockfd = pc->fd;
 
-    wish_core_register_send(ctx->core, ctx, write_to_socket, sockfd_ptr);
+    pc->state = PORT_CONN_CONNECTING;
+    /* The connect time is measured from here, also for a staggered connection */
+    pc->stats.opened_us = time_helper_monotonic_us();
+    port_conntrace_mark(ctx, PORT_CONNTRACE_CONNECT_START);
+    port_timer_start(&pc->connect_timer, connect_deadline_ms(get_connect_rtt(ctx)), 0);
 
     //PORT_LOGINFO(TAG, "Opening connection sockfd %i\n", sockfd);
 
-
-    struct sockaddr_in serv_addr;
-    serv_addr.sin_family = AF_INET;
-    char ip_str[20];
-    snprintf(ip_str, 20, "%d.%d.%d.%d", ip->addr[0], ip->addr[1], ip->addr[2], ip->addr[3]);
-    WISHDEBUG(LOG_CRITICAL, "Remote ip is %s port %hu\n", ip_str, port);
-    inet_aton(ip_str, &serv_addr.sin_addr);
-    serv_addr.sin_port = htons(port);
-    int ret = connect(sockfd,(struct sockaddr *) &serv_addr,sizeof(serv_addr));
+    int ret = connect(sockfd, (struct sockaddr *) &pc->addr, sizeof(pc->addr));
+    int connect_errno = errno;
+    /* Until connect() completes, we are only interested in the socket becoming writable. The socket is watched only now, with the
+     * final interest if connect() already completed: in dual-core mode, a socket watched for writability from the start is taken to
+     * be connecting, and its next writable event would be reported as the completion of connect(). */
+    port_net_watch(sockfd, ret == 0 ? PORT_REACTOR_READ : PORT_REACTOR_WRITE, PORT_REACTOR_KIND_WISH_CONN, ctx);
     if (ret == -1) {
-        if (errno == EINPROGRESS) {
+        if (connect_errno == EINPROGRESS) {
             WISHDEBUG(LOG_DEBUG, "Connect now in progress");
             ctx->curr_transport_state = TRANSPORT_STATE_CONNECTING;
         }
         else {
-            PORT_LOGERR(TAG, "Unhandled connect() errno: %s", strerror(errno));
+            PORT_LOGERR(TAG, "Unhandled connect() errno: %s", strerror(connect_errno));
         }
     }
     else if (ret == 0) {
@@ -151,6 +729,57 @@ int wish_open_connection(wish_core_t* core, wish_connection_t *ctx, wish_ip_addr
             connected_cb(ctx);
         }
     }
+}
+
+int wish_open_connection(wish_core_t* core, wish_connection_t *ctx, wish_ip_addr_t *ip, uint16_t port, bool relaying) {
+    ctx->core = core;
+    port_conntrace_begin(ctx, false);
+    port_conntrace_set_peer(ctx, ip->addr, port);
+    //PORT_LOGINFO(TAG, "should start connect\n");
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        PORT_LOGINFO(TAG, "ERROR opening socket, errno: %s", strerror(errno));
+        port_conntrace_end(ctx, PORT_CONNTRACE_CONNECT_FAILED);
+        if (num_failed_opens < WISH_PORT_CONTEXT_POOL_SZ) {
+            failed_opens[num_failed_opens++] = ctx;
+        }
+        return 1;
+    }
+    
+    socket_set_nonblocking(sockfd);
+    port_sockopt_apply(sockfd, relaying ? MIST_PORT_SOCKET_RELAYED : MIST_PORT_SOCKET_DIRECT);
+
+    /* Look for an attempt over the other transport before attaching, so that this connection is not found */
+    int rival = find_rival(ctx, relaying);
+
+    port_net_attach(ctx, sockfd, true);
+    struct port_conn *pc = get_conn(ctx);
+    pc->relayed = relaying;
+
+    memset(&pc->addr, 0, sizeof(pc->addr));
+    pc->addr.sin_family = AF_INET;
+    char ip_str[20];
+    snprintf(ip_str, 20, "%d.%d.%d.%d", ip->addr[0], ip->addr[1], ip->addr[2], ip->addr[3]);
+    WISHDEBUG(LOG_CRITICAL, "Remote ip is %s port %hu\n", ip_str, port);
+    inet_aton(ip_str, &pc->addr.sin_addr);
+    pc->addr.sin_port = htons(port);
+
+    if (rival >= 0) {
+        /* Race the transports: whichever connects first is kept, see connect_completed() */
+        pc->rival = rival;
+        conns[rival].rival = ctx - core->connection_pool;
+        if (relaying && conns[rival].state == PORT_CONN_CONNECTING) {
+            /* The direct connection gets a head start, as it is the better one if it works at all */
+            int64_t head_start_us = time_helper_monotonic_us() - conns[rival].stats.opened_us;
+            if (head_start_us < MIST_PORT_CONNECT_STAGGER_MS * 1000) {
+                pc->state = PORT_CONN_STAGGERED;
+                port_timer_start(&pc->connect_timer, MIST_PORT_CONNECT_STAGGER_MS - head_start_us / 1000, 0);
+                return 0;
+            }
+        }
+    }
+
+    start_connect(ctx);
     return 0;
 }
 
@@ -160,6 +789,7 @@ int wish_open_connection_dns(wish_core_t* core, wish_connection_t* connection, c
     connection->core = core;
     connection->remote_port = port;
     connection->via_relay = via_relay;
+    port_conntrace_begin(connection, false);
     
     port_dns_start_resolving_wish_conn(connection, host);  
     
@@ -171,19 +801,18 @@ void wish_close_connection(wish_core_t* core, wish_connection_t *ctx) {
      * succeeds, we need to excplicitly call TCP_DISCONNECTED so that
      * clean-up will happen */
     ctx->context_state = WISH_CONTEXT_CLOSING;
-    int sockfd = -1;
-    
-    if (ctx->send_arg != NULL) {
-        sockfd = *((int *)ctx->send_arg);
+    if (ctx->curr_transport_state == TRANSPORT_STATE_RESOLVING) {
+        /* The result of the query must not open a socket for the closed connection */
+        port_dns_resolver_cancel_by_wish_connection(ctx);
     }
-    
-    if (sockfd >= 0) {
-        close(sockfd);
-    }
-    
-    if (ctx->send_arg) {
-        free(ctx->send_arg);
+    /* Also ends the trace of a connection which had no socket yet, because it was being resolved */
+    port_conntrace_end(ctx, PORT_CONNTRACE_CLOSED);
+    struct port_conn *pc = get_conn(ctx);
+    if (pc->corked && port_net_conn_fd(ctx) >= 0) {
+        /* Best effort: the core may have written a last message to the peer just before closing */
+        (void) write(port_net_conn_fd(ctx), port_outq_data(&pc->outq), port_outq_len(&pc->outq));
     }
+    port_net_release_connection(ctx);
     
     wish_core_signal_tcp_event(core, ctx, TCP_DISCONNECTED);
 }
@@ -191,6 +820,7 @@ void wish_close_connection(wish_core_t* core, wish_connection_t *ctx) {
 /* The fd for the socket that will be used for accepting incoming
  * Wish connections */
 static int serverfd = 0;
+static bool server_set_up = false;
 
 int get_server_fd(void) {
     return serverfd;
@@ -202,38 +832,108 @@ int get_server_fd(void) {
  * After this, we can start select()ing on the serverfd, and we should
  * detect readable condition immediately when a TCP client connects.
  * */
-void setup_wish_server(wish_core_t* core) {
-    serverfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (serverfd < 0) {
+static int open_server_socket(wish_core_t* core) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
         perror("server socket creation");
-        exit(1);
+        return -1;
     }
     int option = 1;
-    setsockopt(serverfd, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
-    socket_set_nonblocking(serverfd);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
+    socket_set_nonblocking(fd);
 
     struct sockaddr_in server_addr;
     memset(&server_addr, 0, sizeof (server_addr));
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
     server_addr.sin_port = htons(wish_get_host_port(core));
-    if (bind(serverfd, (struct sockaddr *) &server_addr, 
+    if (bind(fd, (struct sockaddr *) &server_addr, 
             sizeof(server_addr)) < 0) {
         perror("ERROR on binding wish server socket");
-        exit(1);
+        close(fd);
+        return -1;
     }
-    int connection_backlog = 1;
-    if (listen(serverfd, connection_backlog) < 0) {
+    if (listen(fd, MIST_PORT_SERVER_BACKLOG) < 0) {
         perror("listen()");
     }
+    return fd;
+}
+
+void setup_wish_server(wish_core_t* core) {
+    serverfd = open_server_socket(core);
+    if (serverfd < 0) {
+        exit(1);
+    }
+    server_set_up = true;
+    port_net_watch(serverfd, PORT_REACTOR_READ, PORT_REACTOR_KIND_SERVER, NULL);
+}
+
+bool port_net_rearm_server(wish_core_t *core) {
+    if (!server_set_up) {
+        return true;
+    }
+    if (serverfd >= 0) {
+        port_net_close_socket(serverfd);
+        serverfd = -1;
+    }
+    /* In dual-core mode, the I/O task may not have closed the old socket yet, and then the port is still in use */
+    serverfd = open_server_socket(core);
+    if (serverfd < 0) {
+        return false;
+    }
+    port_net_watch(serverfd, PORT_REACTOR_READ, PORT_REACTOR_KIND_SERVER, NULL);
+    return true;
 }
     
-/* The UDP Wish local discovery socket */
-static int wld_fd = 0;
+/* The UDP Wish local discovery socket. In dual-core mode, the I/O task reads the socket of the reactor event, never wld_fd, which
+ * the protocol task replaces when it re-arms local discovery. */
+static int wld_fd = -1;
+static bool wld_set_up = false;
+/* The address the socket is bound to */
 static struct sockaddr_in sockaddr_wld;
 /* The broadcast socket */
 int wld_bcast_sock;
 
+/* In dual-core mode, accept_errors is written by the I/O task and the rest by the protocol task */
+static struct mist_port_esp32_accept_stats accept_stats;
+
+int port_net_accept(int server_fd) {
+    int newsockfd = accept(server_fd, NULL, NULL);
+    if (newsockfd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            PORT_LOGERR(TAG, "on accept: errno %s, abandoning incoming connection", strerror(errno));
+            accept_stats.accept_errors++;
+        }
+        return -1;
+    }
+    socket_set_nonblocking(newsockfd);
+    port_sockopt_apply(newsockfd, MIST_PORT_SOCKET_INBOUND);
+    return newsockfd;
+}
+
+void port_net_count_accept(bool pool_full) {
+    if (pool_full) {
+        accept_stats.rejected_pool_full++;
+    }
+    else {
+        accept_stats.accepted++;
+    }
+}
+
+int port_net_free_connection_slots(wish_core_t *core) {
+    int num_free = 0;
+    for (int i = 0; i < WISH_PORT_CONTEXT_POOL_SZ; i++) {
+        if (core->connection_pool[i].context_state == WISH_CONTEXT_FREE) {
+            num_free++;
+        }
+    }
+    return num_free;
+}
+
+void mist_port_esp32_get_accept_stats(struct mist_port_esp32_accept_stats *stats) {
+    *stats = accept_stats;
+}
+
 int get_wld_fd(void) {
     return wld_fd;
 }
@@ -241,6 +941,7 @@ int get_wld_fd(void) {
 /* This function sets up a UDP socket for listening to UDP local
  * discovery broadcasts */
 void setup_wish_local_discovery(void) {
+    wld_set_up = true;
     wld_fd = socket(AF_INET, SOCK_DGRAM, 0);
     if (wld_fd == -1) {
         WISHDEBUG(LOG_CRITICAL, "error: udp socket");
@@ -265,6 +966,7 @@ void setup_wish_local_discovery(void) {
             sizeof(struct sockaddr_in))==-1) {
         WISHDEBUG(LOG_CRITICAL, "error: local discovery bind()");
     }
+    port_net_watch(wld_fd, PORT_REACTOR_READ, PORT_REACTOR_KIND_WLD, NULL);
 
     /* Setup wld broadcasting socket for sending out adverts */
     wld_bcast_sock = socket(AF_INET, SOCK_DGRAM, 0);
@@ -292,90 +994,119 @@ void setup_wish_local_discovery(void) {
 
 }
 
-/* This function reads data from the local discovery socket. This
- * function should be called when select() indicates that the local
- * discovery socket has data available */
-void read_wish_local_discovery(void) {
-    const int buf_len = 1024;
-    uint8_t buf[buf_len];
-    int blen;
+int port_net_recv_local_discovery(int fd, uint8_t *buf, size_t buf_len, wish_ip_addr_t *ip_addr, uint16_t *port) {
+    struct sockaddr_in sockaddr_src;
     socklen_t slen = sizeof(struct sockaddr_in);
 
-    blen = recvfrom(wld_fd, buf, sizeof(buf), 0, (struct sockaddr*) &sockaddr_wld, &slen);
-    if (blen == -1) {
+    int blen = recvfrom(fd, buf, buf_len, 0, (struct sockaddr*) &sockaddr_src, &slen);
+    if (blen == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
       error("recvfrom()");
     }
 
     if (blen > 0) {
-        //printf("Received from %s:%hu\n\n",inet_ntoa(sockaddr_wld.sin_addr), ntohs(sockaddr_wld.sin_port));
+        //printf("Received from %s:%hu\n\n",inet_ntoa(sockaddr_src.sin_addr), ntohs(sockaddr_src.sin_port));
         union ip {
            uint32_t as_long;
            uint8_t as_bytes[4];
         } ip;
         /* XXX Don't convert to host byte order here. Wish ip addresses
          * have network byte order */
-        //ip.as_long = ntohl(sockaddr_wld.sin_addr.s_addr);
-        ip.as_long = sockaddr_wld.sin_addr.s_addr;
-        wish_ip_addr_t ip_addr;
-        memcpy(&ip_addr.addr, ip.as_bytes, 4);
+        //ip.as_long = ntohl(sockaddr_src.sin_addr.s_addr);
+        ip.as_long = sockaddr_src.sin_addr.s_addr;
+        memcpy(&ip_addr->addr, ip.as_bytes, 4);
         //printf("UDP data from: %i, %i, %i, %i\n", ip_addr.addr[0],
         //    ip_addr.addr[1], ip_addr.addr[2], ip_addr.addr[3]);
+        *port = ntohs(sockaddr_src.sin_port);
+    }
+    return blen;
+}
 
-        wish_ldiscover_feed(core, &ip_addr, 
-           ntohs(sockaddr_wld.sin_port), buf, blen);
+/* This function reads data from the local discovery socket. This
+ * function should be called when select() indicates that the local
+ * discovery socket has data available */
+void read_wish_local_discovery(int fd) {
+    /* Not on the stack, the main loop may run in a task with a small one */
+    static uint8_t buf[1024];
+    wish_ip_addr_t ip_addr;
+    uint16_t port;
+
+    /* Empty the socket, so that a burst of adverts costs one wakeup */
+    for (int i = 0; i < MIST_PORT_WLD_DRAIN_MAX; i++) {
+        int blen = port_net_recv_local_discovery(fd, buf, sizeof(buf), &ip_addr, &port);
+        if (blen <= 0) {
+            break;
+        }
+        if (port_wld_within_rate(&ip_addr, port)) {
+            port_wld_feed(core, &ip_addr, port, buf, blen);
+        }
     }
 }
 
 void cleanup_local_discovery(void) {
-    close(wld_fd);
+    /* In dual-core mode, the I/O task unregisters and closes them in order with its other commands, so it never waits on a closed fd */
+    port_net_close_socket(wld_fd);
+    wld_fd = -1;
 
-    close(wld_bcast_sock);
+    port_net_close_socket(wld_bcast_sock);
+    wld_bcast_sock = -1;
+}
+
+void port_net_rearm_local_discovery(void) {
+    if (!wld_set_up) {
+        return;
+    }
+    cleanup_local_discovery();
+    setup_wish_local_discovery();
 }
 
-int wish_send_advertizement(wish_core_t* core, uint8_t *ad_msg, size_t ad_len) {
-    struct sockaddr_in si_other;
-    si_other.sin_family = AF_INET;
-    si_other.sin_port = htons(LOCAL_DISCOVERY_UDP_PORT);
-    
 #ifdef WLD_SEND_UNICASTS_IN_AP_MODE
-    /* Get the list of each associated APs, and at each iteration send wld message as unicast to that particular station. This improves reliability if you have stations that exhibit
-     * high packet loss (such as Samsung J5) */
-    wifi_mode_t current_mode = WIFI_MODE_NULL;
-    ESP_ERROR_CHECK( esp_wifi_get_mode(&current_mode) );
-    if (current_mode == WIFI_MODE_AP) {      
-        wifi_sta_list_t ap_sta_list;
-        esp_wifi_ap_get_sta_list(&ap_sta_list);
-        tcpip_adapter_sta_list_t tcpip_sta_list;
-        tcpip_adapter_get_sta_list(&ap_sta_list, &tcpip_sta_list);
-        
-        if (tcpip_sta_list.num > 0) {
-            static int i = 0;
-            ip4_addr_t sta_ip = tcpip_sta_list.sta[i].ip;
-            if (sta_ip.addr == 0) {
-                PORT_LOGWARN(TAG, "Lease ip is 0, broadcasting to 255.255.255.255");
-                inet_aton("255.255.255.255", &si_other.sin_addr);
-            }
-            else {
-                PORT_LOGWARN(TAG, "Unicasting instead to %s, %i\n", ip4addr_ntoa(&sta_ip), i);
-                inet_aton(ip4addr_ntoa(&sta_ip), &si_other.sin_addr);
-            }
-            i++;
-            if (i >= tcpip_sta_list.num) {
-                i = 0;
-            }
+/* The addresses of the stations associated to the soft-AP, in network byte order. The list is read again when it is stale, that is
+ * when a station has associated or left since, or when a station had no DHCP lease yet at the last read. */
+static uint32_t ap_station_ips[ESP_WIFI_MAX_CONN_NUM];
+static int num_ap_stations = 0;
+static volatile bool ap_stations_stale = true;
+
+void mist_port_esp32_ap_stations_changed(void) {
+    ap_stations_stale = true;
+}
+
+/* Returns false if a station has no address yet */
+static bool refresh_ap_stations(void) {
+    /* Cleared first, so that a change during the read is not lost */
+    ap_stations_stale = false;
+    wifi_sta_list_t ap_sta_list;
+    tcpip_adapter_sta_list_t tcpip_sta_list;
+    if (esp_wifi_ap_get_sta_list(&ap_sta_list) != ESP_OK || tcpip_adapter_get_sta_list(&ap_sta_list, &tcpip_sta_list) != ESP_OK) {
+        ap_stations_stale = true;
+        num_ap_stations = 0;
+        return false;
+    }
+    bool all_leased = true;
+    num_ap_stations = 0;
+    for (int i = 0; i < tcpip_sta_list.num && i < ESP_WIFI_MAX_CONN_NUM; i++) {
+        if (tcpip_sta_list.sta[i].ip.addr == 0) {
+            all_leased = false;
+            continue;
         }
-        else {
-            inet_aton("255.255.255.255", &si_other.sin_addr);
-        } 
+        ap_station_ips[num_ap_stations++] = tcpip_sta_list.sta[i].ip.addr;
     }
-    else {
-        /* Fail safe: there are no associated stations, but broadcast something anyway */
-        inet_aton("255.255.255.255", &si_other.sin_addr);
+    if (!all_leased) {
+        ap_stations_stale = true;
     }
+    PORT_LOGDEBUG(TAG, "%i soft-AP stations with an address%s", num_ap_stations, all_leased ? "" : ", some without");
+    return all_leased;
+}
 #else
-    /* Form broadcast address */
-    inet_aton("255.255.255.255", &si_other.sin_addr);
+void mist_port_esp32_ap_stations_changed(void) {
+}
 #endif
+
+static void send_advertizement_to(const uint8_t *ad_msg, size_t ad_len, uint32_t ip) {
+    struct sockaddr_in si_other;
+    memset(&si_other, 0, sizeof(si_other));
+    si_other.sin_family = AF_INET;
+    si_other.sin_port = htons(LOCAL_DISCOVERY_UDP_PORT);
+    si_other.sin_addr.s_addr = ip;
     socklen_t addrlen = sizeof(struct sockaddr_in);
     
     if (sendto(wld_bcast_sock, ad_msg, ad_len, 0, 
@@ -391,7 +1122,37 @@ int wish_send_advertizement(wish_core_t* core, uint8_t *ad_msg, size_t ad_len) {
             error(buffer);
         }
     }
+}
+
+void port_net_send_advertizement(const uint8_t *ad_msg, size_t ad_len) {
+#ifdef WLD_SEND_UNICASTS_IN_AP_MODE
+    /* Send the advert as a unicast to each associated station. This improves reliability if you have stations that exhibit high
+     * packet loss of broadcasts (such as Samsung J5). The station list is cached, as reading it takes two calls into the Wi-Fi
+     * driver. */
+    wifi_mode_t current_mode = WIFI_MODE_NULL;
+    ESP_ERROR_CHECK( esp_wifi_get_mode(&current_mode) );
+    if (current_mode == WIFI_MODE_AP) {
+        bool all_leased = true;
+        if (ap_stations_stale) {
+            all_leased = refresh_ap_stations();
+        }
+        for (int i = 0; i < num_ap_stations; i++) {
+            send_advertizement_to(ad_msg, ad_len, ap_station_ips[i]);
+        }
+        if (num_ap_stations > 0 && all_leased) {
+            return;
+        }
+        /* Fail safe: there are no associated stations, or a station is still getting its lease, so broadcast too */
+    }
+#endif
+    send_advertizement_to(ad_msg, ad_len, htonl(INADDR_BROADCAST));
+}
 
+int wish_send_advertizement(wish_core_t* core, uint8_t *ad_msg, size_t ad_len) {
+    /* The adverts are sent on the schedule of port_advert */
+    if (!port_advert_offer(ad_msg, ad_len)) {
+        port_net_send_advertizement(ad_msg, ad_len);
+    }
     return 0;
 }
 
@@ -447,60 +1208,193 @@ void wish_set_host_port(wish_core_t* core, uint16_t port) {
     core->wish_server_port = port;
 }
 
-/** In write_to_socket(), if write to socket return EAGAIN, then retry after this many millisconds */
-#define EAGAIN_RETRY_DELAY (1000)
-/** In write_to_socket(), allow this many retries */
-static const int max_tcp_eagain_retries = 40;
+/* Write as much of vec as the socket takes without blocking. vec is advanced past what was written.
+ * Returns the number of bytes written, or -1 if the connection failed. */
+static int writev_nonblocking(int sockfd, struct iovec *vec, int cnt) {
+    int total = 0;
+    while (cnt > 0) {
+        ssize_t ret = writev(sockfd, vec, cnt);
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            /* Socket send buffer full */
+            break;
+        }
+        else if (ret == 0) {
+            /* Connection has been closed? */
+            PORT_LOGERR(TAG, "writev fd %i: returned 0, closing connection", sockfd);
+            return -1;
+        }
+        else if (ret < 0) {
+            PORT_LOGERR(TAG, "writev fd %i unrecoverable error: %s (errno=%i), closing connection", sockfd, strerror(errno), errno);
+            return -1;
+        }
+        total += ret;
+        while (cnt > 0 && (size_t) ret >= vec->iov_len) {
+            ret -= vec->iov_len;
+            vec++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            vec->iov_base = (uint8_t *) vec->iov_base + ret;
+            vec->iov_len -= ret;
+        }
+    }
+    return total;
+}
 
-int write_to_socket(wish_connection_t* conn, unsigned char* buffer, int len) {
-    int retval = 0;
-    int sockfd = *((int *) conn->send_arg);
-    
-    int write_ret = 0;
-    int total_sent = 0;
-    int remaining_len = len;
+/* Queue pieces of data, skipping the first skip bytes. Returns 0, or -1 if the outbound queue overflowed. */
+static int queue_iov(struct port_conn *pc, const struct iovec *iov, int iovcnt, size_t skip) {
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+    if (port_outq_len(&pc->outq) + len - skip > MIST_PORT_OUTQ_MAX_BYTES) {
+        return -1;
+    }
+    for (int i = 0; i < iovcnt; i++) {
+        if (skip >= iov[i].iov_len) {
+            skip -= iov[i].iov_len;
+            continue;
+        }
+        if (port_outq_push(&pc->outq, (const uint8_t *) iov[i].iov_base + skip, iov[i].iov_len - skip, MIST_PORT_OUTQ_MAX_BYTES) != 0) {
+            return -1;
+        }
+        skip = 0;
+    }
+    return 0;
+}
 
-    int retry_cnt = 0;
-    
-    while (total_sent < len) {
-        write_ret = write(sockfd, buffer+total_sent, remaining_len);
-        if (write_ret < 0) {
-            /* socket write error */
-            if (errno == EAGAIN && retry_cnt < max_tcp_eagain_retries) {
-                /* Buffer was totally full */
-                PORT_LOGWARN(TAG, "write_to_socket fd %i errno: %s (errno=%i) retry %i / %i", sockfd, strerror(errno), errno, retry_cnt, max_tcp_eagain_retries );
-                vTaskDelay(EAGAIN_RETRY_DELAY / portTICK_PERIOD_MS);
-                retry_cnt++;
-            }
-            else if (errno == EAGAIN && retry_cnt >= max_tcp_eagain_retries) {
-                PORT_LOGERR(TAG, "write_to_socket fd %i successive errno: %s (errno=%i), tried %i, closing connection", sockfd, strerror(errno), errno, retry_cnt);
-                wish_close_connection(core, conn);
-                break;
+int port_net_writev(wish_connection_t *conn, const struct iovec *iov, int iovcnt) {
+    int sockfd = port_net_conn_fd(conn);
+    struct port_conn *pc = get_conn(conn);
+
+    if (sockfd < 0) {
+        PORT_LOGERR(TAG, "port_net_writev: connection has no socket");
+        return 0;
+    }
+    if (iovcnt < 0 || iovcnt > MIST_PORT_MAX_IOV) {
+        PORT_LOGERR(TAG, "port_net_writev: bad iovcnt %i", iovcnt);
+        return -1;
+    }
+
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+
+    if (corking && pc->state == PORT_CONN_OPEN && (len >= MIST_PORT_BULK_FRAME_BYTES || pc->bulk_backlog)) {
+        /* Bulk data waits for port_net_uncork(), so that it does not delay the small writes, such as invoke replies, of this and the
+         * other connections during this iteration. The frames of one connection are not reordered, as the peer expects them in order. */
+        if (pc->corked) {
+            flush_outq(conn);
+            if (port_net_conn_fd(conn) < 0) {
+                return 0;
             }
-            else {
-                PORT_LOGERR(TAG, "write_to_socket fd %i unrecoverable error: %s (errno=%i), tried %i times, closing connection", sockfd, strerror(errno), errno, retry_cnt);
-                wish_close_connection(core, conn);
-                break;
+        }
+        if (port_outq_len(&pc->outq) + len > MIST_PORT_OUTQ_MAX_BYTES && !pc->tx_blocked) {
+            /* Make room by writing what the socket takes now, ahead of the scheduler */
+            if (write_outq(conn, SIZE_MAX) < 0) {
+                return 0;
             }
         }
-        else if (write_ret == 0) {
-            /* Connection has been closed? */
-            PORT_LOGERR(TAG, "write_to_socket fd %i: write_ret == 0, closing connection", sockfd);
+        if (queue_iov(pc, iov, iovcnt, 0) != 0) {
+            PORT_LOGERR(TAG, "port_net_writev fd %i: outbound queue full (%i bytes queued), closing connection", sockfd, 
+                    (int) port_outq_len(&pc->outq));
             wish_close_connection(core, conn);
-            break;
+            return 0;
         }
-        else {
-            /* Something was written to socket */
-            
-            if (write_ret != remaining_len) {
-                /* We could write something, but not all. */
-                PORT_LOGWARN(TAG, "write_to_socket partial write %i bytes of remaining %i bytes!\n", write_ret, remaining_len);
+        if (!pc->bulk_backlog) {
+            pc->bulk_backlog = true;
+            num_bulk_backlogged++;
+        }
+        if (port_outq_len(&pc->outq) >= MIST_PORT_OUTQ_HIGH_WATER) {
+            pc->tx_backpressure = true;
+        }
+        update_interest(conn);
+        return 0;
+    }
+
+    if (corking && pc->state == PORT_CONN_OPEN && port_outq_len(&pc->outq) + len < MIST_PORT_CORK_BYTES) {
+        /* Hold small writes until the end of the main loop iteration, so that they go out in one segment */
+        if (queue_iov(pc, iov, iovcnt, 0) != 0) {
+            PORT_LOGERR(TAG, "port_net_writev fd %i: out of memory, closing connection", sockfd);
+            wish_close_connection(core, conn);
+            return 0;
+        }
+        if (!pc->corked) {
+            pc->corked = true;
+            pc->corked_at = port_latency_now();
+            num_corked++;
+        }
+        else if (port_latency_now() - pc->corked_at >= MIST_PORT_CORK_MAX_DELAY_US) {
+            flush_outq(conn);
+        }
+        return 0;
+    }
+
+    size_t queued = port_outq_len(&pc->outq);
+    size_t sent = 0;
+
+    /* Write the corked data and this data with one call. If data is queued because the socket was full, it is left for the writable
+     * event, so that the data stays in order. */
+    if (queued == 0 || pc->corked) {
+        struct iovec vec[MIST_PORT_MAX_IOV + 1];
+        int cnt = 0;
+        if (queued > 0) {
+            vec[cnt].iov_base = (void *) port_outq_data(&pc->outq);
+            vec[cnt].iov_len = queued;
+            cnt++;
+        }
+        for (int i = 0; i < iovcnt; i++) {
+            if (iov[i].iov_len > 0) {
+                vec[cnt++] = iov[i];
             }
-            total_sent += write_ret;
-            remaining_len-=write_ret;
-            retry_cnt = 0; //Again, allow the max retries if EAGAIN is returned after this, since we succeeded in writing something.
+        }
+        int ret = writev_nonblocking(sockfd, vec, cnt);
+        if (ret < 0) {
+            wish_close_connection(core, conn);
+            return 0;
+        }
+        sent = ret;
+        count_tx(pc, sent);
+        pc->tx_blocked = sent < queued + len;
+    }
+    if (pc->corked) {
+        pc->corked = false;
+        num_corked--;
+    }
+
+    if (sent >= queued) {
+        port_outq_consume(&pc->outq, queued);
+        sent -= queued;
+    }
+    else {
+        port_outq_consume(&pc->outq, sent);
+        sent = 0;
+    }
+
+    if (sent < len) {
+        /* The rest is written when the socket becomes writable. A receiver which cannot keep up costs memory, up to a limit, instead
+         * of blocking the main loop. */
+        if (queue_iov(pc, iov, iovcnt, sent) != 0) {
+            PORT_LOGERR(TAG, "port_net_writev fd %i: outbound queue full (%i bytes queued), closing connection", sockfd, 
+                    (int) port_outq_len(&pc->outq));
+            wish_close_connection(core, conn);
+            return 0;
+        }
+        if (port_outq_len(&pc->outq) >= MIST_PORT_OUTQ_HIGH_WATER) {
+            /* Stop reading from the peer, so that the core does not produce more replies to it, until the queue has drained */
+            pc->tx_backpressure = true;
         }
     }
+    else if (pc->tx_backpressure && port_outq_len(&pc->outq) <= MIST_PORT_OUTQ_LOW_WATER) {
+        pc->tx_backpressure = false;
+    }
+    update_interest(conn);
     
-    return retval;
+    return 0;
+}
+
+int write_to_socket(wish_connection_t* conn, unsigned char* buffer, int len) {
+    struct iovec iov = { .iov_base = buffer, .iov_len = len };
+    return port_net_writev(conn, &iov, 1);
 }
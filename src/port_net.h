@@ -31,6 +31,83 @@
 #include "wish_local_discovery.h"
 #include "wish_identity.h"
 
+#include "port_reactor.h"
+
+#ifdef __linux__
+#include <sys/uio.h>
+#else
+/* struct iovec and writev() come from lwIP, the ESP-IDF socket layer does not map writev() */
+#include "lwip/sockets.h"
+#ifndef writev
+#define writev lwip_writev
+#endif
+#endif
+
+/** The maximum number of pieces in one port_net_writev() call */
+#ifndef MIST_PORT_MAX_IOV
+#define MIST_PORT_MAX_IOV 8
+#endif
+
+/** The maximum number of bytes queued for sending on one Wish connection. A connection whose peer does not read fast enough to stay
+ * within this is closed. */
+#ifndef MIST_PORT_OUTQ_MAX_BYTES
+#define MIST_PORT_OUTQ_MAX_BYTES (2 * WISH_PORT_RPC_BUFFER_SZ)
+#endif
+
+/** When this many bytes are queued for sending on a Wish connection, reading from it is paused, so that the core does not produce
+ * more data for it */
+#ifndef MIST_PORT_OUTQ_HIGH_WATER
+#define MIST_PORT_OUTQ_HIGH_WATER (MIST_PORT_OUTQ_MAX_BYTES / 2)
+#endif
+
+/** Reading from a Wish connection paused by MIST_PORT_OUTQ_HIGH_WATER is resumed when its outbound queue is down to this */
+#ifndef MIST_PORT_OUTQ_LOW_WATER
+#define MIST_PORT_OUTQ_LOW_WATER (MIST_PORT_OUTQ_MAX_BYTES / 8)
+#endif
+
+/** While the port is corked, writes to a Wish connection are collected until this many bytes are pending, and then written in one
+ * go. Set to 0 to disable corking. */
+#ifndef MIST_PORT_CORK_BYTES
+#define MIST_PORT_CORK_BYTES 1024
+#endif
+
+/** The longest time written data is held back by corking, in microseconds */
+#ifndef MIST_PORT_CORK_MAX_DELAY_US
+#define MIST_PORT_CORK_MAX_DELAY_US 2000
+#endif
+
+/** While the port is corked, a write of at least this many bytes to a Wish connection is bulk data, such as a large read or an OTA
+ * transfer. Bulk data is written at the end of the main loop iteration, after the smaller writes of all connections. */
+#ifndef MIST_PORT_BULK_FRAME_BYTES
+#define MIST_PORT_BULK_FRAME_BYTES 512
+#endif
+
+/** The number of bytes of bulk data a connection may write per round when several connections have bulk data to send */
+#ifndef MIST_PORT_DRR_QUANTUM
+#define MIST_PORT_DRR_QUANTUM 1460
+#endif
+
+/** The free space needed in the receive ring buffer of a parked Wish connection before its socket is read again. Resuming only
+ * when a useful amount of data fits avoids parking and resuming the connection for every few bytes. A connection whose ring buffer
+ * holds only the beginning of a frame, which the message processor cannot consume, is resumed with any free space. */
+#ifndef MIST_PORT_RX_RESUME_BYTES
+#define MIST_PORT_RX_RESUME_BYTES (WISH_PORT_RX_RB_SZ / 4)
+#endif
+
+/** Traffic counters of one Wish connection, reset when a socket is attached to the connection */
+struct port_net_conn_stats {
+    /** Bytes received and fed to the core */
+    uint32_t bytes_in;
+    /** Bytes written to the socket */
+    uint32_t bytes_out;
+    /** time_helper_monotonic_us() when the socket was attached */
+    int64_t opened_us;
+    /** time_helper_monotonic_us() of the last received data, 0 if none */
+    int64_t last_rx_us;
+    /** time_helper_monotonic_us() of the last write, 0 if none */
+    int64_t last_tx_us;
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -40,9 +117,127 @@ extern "C" {
     int get_server_fd(void);
     void setup_wish_server(wish_core_t* core);
     int write_to_socket(wish_connection_t* conn, unsigned char* buffer, int len);
+    
+    /**
+     * Send data given in pieces on a Wish connection, for example a frame header, ciphertext and authentication tag, without
+     * concatenating them first. The pieces are written with one writev() call where possible, and queued or corked the same way as
+     * with write_to_socket(), which is a wrapper of this.
+     *
+     * @param iovcnt The number of pieces, at most MIST_PORT_MAX_IOV
+     * @return 0, also when the connection failed and was closed, or -1 if iovcnt is out of range
+     */
+    int port_net_writev(wish_connection_t *conn, const struct iovec *iov, int iovcnt);
     void socket_set_nonblocking(int sockfd);
+    
+    /**
+     * Attach a socket to a Wish connection, and register write_to_socket() as its send function. The port state of the connection,
+     * including the fd, is kept in a static table indexed like core->connection_pool.
+     *
+     * @param connecting true if connect() is in progress on the socket
+     */
+    void port_net_attach(wish_connection_t *ctx, int sockfd, bool connecting);
+    
+    /** Get the socket of a Wish connection, or -1 if it has none */
+    int port_net_conn_fd(wish_connection_t *ctx);
+    
+    /** Count data received on a Wish connection */
+    void port_net_count_rx(wish_connection_t *ctx, size_t len);
+    
+    /** Record the completion of the Wish handshake of connections in their lifecycle traces. Called by the main loop. */
+    void port_net_poll_handshakes(wish_core_t *core);
+    
+    /** Get the traffic counters of a Wish connection */
+    const struct port_net_conn_stats *port_net_conn_stats(wish_connection_t *ctx);
+    
+    /** Start watching a socket for readiness. Use this, instead of port_reactor_register(), so that it also works in dual-core mode. */
+    void port_net_watch(int sockfd, uint8_t interest, enum port_reactor_kind kind, void *cookie);
+    
+    /** Change the readiness interest of a watched socket */
+    void port_net_rewatch(int sockfd, uint8_t interest);
+    
+    /** Stop watching a socket and close it */
+    void port_net_close_socket(int sockfd);
+    
+    /** Signal TCP_DISCONNECTED for connections which could not be opened because no socket could be created. Called by the main loop. */
+    void port_net_signal_failed_opens(wish_core_t *core);
+
+    /**
+     * Park a Wish connection whose receive ring buffer is full: its socket is not watched for readability until
+     * port_net_resume_rx() finds that the message processor has made space in the ring buffer.
+     */
+    void port_net_park_rx(wish_connection_t *ctx);
+    
+    /** Tell that the message processor has handled a WISH_EVENT_NEW_DATA event of the connection. Called by the main loop. */
+    void port_net_rx_processed(wish_connection_t *ctx);
 
-    void read_wish_local_discovery(void);
+    /** Resume reading the parked Wish connections which have space in their receive ring buffer again. Called by the main loop. */
+    void port_net_resume_rx(wish_core_t *core);
+
+    /**
+     * Accept one pending connection on the Wish server socket, and set it non-blocking.
+     * @return The new socket, or -1 if there is no pending connection or accept() failed
+     */
+    int port_net_accept(int server_fd);
+    
+    /** Count an accepted connection, which either got a Wish connection context, or was closed because the pool was full */
+    void port_net_count_accept(bool pool_full);
+    
+    /** Get the number of free Wish connection contexts */
+    int port_net_free_connection_slots(wish_core_t *core);
+
+    /** Check if connect() is in progress on a Wish connection, i.e. a writable socket means that it has completed */
+    bool port_net_conn_is_connecting(wish_connection_t *ctx);
+    
+    /** Write out the outbound queue of a Wish connection, when its socket has become writable */
+    void port_net_flush_outq(wish_connection_t *ctx);
+    
+    /**
+     * Start collecting writes to Wish connections, instead of writing them to the sockets right away. Called by the main loop when it
+     * starts handling the events of one wakeup.
+     */
+    void port_net_cork(void);
+
+    /**
+     * Write out the data collected since port_net_cork(). Called by the main loop at the end of the iteration. The small writes are
+     * written first, and then the queued bulk data of the connections, in deficit round robin, until max_bulk_bytes have been written.
+     *
+     * @return true if bulk data which could be written now was left over
+     */
+    bool port_net_uncork(wish_core_t *core, size_t max_bulk_bytes);
+
+    /** Write out the collected data of the connections which have been corked for longer than MIST_PORT_CORK_MAX_DELAY_US */
+    void port_net_flush_overdue_corks(wish_core_t *core);
+    
+    /** Close the socket of a Wish connection, and release the port state of the connection. Does not signal the core. */
+    void port_net_release_connection(wish_connection_t *ctx);
+
+    /**
+     * Close all Wish connections which have a socket, and signal TCP_DISCONNECTED for them, when the network they were on is gone.
+     * @return The number of connections closed
+     */
+    int port_net_close_all_connections(wish_core_t *core);
+
+    /**
+     * Close the Wish server socket, if the server was set up, and open it again.
+     * @return true for success, false if the socket could not be opened, and the server is not listening
+     */
+    bool port_net_rearm_server(wish_core_t *core);
+
+    /** Close the local discovery sockets, if they were set up, and open them again */
+    void port_net_rearm_local_discovery(void);
+
+    /** Read the adverts waiting in the local discovery socket fd, and feed them to the core */
+    void read_wish_local_discovery(int fd);
+
+    /** Send a local discovery advert now, by broadcast, or in soft-AP mode as a unicast to each station */
+    void port_net_send_advertizement(const uint8_t *ad_msg, size_t ad_len);
+    
+    /**
+     * Receive one datagram from the local discovery socket fd, without feeding it to the core. The fd is the one of the reactor event,
+     * as in dual-core mode the protocol task may already have replaced the socket.
+     * @return The datagram length, or -1 (errno is set)
+     */
+    int port_net_recv_local_discovery(int fd, uint8_t *buf, size_t buf_len, wish_ip_addr_t *ip_addr, uint16_t *port);
     
     void connected_cb(wish_connection_t *ctx);
     void connected_cb_relay(wish_connection_t *ctx);
@@ -0,0 +1,83 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "port_outq.h"
+
+/* The initial buffer size. Most stalls are about one message which did not fit in the socket send buffer, and most corked writes are
+ * short control messages. */
+#define PORT_OUTQ_MIN_CAP 512
+
+int port_outq_push(struct port_outq *q, const uint8_t *data, size_t len, size_t max_len) {
+    if (len > max_len || q->len > max_len - len) {
+        return -1;
+    }
+    size_t needed = q->len + len;
+
+    if (q->head + needed > q->cap) {
+        if (needed <= q->cap) {
+            /* There is room, move the queued data to the front of the buffer */
+            memmove(q->buf, q->buf + q->head, q->len);
+        }
+        else {
+            size_t new_cap = q->cap > 0 ? q->cap : PORT_OUTQ_MIN_CAP;
+            while (new_cap < needed) {
+                new_cap *= 2;
+            }
+            if (new_cap > max_len) {
+                new_cap = max_len;
+            }
+            uint8_t *new_buf = malloc(new_cap);
+            if (new_buf == NULL) {
+                return -1;
+            }
+            if (q->len > 0) {
+                memcpy(new_buf, q->buf + q->head, q->len);
+            }
+            free(q->buf);
+            q->buf = new_buf;
+            q->cap = new_cap;
+        }
+        q->head = 0;
+    }
+
+    memcpy(q->buf + q->head + q->len, data, len);
+    q->len = needed;
+    return 0;
+}
+
+void port_outq_consume(struct port_outq *q, size_t len) {
+    if (len >= q->len) {
+        if (q->cap > PORT_OUTQ_MIN_CAP) {
+            port_outq_clear(q);
+        }
+        else {
+            /* Keep the small buffer, a connection which is written to is likely to be corked again soon */
+            q->head = 0;
+            q->len = 0;
+        }
+        return;
+    }
+    q->head += len;
+    q->len -= len;
+}
+
+void port_outq_clear(struct port_outq *q) {
+    free(q->buf);
+    q->buf = NULL;
+    q->cap = 0;
+    q->head = 0;
+    q->len = 0;
+}
@@ -0,0 +1,62 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file port_outq.h
+ * @brief Bounded outbound byte queue of a connection.
+ *
+ * Data which a socket does not accept right away is queued here, and written when the socket becomes writable again. It is also used
+ * for collecting the small writes of one main loop iteration into one (corking). The buffer is allocated when data is first queued,
+ * and grown as needed up to the limit given to port_outq_push(). A grown buffer is freed when the queue has been emptied, so that
+ * only connections to slow receivers use more than a small buffer for this.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct port_outq {
+    uint8_t *buf;
+    size_t cap;
+    /* The queued data is buf[head] ... buf[head + len - 1] */
+    size_t head;
+    size_t len;
+};
+
+/**
+ * Append data to the queue.
+ *
+ * @param max_len The maximum number of bytes the queue may hold
+ * @return 0 for success, -1 if the data does not fit within max_len or memory could not be allocated. Nothing is queued then.
+ */
+int port_outq_push(struct port_outq *q, const uint8_t *data, size_t len, size_t max_len);
+
+/** The number of queued bytes */
+static inline size_t port_outq_len(const struct port_outq *q) {
+    return q->len;
+}
+
+/** The queued bytes, which are always contiguous */
+static inline const uint8_t *port_outq_data(const struct port_outq *q) {
+    return q->buf + q->head;
+}
+
+/**
+ * Remove bytes from the front of the queue, after they have been written to the socket. The buffer is kept if it has not grown beyond
+ * the initial size.
+ */
+void port_outq_consume(struct port_outq *q, size_t len);
+
+/**
+ * Drop all queued data, and free the buffer.
+ */
+void port_outq_clear(struct port_outq *q);
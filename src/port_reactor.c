@@ -0,0 +1,366 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/epoll.h>
+#endif
+
+#include "port_reactor.h"
+#include "port_log.h"
+
+#define TAG "port_reactor"
+
+struct port_reactor_handle {
+    bool in_use;
+    int fd;
+    uint8_t interest;
+    enum port_reactor_kind kind;
+    void *cookie;
+    uint32_t tag;
+    /* Incremented on every unregister, so that events returned before can be detected as stale */
+    uint16_t gen;
+    /* Position of this handle in the active list */
+    int active_pos;
+};
+
+/* The handle slots. The slot index of a handle does not change while it is registered. */
+static struct port_reactor_handle handles[PORT_REACTOR_MAX_HANDLES];
+
+/* Dense list of the slot indexes of registered handles, so that we never need to walk the free slots */
+static uint16_t active[PORT_REACTOR_MAX_HANDLES];
+static int num_active = 0;
+
+static int find_slot(int fd) {
+    for (int i = 0; i < num_active; i++) {
+        if (handles[active[i]].fd == fd) {
+            return active[i];
+        }
+    }
+    return -1;
+}
+
+static int alloc_slot(void) {
+    for (int i = 0; i < PORT_REACTOR_MAX_HANDLES; i++) {
+        if (!handles[i].in_use) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+#ifdef __linux__
+
+/* Linux host build backend: epoll, level triggered so that the semantics are the same as with select() */
+
+static int epoll_fd = -1;
+
+static uint32_t to_epoll_events(uint8_t interest) {
+    uint32_t ev = 0;
+    if (interest & PORT_REACTOR_READ) {
+        ev |= EPOLLIN;
+    }
+    if (interest & PORT_REACTOR_WRITE) {
+        ev |= EPOLLOUT;
+    }
+    return ev;
+}
+
+static void backend_init(void) {
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+    }
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) {
+        PORT_LOGERR(TAG, "epoll_create1: %s", strerror(errno));
+        PORT_ABORT();
+    }
+}
+
+/* A socket with no interest, such as a parked connection, is not in the epoll set at all: epoll reports EPOLLHUP and EPOLLERR also
+ * without being asked, and the main loop would spin on events which nobody handles */
+
+static int backend_add(int slot) {
+    if (handles[slot].interest == 0) {
+        return 0;
+    }
+    struct epoll_event ev = { .events = to_epoll_events(handles[slot].interest), .data.u32 = slot };
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, handles[slot].fd, &ev);
+}
+
+static int backend_modify(int slot, uint8_t old_interest) {
+    struct epoll_event ev = { .events = to_epoll_events(handles[slot].interest), .data.u32 = slot };
+    if (old_interest == 0) {
+        return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, handles[slot].fd, &ev);
+    }
+    if (handles[slot].interest == 0) {
+        return epoll_ctl(epoll_fd, EPOLL_CTL_DEL, handles[slot].fd, &ev);
+    }
+    return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, handles[slot].fd, &ev);
+}
+
+static void backend_remove(int slot) {
+    if (handles[slot].interest == 0) {
+        return;
+    }
+    struct epoll_event ev = { 0 };
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, handles[slot].fd, &ev);
+}
+
+static int backend_wait(unsigned int timeout_ms, struct port_reactor_event *events, int max_events) {
+    struct epoll_event ready[PORT_REACTOR_MAX_HANDLES];
+    if (max_events > PORT_REACTOR_MAX_HANDLES) {
+        max_events = PORT_REACTOR_MAX_HANDLES;
+    }
+    int n = epoll_wait(epoll_fd, ready, max_events, timeout_ms);
+    if (n < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        struct port_reactor_handle *h = &handles[ready[i].data.u32];
+        uint8_t flags = 0;
+        /* Errors and hang-ups are reported to whatever the socket is waiting for, the handler will then find out the error from read() or SO_ERROR */
+        if (ready[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+            flags |= h->interest & PORT_REACTOR_READ;
+        }
+        if (ready[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+            flags |= h->interest & PORT_REACTOR_WRITE;
+        }
+        events[i].fd = h->fd;
+        events[i].events = flags;
+        events[i].kind = h->kind;
+        events[i].cookie = h->cookie;
+        events[i].tag = h->tag;
+        events[i].slot = ready[i].data.u32;
+        events[i].gen = h->gen;
+    }
+    return n;
+}
+
+#else
+
+/* lwIP backend: select() with persistent fd_sets, which are updated only when sockets are (un)registered or their interest changes */
+
+static fd_set master_rfds;
+static fd_set master_wfds;
+static int max_fd = 0;
+
+static void update_max_fd(void) {
+    max_fd = 0;
+    for (int i = 0; i < num_active; i++) {
+        if (handles[active[i]].fd >= max_fd) {
+            max_fd = handles[active[i]].fd + 1;
+        }
+    }
+}
+
+static void backend_init(void) {
+    FD_ZERO(&master_rfds);
+    FD_ZERO(&master_wfds);
+    max_fd = 0;
+}
+
+static void apply_interest(int fd, uint8_t interest) {
+    if (interest & PORT_REACTOR_READ) {
+        FD_SET(fd, &master_rfds);
+    }
+    else {
+        FD_CLR(fd, &master_rfds);
+    }
+    if (interest & PORT_REACTOR_WRITE) {
+        FD_SET(fd, &master_wfds);
+    }
+    else {
+        FD_CLR(fd, &master_wfds);
+    }
+}
+
+static int backend_add(int slot) {
+    int fd = handles[slot].fd;
+    if (fd < 0 || fd >= FD_SETSIZE) {
+        errno = EBADF;
+        return -1;
+    }
+    apply_interest(fd, handles[slot].interest);
+    if (fd >= max_fd) {
+        max_fd = fd + 1;
+    }
+    return 0;
+}
+
+static int backend_modify(int slot, uint8_t old_interest) {
+    (void) old_interest;
+    apply_interest(handles[slot].fd, handles[slot].interest);
+    return 0;
+}
+
+static void backend_remove(int slot) {
+    /* Note: called after the handle has been removed from the active list */
+    apply_interest(handles[slot].fd, 0);
+    if (handles[slot].fd + 1 == max_fd) {
+        update_max_fd();
+    }
+}
+
+static int backend_wait(unsigned int timeout_ms, struct port_reactor_event *events, int max_events) {
+    fd_set rfds = master_rfds;
+    fd_set wfds = master_wfds;
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+    int select_ret = select(max_fd, &rfds, &wfds, NULL, &tv);
+    if (select_ret <= 0) {
+        /* Zero fds ready means we timed out */
+        return select_ret;
+    }
+
+    /* Only the registered handles are examined, not the whole fd range */
+    int n = 0;
+    for (int i = 0; i < num_active && n < max_events; i++) {
+        int slot = active[i];
+        struct port_reactor_handle *h = &handles[slot];
+        uint8_t flags = 0;
+        if (FD_ISSET(h->fd, &rfds)) {
+            flags |= PORT_REACTOR_READ;
+        }
+        if (FD_ISSET(h->fd, &wfds)) {
+            flags |= PORT_REACTOR_WRITE;
+        }
+        if (flags == 0) {
+            continue;
+        }
+        events[n].fd = h->fd;
+        events[n].events = flags;
+        events[n].kind = h->kind;
+        events[n].cookie = h->cookie;
+        events[n].tag = h->tag;
+        events[n].slot = slot;
+        events[n].gen = h->gen;
+        n++;
+    }
+    return n;
+}
+
+#endif //__linux__
+
+void port_reactor_init(void) {
+    memset(handles, 0, sizeof(handles));
+    num_active = 0;
+    backend_init();
+}
+
+int port_reactor_register(int fd, uint8_t interest, enum port_reactor_kind kind, void *cookie) {
+    if (fd < 0) {
+        PORT_LOGERR(TAG, "Refusing to register fd %i", fd);
+        return -1;
+    }
+    if (find_slot(fd) >= 0) {
+        PORT_LOGERR(TAG, "fd %i is already registered", fd);
+        return -1;
+    }
+    int slot = alloc_slot();
+    if (slot < 0) {
+        PORT_LOGERR(TAG, "No free reactor handles for fd %i", fd);
+        return -1;
+    }
+
+    struct port_reactor_handle *h = &handles[slot];
+    h->fd = fd;
+    h->interest = interest;
+    h->kind = kind;
+    h->cookie = cookie;
+    h->tag = 0;
+    if (backend_add(slot) != 0) {
+        PORT_LOGERR(TAG, "Could not register fd %i: %s", fd, strerror(errno));
+        return -1;
+    }
+    h->in_use = true;
+    h->active_pos = num_active;
+    active[num_active++] = slot;
+    return 0;
+}
+
+int port_reactor_modify(int fd, uint8_t interest) {
+    int slot = find_slot(fd);
+    if (slot < 0) {
+        return -1;
+    }
+    uint8_t old_interest = handles[slot].interest;
+    if (old_interest == interest) {
+        return 0;
+    }
+    handles[slot].interest = interest;
+    if (backend_modify(slot, old_interest) != 0) {
+        PORT_LOGERR(TAG, "Could not modify fd %i: %s", fd, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int port_reactor_get_interest(int fd) {
+    int slot = find_slot(fd);
+    if (slot < 0) {
+        return -1;
+    }
+    return handles[slot].interest;
+}
+
+int port_reactor_set_tag(int fd, uint32_t tag) {
+    int slot = find_slot(fd);
+    if (slot < 0) {
+        return -1;
+    }
+    handles[slot].tag = tag;
+    return 0;
+}
+
+void port_reactor_unregister(int fd) {
+    int slot = find_slot(fd);
+    if (slot < 0) {
+        return;
+    }
+    struct port_reactor_handle *h = &handles[slot];
+
+    /* Remove from the active list by moving the last element in its place */
+    int pos = h->active_pos;
+    num_active--;
+    if (pos != num_active) {
+        active[pos] = active[num_active];
+        handles[active[pos]].active_pos = pos;
+    }
+
+    backend_remove(slot);
+    h->in_use = false;
+    h->gen++;
+}
+
+int port_reactor_wait(unsigned int timeout_ms, struct port_reactor_event *events, int max_events) {
+    return backend_wait(timeout_ms, events, max_events);
+}
+
+bool port_reactor_event_is_stale(const struct port_reactor_event *ev) {
+    const struct port_reactor_handle *h = &handles[ev->slot];
+    return !h->in_use || h->gen != ev->gen;
+}
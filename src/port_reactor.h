@@ -0,0 +1,129 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file port_reactor.h
+ * @brief Socket readiness reactor of the port layer.
+ *
+ * Sockets are registered once, when they are created, together with the interest (readable and/or writable) and a kind + cookie
+ * which tells the main loop what the socket belongs to. When the socket is closed, it is unregistered. port_reactor_wait() then
+ * returns only the handles which became ready, so that the cost of one main loop iteration depends on socket activity, not on the
+ * size of the Wish connection pool.
+ *
+ * There are two backends: on the ESP32 (lwIP) the reactor maintains persistent fd_sets and a dense list of registered handles for
+ * select(), and on a Linux host build epoll is used.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "wish_port_config.h"
+
+/** Interest and readiness flag: the socket is readable (or has a pending incoming connection) */
+#define PORT_REACTOR_READ   (1 << 0)
+/** Interest and readiness flag: the socket is writable (or a pending connect() has completed) */
+#define PORT_REACTOR_WRITE  (1 << 1)
+
+/** The maximum number of simultaneously registered sockets: all Wish connections, the server, local discovery, the wakeup channel and
+ * relay control sockets */
+#ifndef PORT_REACTOR_MAX_HANDLES
+#define PORT_REACTOR_MAX_HANDLES (WISH_PORT_CONTEXT_POOL_SZ + 5)
+#endif
+
+/** What a registered socket belongs to. This determines how the main loop dispatches a ready event. */
+enum port_reactor_kind {
+    /** The Wish TCP server socket, cookie is NULL */
+    PORT_REACTOR_KIND_SERVER,
+    /** The Wish local discovery UDP socket, cookie is NULL */
+    PORT_REACTOR_KIND_WLD,
+    /** A relay control connection, cookie is the wish_relay_client_t */
+    PORT_REACTOR_KIND_RELAY,
+    /** A Wish connection, cookie is the wish_connection_t */
+    PORT_REACTOR_KIND_WISH_CONN,
+    /** The wakeup channel, see port_wakeup.h, cookie is NULL */
+    PORT_REACTOR_KIND_WAKEUP,
+};
+
+/** A ready event, as returned by port_reactor_wait() */
+struct port_reactor_event {
+    int fd;
+    /** PORT_REACTOR_READ and/or PORT_REACTOR_WRITE */
+    uint8_t events;
+    enum port_reactor_kind kind;
+    void *cookie;
+    /** The tag set with port_reactor_set_tag(), 0 by default */
+    uint32_t tag;
+    /* Internal: used for detecting events which have become stale during dispatch */
+    uint16_t slot;
+    uint16_t gen;
+};
+
+/**
+ * Initialise the reactor. Must be called before any socket is registered.
+ */
+void port_reactor_init(void);
+
+/**
+ * Register a socket to the reactor.
+ *
+ * @param fd The socket
+ * @param interest PORT_REACTOR_READ and/or PORT_REACTOR_WRITE
+ * @param kind What the socket belongs to
+ * @param cookie Opaque pointer which is returned with the ready events of this socket
+ * @return 0 for success, -1 if the socket could not be registered
+ */
+int port_reactor_register(int fd, uint8_t interest, enum port_reactor_kind kind, void *cookie);
+
+/**
+ * Change the interest of a registered socket, for example from writable to readable when a pending connect() completes.
+ *
+ * @return 0 for success, -1 if the socket is not registered
+ */
+int port_reactor_modify(int fd, uint8_t interest);
+
+/**
+ * Get the interest of a registered socket.
+ *
+ * @return PORT_REACTOR_READ and/or PORT_REACTOR_WRITE, or -1 if the socket is not registered
+ */
+int port_reactor_get_interest(int fd);
+
+/**
+ * Attach an opaque tag to a registered socket. The tag is returned with the ready events of the socket.
+ *
+ * @return 0 for success, -1 if the socket is not registered
+ */
+int port_reactor_set_tag(int fd, uint32_t tag);
+
+/**
+ * Unregister a socket. This must be done before the socket is closed. Unregistering a socket that is not registered is harmless.
+ */
+void port_reactor_unregister(int fd);
+
+/**
+ * Wait for registered sockets to become ready.
+ *
+ * @param timeout_ms The maximum time to block, 0 returns immediately
+ * @param events The array where ready events are stored
+ * @param max_events The length of the events array
+ * @return The number of ready events (0 on timeout), or -1 on error (errno is set)
+ */
+int port_reactor_wait(unsigned int timeout_ms, struct port_reactor_event *events, int max_events);
+
+/**
+ * Check if an event has become stale after it was returned by port_reactor_wait(), i.e. the socket was unregistered (and perhaps
+ * another socket was registered with the same fd) while dispatching earlier events of the same batch.
+ *
+ * @return true if the event must not be dispatched
+ */
+bool port_reactor_event_is_stale(const struct port_reactor_event *ev);
@@ -13,3 +13,12 @@
 
 void port_relay_client_open(wish_core_t *core, wish_relay_client_t* relay, wish_ip_addr_t *ip);
 
+/**
+ * Close the relay control connections which have a socket. They are reconnected by the relay client as usual, or right away by
+ * port_relay_client_reconnect_all().
+ * @return The number of connections closed
+ */
+int port_relay_client_close_all(wish_core_t *core);
+
+/** Connect the relay control connections which are waiting to reconnect, without waiting for the reconnect timer */
+void port_relay_client_reconnect_all(wish_core_t *core);
@@ -81,18 +81,8 @@ void port_service_ipc_task(void) {
 }
 
 bool port_service_ipc_task_has_more(void) {
-    struct ipc_event *elt;
-    int queue_len = 0;
-    LL_COUNT(ipc_event_queue, elt, queue_len);
-    
-    if ( queue_len > 0) {
-        /* Continue processing the event queue */
-        return true;
-    }
-    else {
-        //printf("IPC event queue is empty!\n");
-        return false;
-    }
+    /* Continue processing the event queue if it is not empty */
+    return ipc_event_queue != NULL;
 }
 
 void core_service_ipc_init(wish_core_t* wish_core) {
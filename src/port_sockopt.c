@@ -0,0 +1,104 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#ifdef __linux__
+#include <netinet/tcp.h>
+#else
+#include "lwip/sockets.h"
+#endif
+
+#include "port_sockopt.h"
+#include "port_main.h"
+#include "port_log.h"
+
+#define TAG "port_sockopt"
+
+#define DEFAULT_WISH_PROFILE { \
+        .nodelay = true, \
+        .keepalive = true, \
+        .keepidle_s = MIST_PORT_TCP_KEEPIDLE_S, \
+        .keepintvl_s = MIST_PORT_TCP_KEEPINTVL_S, \
+        .keepcnt = MIST_PORT_TCP_KEEPCNT, \
+    }
+
+static struct mist_port_esp32_socket_profile profiles[MIST_PORT_SOCKET_NUM_ROLES] = {
+    [MIST_PORT_SOCKET_DIRECT] = DEFAULT_WISH_PROFILE,
+    [MIST_PORT_SOCKET_RELAYED] = DEFAULT_WISH_PROFILE,
+    [MIST_PORT_SOCKET_INBOUND] = DEFAULT_WISH_PROFILE,
+    /* The relay server sends a short message when a session is to be opened, and the control connection is otherwise idle. The
+     * relay client itself notices a dead server by its own timeout, keepalive just makes it sooner. */
+    [MIST_PORT_SOCKET_RELAY_CONTROL] = DEFAULT_WISH_PROFILE,
+};
+
+void mist_port_esp32_set_socket_profile(enum mist_port_esp32_socket_role role, const struct mist_port_esp32_socket_profile *profile) {
+    if (role >= MIST_PORT_SOCKET_NUM_ROLES) {
+        return;
+    }
+    profiles[role] = *profile;
+}
+
+void mist_port_esp32_get_socket_profile(enum mist_port_esp32_socket_role role, struct mist_port_esp32_socket_profile *profile) {
+    if (role >= MIST_PORT_SOCKET_NUM_ROLES) {
+        return;
+    }
+    *profile = profiles[role];
+}
+
+static void set_int_option(int sockfd, int level, int option, int value, const char *name) {
+    if (setsockopt(sockfd, level, option, &value, sizeof(value)) != 0) {
+        /* Typically an option which is disabled in the lwIP configuration, such as SO_SNDBUF */
+        PORT_LOGDEBUG(TAG, "fd %i: could not set %s to %i: %s", sockfd, name, value, strerror(errno));
+    }
+}
+
+void port_sockopt_apply(int sockfd, enum mist_port_esp32_socket_role role) {
+    if (role >= MIST_PORT_SOCKET_NUM_ROLES) {
+        return;
+    }
+    const struct mist_port_esp32_socket_profile *profile = &profiles[role];
+
+    if (profile->nodelay) {
+        set_int_option(sockfd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    }
+    if (profile->keepalive) {
+        set_int_option(sockfd, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+#ifdef TCP_KEEPIDLE
+        if (profile->keepidle_s > 0) {
+            set_int_option(sockfd, IPPROTO_TCP, TCP_KEEPIDLE, profile->keepidle_s, "TCP_KEEPIDLE");
+        }
+#endif
+#ifdef TCP_KEEPINTVL
+        if (profile->keepintvl_s > 0) {
+            set_int_option(sockfd, IPPROTO_TCP, TCP_KEEPINTVL, profile->keepintvl_s, "TCP_KEEPINTVL");
+        }
+#endif
+#ifdef TCP_KEEPCNT
+        if (profile->keepcnt > 0) {
+            set_int_option(sockfd, IPPROTO_TCP, TCP_KEEPCNT, profile->keepcnt, "TCP_KEEPCNT");
+        }
+#endif
+    }
+    if (profile->sndbuf > 0) {
+        set_int_option(sockfd, SOL_SOCKET, SO_SNDBUF, profile->sndbuf, "SO_SNDBUF");
+    }
+    if (profile->rcvbuf > 0) {
+        set_int_option(sockfd, SOL_SOCKET, SO_RCVBUF, profile->rcvbuf, "SO_RCVBUF");
+    }
+}
@@ -0,0 +1,28 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file port_sockopt.h
+ * @brief Socket option profiles of the TCP sockets of the port.
+ *
+ * Each role of socket (direct, relayed and inbound Wish connections, and the relay control connection) has a profile of TCP_NODELAY,
+ * keepalive and buffer size options, which is applied when a socket of that role is created or accepted. The profiles are set with
+ * mist_port_esp32_set_socket_profile(), see port_main.h.
+ */
+
+#include "port_main.h"
+
+/**
+ * Apply the profile of a role to a socket. Failures are logged, and do not prevent using the socket.
+ */
+void port_sockopt_apply(int sockfd, enum mist_port_esp32_socket_role role);
@@ -0,0 +1,62 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "port_spsc_ring.h"
+
+int port_spsc_ring_init(struct port_spsc_ring *ring, void *storage, size_t elem_size, uint32_t capacity) {
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        return -1;
+    }
+    ring->storage = storage;
+    ring->elem_size = elem_size;
+    ring->capacity = capacity;
+    ring->head = 0;
+    ring->tail = 0;
+    return 0;
+}
+
+void *port_spsc_ring_producer_slot(struct port_spsc_ring *ring) {
+    uint32_t head = ring->head;
+    /* Acquire: the consumer must be done with the element before we overwrite it */
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= ring->capacity) {
+        return NULL;
+    }
+    return ring->storage + (head & (ring->capacity - 1)) * ring->elem_size;
+}
+
+void port_spsc_ring_produce(struct port_spsc_ring *ring) {
+    /* Release: the element contents become visible before the new head */
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+void *port_spsc_ring_consumer_peek(struct port_spsc_ring *ring) {
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        return NULL;
+    }
+    return ring->storage + (tail & (ring->capacity - 1)) * ring->elem_size;
+}
+
+void port_spsc_ring_consume(struct port_spsc_ring *ring) {
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+uint32_t port_spsc_ring_count(struct port_spsc_ring *ring) {
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    return head - tail;
+}
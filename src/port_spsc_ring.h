@@ -0,0 +1,74 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file port_spsc_ring.h
+ * @brief Lock-free single-producer/single-consumer ring of fixed-size elements.
+ *
+ * Exactly one task may produce and exactly one task may consume. The producer writes directly into the element returned by
+ * port_spsc_ring_producer_slot() and publishes it with port_spsc_ring_produce(), so that data can be read from a socket straight
+ * into the ring. Likewise the consumer processes the element in place, and releases it with port_spsc_ring_consume().
+ *
+ * The implementation depends only on the GCC atomic builtins, not on FreeRTOS, so it can be exercised with pthreads on Linux.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct port_spsc_ring {
+    uint8_t *storage;
+    size_t elem_size;
+    /* Number of elements, a power of two */
+    uint32_t capacity;
+    /* Free-running counters. Head is written only by the producer, tail only by the consumer. */
+    uint32_t head;
+    uint32_t tail;
+};
+
+/**
+ * Initialise a ring.
+ *
+ * @param ring The ring
+ * @param storage Memory for capacity * elem_size bytes
+ * @param elem_size The size of one element. Should be a multiple of the alignment the elements need.
+ * @param capacity The number of elements. Must be a power of two.
+ * @return 0 for success, -1 if capacity is not a power of two
+ */
+int port_spsc_ring_init(struct port_spsc_ring *ring, void *storage, size_t elem_size, uint32_t capacity);
+
+/**
+ * Producer: get the next free element, or NULL if the ring is full. The element is not visible to the consumer before
+ * port_spsc_ring_produce() is called. Calling this again before producing returns the same element.
+ */
+void *port_spsc_ring_producer_slot(struct port_spsc_ring *ring);
+
+/**
+ * Producer: publish the element obtained with port_spsc_ring_producer_slot().
+ */
+void port_spsc_ring_produce(struct port_spsc_ring *ring);
+
+/**
+ * Consumer: get the oldest published element, or NULL if the ring is empty.
+ */
+void *port_spsc_ring_consumer_peek(struct port_spsc_ring *ring);
+
+/**
+ * Consumer: release the element obtained with port_spsc_ring_consumer_peek().
+ */
+void port_spsc_ring_consume(struct port_spsc_ring *ring);
+
+/**
+ * Get the number of published elements. Exact only when called by the producer or the consumer.
+ */
+uint32_t port_spsc_ring_count(struct port_spsc_ring *ring);
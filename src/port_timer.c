@@ -0,0 +1,248 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "utlist.h"
+
+#include "port_timer.h"
+#include "time_helper.h"
+#include "port_log.h"
+
+#define TAG "port_timer"
+
+/*
+ * The wheel has three levels. Level 0 has one slot per tick, and holds the timers expiring within the next 256 ticks (2.56 s with
+ * the default 10 ms tick). Level 1 slots span 256 ticks each, and level 2 slots span 64 level 1 slots each. When level 0 wraps
+ * around, the next level 1 slot is cascaded down, and so on. Timers further away than level 2 can hold (2.9 hours) are parked in
+ * the last level 2 slot, and are re-inserted when it cascades.
+ */
+#define LVL0_BITS 8
+#define LVLN_BITS 6
+#define LVL0_SIZE (1 << LVL0_BITS)
+#define LVLN_SIZE (1 << LVLN_BITS)
+#define LVL0_MASK (LVL0_SIZE - 1)
+#define LVLN_MASK (LVLN_SIZE - 1)
+#define LVL1_SHIFT LVL0_BITS
+#define LVL2_SHIFT (LVL0_BITS + LVLN_BITS)
+#define MAX_TIMEOUT_TICKS ((1UL << (LVL0_BITS + 2 * LVLN_BITS)) - 1)
+
+static port_timer_t *lvl0[LVL0_SIZE];
+static port_timer_t *lvl1[LVLN_SIZE];
+static port_timer_t *lvl2[LVLN_SIZE];
+
+/* The expired timers which are being run by port_timer_run() */
+static port_timer_t *expired;
+
+/* The next tick to be processed by the wheel */
+static uint32_t wheel_ticks;
+
+static uint32_t now_ticks(void) {
+    /* Computed from the 64-bit microsecond clock, so that the tick counter wraps around only at 2^32 ticks */
+    return (uint32_t) (time_helper_monotonic_us() / (PORT_TIMER_TICK_MS * 1000));
+}
+
+/* Wrap-around safe comparison of tick values */
+static bool ticks_before(uint32_t a, uint32_t b) {
+    return (int32_t) (a - b) < 0;
+}
+
+static void list_add(port_timer_t **list, port_timer_t *timer) {
+    DL_APPEND(*list, timer);
+    timer->list = list;
+}
+
+static void list_remove(port_timer_t *timer) {
+    DL_DELETE(*(timer->list), timer);
+    timer->list = NULL;
+}
+
+static void wheel_add(port_timer_t *timer) {
+    uint32_t expires = timer->expires;
+    uint32_t delta = expires - wheel_ticks;
+    port_timer_t **list;
+
+    if (ticks_before(expires, wheel_ticks)) {
+        /* Already expired: run it on the next processed tick */
+        list = &lvl0[wheel_ticks & LVL0_MASK];
+    }
+    else if (delta < LVL0_SIZE) {
+        list = &lvl0[expires & LVL0_MASK];
+    }
+    else if (delta < (1UL << LVL2_SHIFT)) {
+        list = &lvl1[(expires >> LVL1_SHIFT) & LVLN_MASK];
+    }
+    else {
+        if (delta > MAX_TIMEOUT_TICKS) {
+            expires = wheel_ticks + MAX_TIMEOUT_TICKS;
+        }
+        list = &lvl2[(expires >> LVL2_SHIFT) & LVLN_MASK];
+    }
+    list_add(list, timer);
+}
+
+/* Move the timers of one higher level slot to the levels below */
+static void cascade(port_timer_t **slot) {
+    port_timer_t *list = *slot;
+    *slot = NULL;
+    while (list != NULL) {
+        port_timer_t *timer = list;
+        DL_DELETE(list, timer);
+        wheel_add(timer);
+    }
+}
+
+void port_timer_wheel_init(void) {
+    memset(lvl0, 0, sizeof(lvl0));
+    memset(lvl1, 0, sizeof(lvl1));
+    memset(lvl2, 0, sizeof(lvl2));
+    expired = NULL;
+    wheel_ticks = now_ticks();
+}
+
+void port_timer_init(port_timer_t *timer, port_timer_cb cb, void *arg) {
+    memset(timer, 0, sizeof(port_timer_t));
+    timer->cb = cb;
+    timer->arg = arg;
+}
+
+void port_timer_start(port_timer_t *timer, uint32_t delay_ms, uint32_t period_ms) {
+    if (timer->pending) {
+        list_remove(timer);
+    }
+    /* Round up, so that a timer never fires early */
+    timer->expires = now_ticks() + (delay_ms + PORT_TIMER_TICK_MS - 1) / PORT_TIMER_TICK_MS;
+    timer->period = (period_ms + PORT_TIMER_TICK_MS - 1) / PORT_TIMER_TICK_MS;
+    if (period_ms > 0 && timer->period == 0) {
+        timer->period = 1;
+    }
+    timer->pending = true;
+    wheel_add(timer);
+}
+
+void port_timer_stop(port_timer_t *timer) {
+    if (!timer->pending) {
+        return;
+    }
+    list_remove(timer);
+    timer->pending = false;
+}
+
+bool port_timer_is_pending(const port_timer_t *timer) {
+    return timer->pending;
+}
+
+void port_timer_run(void) {
+    uint32_t now = now_ticks();
+
+    while (!ticks_before(now, wheel_ticks)) {
+        int index = wheel_ticks & LVL0_MASK;
+        if (index == 0) {
+            int lvl1_index = (wheel_ticks >> LVL1_SHIFT) & LVLN_MASK;
+            if (lvl1_index == 0) {
+                cascade(&lvl2[(wheel_ticks >> LVL2_SHIFT) & LVLN_MASK]);
+            }
+            cascade(&lvl1[lvl1_index]);
+        }
+
+        /* Move the slot to the expired list first, so that callbacks can freely start and stop timers */
+        while (lvl0[index] != NULL) {
+            port_timer_t *timer = lvl0[index];
+            list_remove(timer);
+            list_add(&expired, timer);
+        }
+        wheel_ticks++;
+
+        while (expired != NULL) {
+            port_timer_t *timer = expired;
+            list_remove(timer);
+            if (timer->period > 0) {
+                timer->expires += timer->period;
+                if (!ticks_before(now, timer->expires)) {
+                    /* We have been late for more than a period, don't try to catch up with a burst of callbacks */
+                    timer->expires = now + timer->period;
+                }
+                wheel_add(timer);
+            }
+            else {
+                timer->pending = false;
+            }
+            timer->cb(timer->arg);
+        }
+    }
+}
+
+/* Earliest expiry among the timers of a list */
+static bool list_min_expiry(port_timer_t *list, uint32_t *min) {
+    port_timer_t *timer;
+    bool found = false;
+    DL_FOREACH(list, timer) {
+        if (!found || ticks_before(timer->expires, *min)) {
+            *min = timer->expires;
+            found = true;
+        }
+    }
+    return found;
+}
+
+/* Earliest expiry in a higher level, whose slots are examined in time order starting from the one after the current position */
+static bool level_min_expiry(port_timer_t **level, int current, uint32_t *min) {
+    for (int i = 1; i <= LVLN_SIZE; i++) {
+        if (list_min_expiry(level[(current + i) & LVLN_MASK], min)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t port_timer_next_timeout_ms(uint32_t max_ms) {
+    uint32_t next = 0;
+    bool found = false;
+
+    /* In level 0, the slot position alone gives the expiry */
+    for (int i = 0; i < LVL0_SIZE; i++) {
+        if (lvl0[(wheel_ticks + i) & LVL0_MASK] != NULL) {
+            next = wheel_ticks + i;
+            found = true;
+            break;
+        }
+    }
+
+    /* The higher levels are checked also when level 0 has a timer: once the level 0 position wraps around, a timer in the next
+     * level 1 slot, which is cascaded then, expires before the timers in the rest of level 0 */
+    uint32_t lvl_min;
+    if (level_min_expiry(lvl1, (wheel_ticks >> LVL1_SHIFT) & LVLN_MASK, &lvl_min)) {
+        if (!found || ticks_before(lvl_min, next)) {
+            next = lvl_min;
+            found = true;
+        }
+    }
+    if (level_min_expiry(lvl2, (wheel_ticks >> LVL2_SHIFT) & LVLN_MASK, &lvl_min)) {
+        if (!found || ticks_before(lvl_min, next)) {
+            next = lvl_min;
+            found = true;
+        }
+    }
+
+    if (!found) {
+        return max_ms;
+    }
+
+    uint32_t now = now_ticks();
+    if (!ticks_before(now, next)) {
+        return 0;
+    }
+    uint32_t timeout_ms = (next - now) * PORT_TIMER_TICK_MS;
+    return timeout_ms < max_ms ? timeout_ms : max_ms;
+}
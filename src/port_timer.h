@@ -0,0 +1,92 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file port_timer.h
+ * @brief Hierarchical timer wheel for the periodic work of the port and of the apps running in the Mist main loop.
+ *
+ * Timers are run by mist_port_esp32_periodic(), in the context of the task running the main loop, so the callbacks may call into
+ * Wish and Mist. The time until the nearest deadline is used as the select() timeout, so that the main loop neither wakes up
+ * needlessly nor fires timers late.
+ *
+ * The port_timer_t structures are owned by the caller, and must stay valid while the timer is pending. Usually they are static.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** The resolution of the timer wheel, in milliseconds */
+#ifndef PORT_TIMER_TICK_MS
+#define PORT_TIMER_TICK_MS 10
+#endif
+
+typedef void (*port_timer_cb)(void *arg);
+
+typedef struct port_timer {
+    /* Internal state, initialised by port_timer_init() */
+    struct port_timer *prev;
+    struct port_timer *next;
+    /* The list head of the wheel slot where the timer currently is */
+    struct port_timer **list;
+    /* Expiry time, in wheel ticks */
+    uint32_t expires;
+    /* Period in wheel ticks, 0 for a one-shot timer */
+    uint32_t period;
+    bool pending;
+    port_timer_cb cb;
+    void *arg;
+} port_timer_t;
+
+/**
+ * Initialise the timer wheel. This is called by mist_port_esp32_init(), before any timer can be started.
+ */
+void port_timer_wheel_init(void);
+
+/**
+ * Initialise a timer structure.
+ *
+ * @param timer The timer
+ * @param cb The function to call when the timer expires
+ * @param arg The argument to pass to cb
+ */
+void port_timer_init(port_timer_t *timer, port_timer_cb cb, void *arg);
+
+/**
+ * Start, or restart, a timer.
+ *
+ * @param timer An initialised timer. If it is already pending, it is rescheduled.
+ * @param delay_ms Time until the first expiry
+ * @param period_ms The period of a repeating timer, or 0 for a one-shot timer
+ */
+void port_timer_start(port_timer_t *timer, uint32_t delay_ms, uint32_t period_ms);
+
+/**
+ * Stop a timer. Stopping a timer that is not pending is harmless. A timer may stop itself, or any other timer, from its callback.
+ */
+void port_timer_stop(port_timer_t *timer);
+
+bool port_timer_is_pending(const port_timer_t *timer);
+
+/**
+ * Run the callbacks of all timers which have expired. Called by the main loop.
+ */
+void port_timer_run(void);
+
+/**
+ * Get the time until the nearest timer deadline.
+ *
+ * @param max_ms The upper limit for the returned value
+ * @return The milliseconds until the next timer expires, or max_ms if there is no timer expiring sooner. 0 if a timer has already
+ * expired.
+ */
+uint32_t port_timer_next_timeout_ms(uint32_t max_ms);
@@ -0,0 +1,166 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "lwip/udp.h"
+#include "lwip/pbuf.h"
+#endif
+
+#include "port_wakeup.h"
+#include "port_reactor.h"
+#include "port_net.h"
+#include "port_log.h"
+
+#define TAG "port_wakeup"
+
+static int wakeup_fd = -1;
+
+/* Set when a wakeup has been sent and not yet drained. Written by the signaling tasks and the reactor task. */
+static uint8_t wakeup_pending = 0;
+
+/* Returns true if the caller should send the wakeup, i.e. there is none in flight */
+static bool claim_wakeup(void) {
+    return __atomic_exchange_n(&wakeup_pending, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+/* Called when the claimed wakeup could not be sent, so that the next signal tries again instead of being skipped forever */
+static void release_wakeup(void) {
+    __atomic_store_n(&wakeup_pending, 0, __ATOMIC_RELEASE);
+}
+
+#ifdef __linux__
+
+static int create_wakeup_fd(void) {
+    return eventfd(0, EFD_NONBLOCK);
+}
+
+void port_wakeup_signal(void) {
+    if (wakeup_fd < 0 || !claim_wakeup()) {
+        return;
+    }
+    uint64_t one = 1;
+    if (write(wakeup_fd, &one, sizeof(one)) < 0) {
+        PORT_LOGERR(TAG, "write: %s", strerror(errno));
+        release_wakeup();
+    }
+}
+
+void port_wakeup_signal_from_lwip(void) {
+    /* There is no lwIP thread on the host */
+    port_wakeup_signal();
+}
+
+static void drain_fd(void) {
+    uint64_t count;
+    while (read(wakeup_fd, &count, sizeof(count)) > 0);
+}
+
+#else
+
+/* The address the wakeup socket is bound to. Only loopback traffic can reach it. */
+static struct sockaddr_in wakeup_addr;
+static struct udp_pcb *lwip_pcb = NULL;
+
+static int create_wakeup_fd(void) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t addr_len = sizeof(addr);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || getsockname(fd, (struct sockaddr *) &addr, &addr_len) < 0) {
+        close(fd);
+        return -1;
+    }
+    wakeup_addr = addr;
+    socket_set_nonblocking(fd);
+    return fd;
+}
+
+void port_wakeup_signal(void) {
+    if (wakeup_fd < 0 || !claim_wakeup()) {
+        return;
+    }
+    uint8_t b = 0;
+    if (sendto(wakeup_fd, &b, 1, 0, (struct sockaddr *) &wakeup_addr, sizeof(wakeup_addr)) < 0) {
+        PORT_LOGERR(TAG, "sendto: %s", strerror(errno));
+        release_wakeup();
+    }
+}
+
+void port_wakeup_signal_from_lwip(void) {
+    if (wakeup_fd < 0 || !claim_wakeup()) {
+        return;
+    }
+    /* A socket API call from the lwIP thread would wait for the lwIP thread itself, so the raw API is used instead */
+    if (lwip_pcb == NULL) {
+        lwip_pcb = udp_new();
+        if (lwip_pcb == NULL) {
+            PORT_LOGERR(TAG, "udp_new failed");
+            release_wakeup();
+            return;
+        }
+    }
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, 1, PBUF_RAM);
+    if (p == NULL) {
+        PORT_LOGERR(TAG, "pbuf_alloc failed");
+        release_wakeup();
+        return;
+    }
+    ((uint8_t *) p->payload)[0] = 0;
+    ip_addr_t loopback;
+    IP_ADDR4(&loopback, 127, 0, 0, 1);
+    err_t err = udp_sendto(lwip_pcb, p, &loopback, ntohs(wakeup_addr.sin_port));
+    pbuf_free(p);
+    if (err != ERR_OK) {
+        PORT_LOGERR(TAG, "udp_sendto failed: %i", err);
+        release_wakeup();
+    }
+}
+
+static void drain_fd(void) {
+    uint8_t buf[8];
+    while (recv(wakeup_fd, buf, sizeof(buf), 0) > 0);
+}
+
+#endif //__linux__
+
+int port_wakeup_init(void) {
+    wakeup_fd = create_wakeup_fd();
+    if (wakeup_fd < 0) {
+        PORT_LOGERR(TAG, "Could not create wakeup socket: %s", strerror(errno));
+        return -1;
+    }
+    port_net_watch(wakeup_fd, PORT_REACTOR_READ, PORT_REACTOR_KIND_WAKEUP, NULL);
+    return 0;
+}
+
+void port_wakeup_drain(void) {
+    drain_fd();
+    /* Cleared only after draining: a signal sent in between is skipped, but the caller looks at the queues after this anyway */
+    __atomic_store_n(&wakeup_pending, 0, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,46 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file port_wakeup.h
+ * @brief Wakeup channel for interrupting the reactor wait from other tasks.
+ *
+ * The channel is a socket registered in the reactor: a loopback UDP socket connected to itself on lwIP, and an eventfd on a Linux
+ * host build. A task which has queued work for the task blocking in port_reactor_wait() calls port_wakeup_signal() after queueing,
+ * and the wait returns a PORT_REACTOR_KIND_WAKEUP event. Signals are coalesced, so that only one datagram is in flight at a time.
+ *
+ * The task owning the reactor must call port_wakeup_drain() when the wakeup event is returned, and only after that look at the
+ * queues, so that no signal is lost.
+ */
+
+/**
+ * Create the wakeup socket and register it to the reactor. Called by mist_port_esp32_init().
+ *
+ * @return 0 for success, -1 on error
+ */
+int port_wakeup_init(void);
+
+/**
+ * Wake up the task waiting in port_reactor_wait(). May be called from any task, except from the lwIP thread.
+ */
+void port_wakeup_signal(void);
+
+/**
+ * Like port_wakeup_signal(), but for callbacks running in the lwIP thread, such as DNS results, where the socket API cannot be used.
+ */
+void port_wakeup_signal_from_lwip(void);
+
+/**
+ * Consume all pending wakeups. Called by the task owning the reactor, when the wakeup socket is readable.
+ */
+void port_wakeup_drain(void);
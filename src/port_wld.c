@@ -0,0 +1,268 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "wish_core.h"
+#include "wish_local_discovery.h"
+#include "port_wld.h"
+#include "port_main.h"
+#include "port_advert.h"
+#include "port_neighbours.h"
+#include "time_helper.h"
+
+struct seen_advert {
+    uint32_t digest;
+    /* Milliseconds since boot when the advert was last fed, 0 for a free slot */
+    uint32_t fed_ms;
+};
+
+static struct seen_advert seen[MIST_PORT_WLD_DEDUPE_SLOTS];
+
+/* Tokens are counted in thousandths, so that a rate of a few per second can be refilled every millisecond */
+#define TOKEN 1000
+
+struct token_bucket {
+    uint32_t tokens;
+    uint32_t refilled_ms;
+};
+
+struct source_bucket {
+    uint32_t ip;
+    uint16_t port;
+    bool in_use;
+    struct token_bucket bucket;
+};
+
+static struct source_bucket sources[MIST_PORT_WLD_SOURCE_SLOTS];
+static struct token_bucket global_bucket;
+static bool global_bucket_in_use = false;
+/* Set by mist_port_esp32_set_wld_rate_limit(), the buckets are reset by the task which checks the rates */
+static bool buckets_stale = false;
+
+static struct mist_port_esp32_wld_rate_limit rate_limit = {
+    .source_per_s = MIST_PORT_WLD_SOURCE_RATE,
+    .source_burst = MIST_PORT_WLD_SOURCE_BURST,
+    .global_per_s = MIST_PORT_WLD_GLOBAL_RATE,
+    .global_burst = MIST_PORT_WLD_GLOBAL_BURST,
+};
+
+static char class_filter[MIST_PORT_WLD_CLASS_FILTER_MAX][MIST_PORT_WLD_CLASS_MAX_LEN];
+static unsigned int num_class_filter = 0;
+
+/* In dual-core mode, received and rate_limited_* are written by the I/O task, and the rest by the protocol task */
+static struct mist_port_esp32_wld_stats wld_stats;
+
+/* FNV-1a */
+static uint32_t digest_update(uint32_t h, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        h ^= data[i];
+        h *= 16777619UL;
+    }
+    return h;
+}
+
+static uint32_t digest_advert(const wish_ip_addr_t *ip, uint16_t port, const uint8_t *data, size_t len) {
+    uint8_t port_bytes[2] = { port >> 8, port & 0xff };
+    uint32_t h = 2166136261UL;
+    h = digest_update(h, ip->addr, sizeof(ip->addr));
+    h = digest_update(h, port_bytes, sizeof(port_bytes));
+    return digest_update(h, data, len);
+}
+
+/* The string element is found without parsing the BSON document: the element type 0x02, the key, and the length of the string
+ * including its terminating zero */
+const char *port_wld_find_string(const uint8_t *data, size_t len, const char *key, size_t *str_len) {
+    size_t key_len = strlen(key) + 1;
+    for (size_t i = 0; i + 1 + key_len + 4 < len; i++) {
+        if (data[i] != 0x02 || memcmp(&data[i + 1], key, key_len) != 0) {
+            continue;
+        }
+        const uint8_t *p = &data[i + 1 + key_len];
+        uint32_t bson_len = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+        if (bson_len == 0 || bson_len > len - (i + 1 + key_len + 4) || p[4 + bson_len - 1] != 0) {
+            return NULL;
+        }
+        *str_len = bson_len - 1;
+        return (const char *) &p[4];
+    }
+    return NULL;
+}
+
+static bool class_wanted(const uint8_t *data, size_t len) {
+    if (num_class_filter == 0) {
+        return true;
+    }
+    size_t class_len;
+    const char *advert_class = port_wld_find_string(data, len, "class", &class_len);
+    if (advert_class == NULL) {
+        /* Cannot tell, let the core decide */
+        return true;
+    }
+    for (unsigned int i = 0; i < num_class_filter; i++) {
+        if (strlen(class_filter[i]) == class_len && memcmp(class_filter[i], advert_class, class_len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint32_t now_ms(void) {
+    return (uint32_t) (time_helper_monotonic_us() / 1000);
+}
+
+/* Take a token from the bucket, if there is one, after refilling it for the time since the last refill */
+static bool take_token(struct token_bucket *b, uint32_t per_s, uint32_t burst, uint32_t now) {
+    uint32_t elapsed_ms = now - b->refilled_ms;
+    uint32_t max_tokens = burst * TOKEN;
+    /* per_s tokens per second is per_s thousandths of a token per millisecond */
+    if (elapsed_ms >= max_tokens / (per_s ? per_s : 1)) {
+        b->tokens = max_tokens;
+    }
+    else {
+        b->tokens += elapsed_ms * per_s;
+        if (b->tokens > max_tokens) {
+            b->tokens = max_tokens;
+        }
+    }
+    b->refilled_ms = now;
+    if (b->tokens < TOKEN) {
+        return false;
+    }
+    b->tokens -= TOKEN;
+    return true;
+}
+
+static struct token_bucket *get_source_bucket(const wish_ip_addr_t *ip, uint16_t port, uint32_t now) {
+    uint32_t addr;
+    memcpy(&addr, ip->addr, sizeof(addr));
+    struct source_bucket *lru = &sources[0];
+    for (int i = 0; i < MIST_PORT_WLD_SOURCE_SLOTS; i++) {
+        if (sources[i].in_use && sources[i].ip == addr && sources[i].port == port) {
+            return &sources[i].bucket;
+        }
+        if (!sources[i].in_use || (lru->in_use && now - sources[i].bucket.refilled_ms > now - lru->bucket.refilled_ms)) {
+            lru = &sources[i];
+        }
+    }
+    /* A new source starts with a full bucket */
+    lru->in_use = true;
+    lru->ip = addr;
+    lru->port = port;
+    lru->bucket.tokens = rate_limit.source_burst * TOKEN;
+    lru->bucket.refilled_ms = now;
+    return &lru->bucket;
+}
+
+bool port_wld_within_rate(const wish_ip_addr_t *ip, uint16_t port) {
+    wld_stats.received++;
+    if (__atomic_exchange_n(&buckets_stale, false, __ATOMIC_ACQUIRE)) {
+        /* Start over with full buckets */
+        memset(sources, 0, sizeof(sources));
+        global_bucket_in_use = false;
+    }
+    uint32_t now = now_ms();
+    if (!take_token(get_source_bucket(ip, port, now), rate_limit.source_per_s, rate_limit.source_burst, now)) {
+        wld_stats.rate_limited_source++;
+        return false;
+    }
+    if (!global_bucket_in_use) {
+        global_bucket_in_use = true;
+        global_bucket.tokens = rate_limit.global_burst * TOKEN;
+        global_bucket.refilled_ms = now;
+    }
+    if (!take_token(&global_bucket, rate_limit.global_per_s, rate_limit.global_burst, now)) {
+        wld_stats.rate_limited_global++;
+        return false;
+    }
+    return true;
+}
+
+/* Returns true if the same advert was fed within the window, and remembers it otherwise */
+static bool is_duplicate(uint32_t digest) {
+    /* 0 marks a free slot */
+    uint32_t now = now_ms() | 1;
+    struct seen_advert *slot = &seen[digest & (MIST_PORT_WLD_DEDUPE_SLOTS - 1)];
+    if (slot->fed_ms != 0 && slot->digest == digest && now - slot->fed_ms < MIST_PORT_WLD_DEDUPE_WINDOW_MS) {
+        return true;
+    }
+    /* A colliding advert takes over the slot */
+    slot->digest = digest;
+    slot->fed_ms = now;
+    return false;
+}
+
+void port_wld_feed(wish_core_t *core, wish_ip_addr_t *ip, uint16_t port, uint8_t *data, size_t len) {
+    /* Also the adverts which the core does not get keep their host in the neighbour table */
+    uint32_t digest = digest_advert(ip, port, data, len);
+    bool new_peer = port_neighbours_heard(ip, port, digest, data, len);
+    if (!class_wanted(data, len)) {
+        wld_stats.filtered++;
+        return;
+    }
+    if (is_duplicate(digest)) {
+        wld_stats.duplicates++;
+        return;
+    }
+    wld_stats.fed++;
+    wish_ldiscover_feed(core, ip, port, data, len);
+    if (new_peer) {
+        /* A peer which has just come up advertises itself, and is looking for others */
+        port_advert_trigger();
+    }
+}
+
+int mist_port_esp32_set_wld_class_filter(const char *const *classes, unsigned int num_classes) {
+    if (num_classes > MIST_PORT_WLD_CLASS_FILTER_MAX) {
+        return -1;
+    }
+    for (unsigned int i = 0; i < num_classes; i++) {
+        if (strlen(classes[i]) >= MIST_PORT_WLD_CLASS_MAX_LEN) {
+            return -1;
+        }
+    }
+    for (unsigned int i = 0; i < num_classes; i++) {
+        strcpy(class_filter[i], classes[i]);
+    }
+    num_class_filter = num_classes;
+    return 0;
+}
+
+void mist_port_esp32_get_wld_stats(struct mist_port_esp32_wld_stats *stats) {
+    *stats = wld_stats;
+    port_neighbours_get_stats(stats);
+}
+
+/* Keeps the milli-tokens of a bucket within uint32_t */
+#define MAX_RATE 1000000
+
+static uint32_t rate_or_default(uint32_t value, uint32_t default_value) {
+    if (value == 0) {
+        return default_value;
+    }
+    return value < MAX_RATE ? value : MAX_RATE;
+}
+
+void mist_port_esp32_set_wld_rate_limit(const struct mist_port_esp32_wld_rate_limit *limit) {
+    rate_limit.source_per_s = rate_or_default(limit->source_per_s, MIST_PORT_WLD_SOURCE_RATE);
+    rate_limit.source_burst = rate_or_default(limit->source_burst, MIST_PORT_WLD_SOURCE_BURST);
+    rate_limit.global_per_s = rate_or_default(limit->global_per_s, MIST_PORT_WLD_GLOBAL_RATE);
+    rate_limit.global_burst = rate_or_default(limit->global_burst, MIST_PORT_WLD_GLOBAL_BURST);
+    /* In dual-core mode, the buckets belong to the I/O task */
+    __atomic_store_n(&buckets_stale, true, __ATOMIC_RELEASE);
+}
+
+void mist_port_esp32_get_wld_rate_limit(struct mist_port_esp32_wld_rate_limit *limit) {
+    *limit = rate_limit;
+}
@@ -0,0 +1,112 @@
+/**
+ * Copyright (C) 2020, ControlThings Oy Ab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * @license Apache-2.0
+ */
+#pragma once
+
+/**
+ * @file port_wld.h
+ * @brief Filtering of incoming Wish local discovery adverts.
+ *
+ * Peers rebroadcast the same advert every few seconds, and on a busy LAN most of them are of classes the application does not care
+ * about. Before an advert is given to wish_ldiscover_feed(), which parses all of it, it is checked against a table of digests of
+ * recently fed adverts, and its class against the class filter set with mist_port_esp32_set_wld_class_filter(). Both checks look
+ * at the raw datagram only.
+ *
+ * Before that, the datagrams are rate limited with token buckets, one per source address and one for all, so that a host flooding
+ * the local discovery port costs little more than the reads. In dual-core mode, the I/O task checks the rates, and a datagram over
+ * them does not take room in the receive ring from the Wish connections. A source which keeps within its rate is not affected by a
+ * flood from another source, unless the flood comes from more sources than there are buckets.
+ *
+ * A source is an address and a port, so that several Wish cores on one host each have a bucket. A core sends the adverts of all its
+ * identities from the same port in one round, so the burst of a source must be at least the number of identities of the peers:
+ * the adverts of a round which do not fit in the burst are dropped, every round.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "wish_core.h"
+#include "wish_ip_addr.h"
+
+/** The number of digests of recently fed adverts which are remembered, a power of two */
+#ifndef MIST_PORT_WLD_DEDUPE_SLOTS
+#define MIST_PORT_WLD_DEDUPE_SLOTS 32
+#endif
+
+/** An advert identical to one fed from the same source within this many milliseconds is dropped. Keep this shorter than the time
+ * the core keeps a local discovery entry without hearing from the peer. */
+#ifndef MIST_PORT_WLD_DEDUPE_WINDOW_MS
+#define MIST_PORT_WLD_DEDUPE_WINDOW_MS 10000
+#endif
+
+/** The maximum number of classes in the class filter */
+#ifndef MIST_PORT_WLD_CLASS_FILTER_MAX
+#define MIST_PORT_WLD_CLASS_FILTER_MAX 4
+#endif
+
+/** The maximum length of a class in the class filter, including the terminating zero */
+#ifndef MIST_PORT_WLD_CLASS_MAX_LEN
+#define MIST_PORT_WLD_CLASS_MAX_LEN 64
+#endif
+
+/** The number of sources, address and port, which have a token bucket of their own. The least recently heard one gives its bucket
+ * to a new source. */
+#ifndef MIST_PORT_WLD_SOURCE_SLOTS
+#define MIST_PORT_WLD_SOURCE_SLOTS 16
+#endif
+
+/** Default for mist_port_esp32_wld_rate_limit.source_per_s */
+#ifndef MIST_PORT_WLD_SOURCE_RATE
+#define MIST_PORT_WLD_SOURCE_RATE 2
+#endif
+
+/** Default for mist_port_esp32_wld_rate_limit.source_burst. Peers with more identities than this lose some of their adverts. */
+#ifndef MIST_PORT_WLD_SOURCE_BURST
+#define MIST_PORT_WLD_SOURCE_BURST 5
+#endif
+
+/** Default for mist_port_esp32_wld_rate_limit.global_per_s */
+#ifndef MIST_PORT_WLD_GLOBAL_RATE
+#define MIST_PORT_WLD_GLOBAL_RATE 20
+#endif
+
+/** Default for mist_port_esp32_wld_rate_limit.global_burst */
+#ifndef MIST_PORT_WLD_GLOBAL_BURST
+#define MIST_PORT_WLD_GLOBAL_BURST 40
+#endif
+
+/** The maximum number of datagrams read from the local discovery socket per wakeup */
+#ifndef MIST_PORT_WLD_DRAIN_MAX
+#define MIST_PORT_WLD_DRAIN_MAX 16
+#endif
+
+/**
+ * Find a string element of a local discovery advert, "W." and a BSON document, by scanning the raw datagram.
+ *
+ * @param str_len Set to the length of the string, without the terminating zero
+ * @return The string, which is zero terminated, or NULL if there is no such element
+ */
+const char *port_wld_find_string(const uint8_t *data, size_t len, const char *key, size_t *str_len);
+
+/**
+ * Check a received local discovery datagram against the rates of its source and of all sources, and take a token from both. Call
+ * this right after reading the datagram: one over the rates is dropped before anything else is done with it.
+ *
+ * @return true if the datagram is within the rates, and should be given to port_wld_feed()
+ */
+bool port_wld_within_rate(const wish_ip_addr_t *ip, uint16_t port);
+
+/**
+ * Give a local discovery datagram which is within the rates to the core, unless it is a duplicate of a recently fed one, or its
+ * class is filtered out.
+ */
+void port_wld_feed(wish_core_t *core, wish_ip_addr_t *ip, uint16_t port, uint8_t *data, size_t len);
@@ -29,11 +29,12 @@
 #include "wish_connection.h"
 #include "port_dns.h"
 #include "port_relay_client.h"
+#include "port_net.h"
+#include "port_sockopt.h"
+#include "utlist.h"
 
 #define TAG "port relay_client"
 
-void socket_set_nonblocking(int sockfd);
-
 /* Function used by Wish to send data over the Relay control connection
  * */
 int relay_send(int relay_sockfd, unsigned char* buffer, int len) {
@@ -88,6 +89,9 @@ void port_relay_client_open(wish_core_t *core, wish_relay_client_t* relay, wish_
         return;
     }
     socket_set_nonblocking(relay->sockfd);
+    port_sockopt_apply(relay->sockfd, MIST_PORT_SOCKET_RELAY_CONTROL);
+    /* Wait for the connect() to complete */
+    port_net_watch(relay->sockfd, PORT_REACTOR_WRITE, PORT_REACTOR_KIND_RELAY, relay);
 
     relay_serv_addr.sin_family = AF_INET;
     char ip_str[12+3+1] = { 0 };
@@ -112,8 +116,37 @@ void port_relay_client_open(wish_core_t *core, wish_relay_client_t* relay, wish_
 }
 
 void wish_relay_client_close(wish_core_t* core, wish_relay_client_t *relay) {
-    close(relay->sockfd);
+    port_net_close_socket(relay->sockfd);
     relay_ctrl_disconnect_cb(core, relay);
 }
 
+/* The relay control connection has a socket in these states */
+static bool relay_has_socket(wish_relay_client_t *relay) {
+    return relay->curr_state == WISH_RELAY_CLIENT_CONNECTING || relay->curr_state == WISH_RELAY_CLIENT_OPEN
+            || relay->curr_state == WISH_RELAY_CLIENT_WAIT;
+}
+
+int port_relay_client_close_all(wish_core_t *core) {
+    int num_closed = 0;
+    wish_relay_client_t *relay;
+    LL_FOREACH(core->relay_db, relay) {
+        if (relay_has_socket(relay)) {
+            wish_relay_client_close(core, relay);
+            num_closed++;
+        }
+    }
+    return num_closed;
+}
 
+void port_relay_client_reconnect_all(wish_core_t *core) {
+    wish_relay_client_t *relay;
+    LL_FOREACH(core->relay_db, relay) {
+        if (relay->curr_state != WISH_RELAY_CLIENT_WAIT_RECONNECT && relay->curr_state != WISH_RELAY_CLIENT_INITIAL) {
+            continue;
+        }
+        ESP_LOGI(TAG, "Reconnecting relay %s", relay->host);
+        uint8_t relay_uid[WISH_ID_LEN];
+        memcpy(relay_uid, relay->uid, WISH_ID_LEN);
+        wish_relay_client_open(core, relay, relay_uid);
+    }
+}
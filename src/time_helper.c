@@ -15,8 +15,17 @@
  * and open the template in the editor.
  */
 
+#include <stdint.h>
 #include <sys/time.h>
 
+#ifdef __linux__
+#include <time.h>
+#else
+#include "esp_timer.h"
+#endif
+
+#include "time_helper.h"
+
 /* Subtract the ‘struct timeval’ values X and Y,
    storing the result in RESULT.
    Return 1 if the difference is negative, otherwise 0. */
@@ -42,4 +51,18 @@ double timeval_subtract (struct timeval *result, struct timeval *x, struct timev
   /* Return 1 if result is negative. */
   //return x->tv_sec < y->tv_sec;
   return result->tv_sec + (double)result->tv_usec / 1000000.0;
-}
\ No newline at end of file
+}
+
+int64_t time_helper_monotonic_us(void) {
+#ifdef __linux__
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    return esp_timer_get_time();
+#endif
+}
+
+uint32_t time_helper_monotonic_ms(void) {
+    return (uint32_t) (time_helper_monotonic_us() / 1000);
+}
@@ -25,12 +25,26 @@
 #ifndef TIME_HELPER_H
 #define TIME_HELPER_H
 
+#include <stdint.h>
+#include <sys/time.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
     double timeval_subtract (struct timeval *result, struct timeval *x, struct timeval *y);
 
+    /**
+     * Get the time elapsed since boot, in microseconds. Unlike time(), this is not affected by changes of the wall clock.
+     */
+    int64_t time_helper_monotonic_us(void);
+
+    /**
+     * Get the time elapsed since boot, in milliseconds. The value wraps around after 49 days, so compare timestamps only by
+     * subtracting them.
+     */
+    uint32_t time_helper_monotonic_ms(void);
+
 
 #ifdef __cplusplus
 }
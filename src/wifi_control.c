@@ -32,6 +32,7 @@
 #endif //WITHOUT_MIST_CONFIG_APP
 
 #include "led_gpio.h"
+#include "port_main.h"
 
 #define TAG "wifi_control"
 
@@ -76,6 +77,7 @@ esp_err_t event_handler(void *ctx, system_event_t *event)
         break;
     case SYSTEM_EVENT_STA_GOT_IP:
         ESP_LOGI(TAG, "Got IP");
+        mist_port_esp32_link_up(event->event_info.got_ip.ip_info.ip.addr);
         xEventGroupSetBits(wifi_event_group, CONNECTED_BIT);
         led_gpio_set_state(BLINK_NETWORK_OK);
         wifi_control_state = WIFI_CONTROL_STA_CONNECTED;
@@ -85,6 +87,7 @@ esp_err_t event_handler(void *ctx, system_event_t *event)
         break;
     case SYSTEM_EVENT_STA_DISCONNECTED:
         ESP_LOGI(TAG, "SYSTEM_EVENT_STA_DISCONNECTED");
+        mist_port_esp32_link_down();
         /* This is a workaround as ESP32 WiFi libs don't currently
            auto-reassociate. */
         led_gpio_set_state(BLINK_JOINING);
@@ -113,6 +116,10 @@ esp_err_t event_handler(void *ctx, system_event_t *event)
             esp_wifi_connect();
         }
      
+        break;
+    case SYSTEM_EVENT_STA_LOST_IP:
+        ESP_LOGI(TAG, "SYSTEM_EVENT_STA_LOST_IP");
+        mist_port_esp32_ip_lost();
         break;
     case SYSTEM_EVENT_AP_START:
         ESP_LOGI(TAG, "AP started, wifi state %i", wifi_control_state);
@@ -121,6 +128,7 @@ esp_err_t event_handler(void *ctx, system_event_t *event)
         if (wifi_control_state == WIFI_CONTROL_COMMISSIONING_AP_WAIT_ACTIVATION) {
             wifi_control_state = WIFI_CONTROL_COMMISSIONING_AP_STARTED;
             ap_started_ts = current_time;
+            mist_port_esp32_advert_burst();
             led_gpio_set_state(BLINK_COMMISSIONING);
         }
         else {
@@ -133,10 +141,13 @@ esp_err_t event_handler(void *ctx, system_event_t *event)
         ap_started_ts = current_time;
         ap_num_stations_connected++;
         ESP_LOGI(TAG, "Detected station connect, count is now %i", ap_num_stations_connected);
+        mist_port_esp32_ap_stations_changed();
+        mist_port_esp32_advert_burst();
         break;
     case SYSTEM_EVENT_AP_STADISCONNECTED:
         ap_num_stations_connected--;
         ESP_LOGI(TAG, "Detected station disconnect, count is now %i", ap_num_stations_connected);
+        mist_port_esp32_ap_stations_changed();
         break;
     case SYSTEM_EVENT_SCAN_DONE:
         ESP_LOGI(TAG, "Wifi scan complete");
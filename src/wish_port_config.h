@@ -37,7 +37,8 @@
 #endif
 
 /** This defines the maximum number of entries in the Wish local discovery table (4).
- * You should make sure that in the worst case any message will fit into WISH_PORT_RPC_BUFFFER_SZ  */
+ * You should make sure that in the worst case any message will fit into WISH_PORT_RPC_BUFFFER_SZ, as wld.list replies with all of
+ * them in one buffer. The port keeps a larger table of the hosts heard advertising, see src/port_neighbours.h. */
 #define WISH_LOCAL_DISCOVERY_MAX ( 4 ) /* wld.list: 64 local discoveries should fit in 16k RPC buffer size */
 
 /** This defines the maximum number of uids in database (max number of identities + contacts) (4) 